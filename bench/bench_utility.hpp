@@ -0,0 +1,129 @@
+#ifndef SJTU_BENCH_UTILITY_HPP
+#define SJTU_BENCH_UTILITY_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <latch>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A small benchmark harness: every case runs a fixed number of operations on
+// some threads, times each operation, and counts the heap allocations it makes
+// through the replaced global operator new below. Include this header from one
+// translation unit only.
+
+namespace bench {
+    // Allocations made by the current thread.
+    inline thread_local long allocations = 0;
+
+    struct Result {
+        std::string name;
+        int threads;
+        size_t ops;
+        double seconds;
+        // Latency percentiles of one operation, in nanoseconds.
+        uint64_t p50;
+        uint64_t p99;
+        uint64_t p999;
+        double allocations_per_op;
+    };
+
+    inline auto Percentile(std::vector<uint64_t> &sorted, double p) -> uint64_t {
+        if (sorted.empty()) return 0;
+        return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * static_cast<double>(sorted.size())))];
+    }
+
+    // Run op(thread, i) for i in [0, ops_per_thread) on each of threads threads,
+    // all started together.
+    template<class Op>
+    auto Run(const std::string &name, int threads, size_t ops_per_thread, Op &&op) -> Result {
+        std::vector<std::vector<uint64_t> > latencies(threads);
+        std::vector<long> allocated(threads);
+        std::latch start(threads + 1);
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                std::vector<uint64_t> &own = latencies[t];
+                own.reserve(ops_per_thread);
+                start.arrive_and_wait();
+                const long before = allocations;
+                for (size_t i = 0; i < ops_per_thread; ++i) {
+                    const auto begin = std::chrono::steady_clock::now();
+                    op(t, i);
+                    const auto end = std::chrono::steady_clock::now();
+                    own.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+                }
+                // The latency buffer was reserved up front, so this counts the
+                // operations alone.
+                allocated[t] = allocations - before;
+            });
+        }
+        const auto begin = std::chrono::steady_clock::now();
+        start.arrive_and_wait();
+        for (auto &worker: workers) {
+            worker.join();
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        std::vector<uint64_t> all;
+        long total_allocations = 0;
+        for (int t = 0; t < threads; ++t) {
+            all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+            total_allocations += allocated[t];
+        }
+        std::sort(all.begin(), all.end());
+        const size_t ops = ops_per_thread * threads;
+        return {name, threads, ops, seconds, Percentile(all, 0.50), Percentile(all, 0.99), Percentile(all, 0.999),
+                static_cast<double>(total_allocations) / static_cast<double>(ops)};
+    }
+
+    inline void PrintHeader() {
+        std::printf("%-44s %7s %12s %9s %9s %9s %10s\n", "case", "threads", "ops/s", "p50 ns", "p99 ns", "p999 ns",
+                    "allocs/op");
+    }
+
+    inline void Print(const Result &result) {
+        std::printf("%-44s %7d %12.0f %9llu %9llu %9llu %10.2f\n", result.name.c_str(), result.threads,
+                    static_cast<double>(result.ops) / result.seconds, static_cast<unsigned long long>(result.p50),
+                    static_cast<unsigned long long>(result.p99), static_cast<unsigned long long>(result.p999),
+                    result.allocations_per_op);
+        std::fflush(stdout);
+    }
+} // namespace bench
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void *operator new(size_t size) {
+    ++bench::allocations;
+    if (void *p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new(size_t size, std::align_val_t alignment) {
+    ++bench::allocations;
+    const size_t align = static_cast<size_t>(alignment);
+    if (void *p = std::aligned_alloc(align, (size + align - 1) / align * align)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+#endif  // SJTU_BENCH_UTILITY_HPP
@@ -0,0 +1,154 @@
+#include "bench_utility.hpp"
+#include "../trie/src.hpp"
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Benchmarks Trie and TrieStore operations. Usage:
+//   Cow_trie_bench [--quick] [filter...]
+// --quick runs a tenth of the operations; filters keep the cases whose name
+// contains any of them.
+
+using Integer = std::unique_ptr<uint32_t>;
+
+namespace {
+    bool quick = false;
+    std::vector<std::string> filters;
+
+    auto Selected(const std::string &name) -> bool {
+        if (filters.empty()) return true;
+        for (const auto &filter: filters) {
+            if (name.find(filter) != std::string::npos) return true;
+        }
+        return false;
+    }
+
+    auto Scaled(size_t ops) -> size_t { return quick ? ops / 10 : ops; }
+
+    // count distinct random keys of length bytes drawn from fanout distinct bytes.
+    auto Keys(size_t count, size_t length, int fanout, uint32_t seed) -> std::vector<std::string> {
+        std::mt19937 gen(seed);
+        std::unordered_set<std::string> seen;
+        std::vector<std::string> keys;
+        while (keys.size() < count) {
+            std::string key(length, '\0');
+            for (char &c: key) {
+                c = static_cast<char>(fanout == 256 ? gen() % 256 : 'a' + gen() % fanout);
+            }
+            if (seen.insert(key).second) {
+                keys.push_back(std::move(key));
+            }
+        }
+        return keys;
+    }
+
+    template<class T>
+    auto MakeValue(size_t i) -> T {
+        if constexpr (std::is_same_v<T, std::string>) {
+            return std::string(24, static_cast<char>('a' + i % 26));
+        } else if constexpr (std::is_same_v<T, Integer>) {
+            return std::make_unique<uint32_t>(static_cast<uint32_t>(i));
+        } else {
+            return static_cast<T>(i);
+        }
+    }
+
+    template<class Op>
+    void Case(const std::string &name, int threads, size_t ops, Op &&op) {
+        if (Selected(name)) {
+            bench::Print(bench::Run(name, threads, std::max<size_t>(1, ops / threads), op));
+        }
+    }
+
+    // Get, Put and Remove on one immutable trie of 10000 keys.
+    template<class T>
+    void TrieCases(const std::string &type, size_t length, int fanout) {
+        const std::string suffix = "/" + type + "/len" + std::to_string(length) + "/fanout" + std::to_string(fanout);
+        if (!Selected("Trie::Get" + suffix) && !Selected("Trie::Put" + suffix) && !Selected("Trie::Remove" + suffix)) {
+            return;
+        }
+        constexpr size_t kKeys = 10000;
+        const auto keys = Keys(2 * kKeys, length, fanout, 20230601);
+        sjtu::Trie base;
+        for (size_t i = 0; i < kKeys; ++i) {
+            base = base.Put<T>(keys[i], MakeValue<T>(i));
+        }
+        const size_t ops = Scaled(200000);
+        Case("Trie::Get" + suffix, 1, ops, [&](int, size_t i) {
+            if (base.Get<T>(keys[i % kKeys]) == nullptr) std::abort();
+        });
+        // Put keys that are not in the trie yet, so every op adds a leaf.
+        std::vector<T> values;
+        values.reserve(ops);
+        for (size_t i = 0; i < ops; ++i) {
+            values.push_back(MakeValue<T>(i));
+        }
+        Case("Trie::Put" + suffix, 1, ops, [&](int, size_t i) {
+            sjtu::Trie next = base.Put<T>(keys[kKeys + i % kKeys], std::move(values[i]));
+        });
+        Case("Trie::Remove" + suffix, 1, ops, [&](int, size_t i) {
+            sjtu::Trie next = base.Remove(keys[i % kKeys]);
+        });
+    }
+
+    // A TrieStore of 10000 int keys under a mix of reads and writes.
+    void StoreCases(int read_percent, int threads) {
+        const std::string name = "TrieStore/read" + std::to_string(read_percent);
+        if (!Selected(name)) return;
+        constexpr size_t kKeys = 10000;
+        const auto keys = Keys(kKeys, 16, 256, 20230602);
+        sjtu::TrieStore store(sjtu::RetentionPolicy{16});
+        for (size_t i = 0; i < kKeys; ++i) {
+            store.Put<int>(keys[i], static_cast<int>(i));
+        }
+        Case(name, threads, Scaled(100000), [&](int t, size_t i) {
+            const size_t k = (i * 7919 + static_cast<size_t>(t) * 104729) % kKeys;
+            if (static_cast<int>((i * 37 + static_cast<size_t>(t)) % 100) < read_percent) {
+                auto guard = store.Get<int>(keys[k]);
+            } else if (i % 2 == 0) {
+                store.Put<int>(keys[k], static_cast<int>(i));
+            } else {
+                store.Remove(keys[k]);
+            }
+        });
+    }
+
+    // Puts of non-copyable values into a store.
+    void StoreNonCopyableCase() {
+        const std::string name = "TrieStore::Put/unique_ptr";
+        if (!Selected(name)) return;
+        const auto keys = Keys(10000, 16, 256, 20230603);
+        sjtu::TrieStore store(sjtu::RetentionPolicy{16});
+        Case(name, 1, Scaled(100000), [&](int, size_t i) {
+            store.Put<Integer>(keys[i % keys.size()], std::make_unique<uint32_t>(static_cast<uint32_t>(i)));
+        });
+    }
+} // namespace
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--quick") == 0) {
+            quick = true;
+        } else {
+            filters.emplace_back(argv[i]);
+        }
+    }
+    bench::PrintHeader();
+    for (size_t length: {8, 32, 128}) {
+        for (int fanout: {4, 256}) {
+            TrieCases<int>("int", length, fanout);
+        }
+    }
+    TrieCases<std::string>("string", 32, 256);
+    TrieCases<Integer>("unique_ptr", 32, 256);
+    for (int read_percent: {100, 90, 50}) {
+        for (int threads: {1, 2, 4, 8, 16, 32, 64}) {
+            StoreCases(read_percent, threads);
+        }
+    }
+    StoreNonCopyableCase();
+    return 0;
+}
@@ -0,0 +1,217 @@
+#define SJTU_TRIE_STATS
+#include "bench_utility.hpp"
+#include "../trie/src.hpp"
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+// Measures how TrieStore read and write strategies scale with threads. Usage:
+//   Cow_trie_scale_bench [--quick] [--csv] [--threads N] [filter...]
+// Every case runs a read:write mix (99:1, 90:10, 50:50) over uniform or
+// Zipfian keys on 1, 2, 4, ... up to N threads (default: twice the hardware
+// threads). Reads are Gets of the newest version; the strategies differ in how
+// they write:
+//   store    TrieStore::Put, serialised on the write lock
+//   group    TrieStore::GroupCommit of one put, combined with concurrent ones
+//   async    TrieStore::PutAsync, waiting for its version
+//   sharded  ShardedTrieStore::Put on 16 hash-routed shards
+// Besides the latency percentiles, each case reports the write lock wait and
+// hold time per write from TrieStats. --csv prints comma-separated rows for
+// plotting; filters keep the cases whose name contains any of them.
+
+namespace {
+    bool quick = false;
+    bool csv = false;
+    std::vector<std::string> filters;
+
+    constexpr size_t kKeys = 100000;
+
+    auto Selected(const std::string &name) -> bool {
+        if (filters.empty()) return true;
+        for (const auto &filter: filters) {
+            if (name.find(filter) != std::string::npos) return true;
+        }
+        return false;
+    }
+
+    // The n-th key of the store.
+    auto Key(size_t n) -> std::string { return sjtu::EncodeKey(uint64_t{n * 0x9e3779b97f4a7c15ULL}); }
+
+    // Draws key numbers in [0, n) with P(k) proportional to 1 / (k + 1)^s, by a
+    // binary search of the cumulative distribution.
+    class Zipf {
+    public:
+        Zipf(size_t n, double s): cdf_(n) {
+            double sum = 0;
+            for (size_t k = 0; k < n; ++k) {
+                sum += 1.0 / std::pow(static_cast<double>(k + 1), s);
+                cdf_[k] = sum;
+            }
+            for (double &p: cdf_) {
+                p /= sum;
+            }
+        }
+
+        auto operator()(std::mt19937_64 &gen) const -> size_t {
+            const double u = std::uniform_real_distribution<double>(0, 1)(gen);
+            return std::min<size_t>(std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin(), cdf_.size() - 1);
+        }
+
+    private:
+        std::vector<double> cdf_;
+    };
+
+    // The key each operation of each thread uses and whether it writes, drawn up
+    // front so that drawing is not timed.
+    struct Plan {
+        std::vector<std::vector<uint32_t> > keys;
+        std::vector<std::vector<bool> > writes;
+    };
+
+    auto MakePlan(int threads, size_t ops_per_thread, int read_percent, const Zipf *zipf) -> Plan {
+        Plan plan{std::vector<std::vector<uint32_t> >(threads), std::vector<std::vector<bool> >(threads)};
+        for (int t = 0; t < threads; ++t) {
+            std::mt19937_64 gen(20230610 + static_cast<uint64_t>(t));
+            for (size_t i = 0; i < ops_per_thread; ++i) {
+                plan.keys[t].push_back(static_cast<uint32_t>(zipf ? (*zipf)(gen) : gen() % kKeys));
+                plan.writes[t].push_back(static_cast<int>(gen() % 100) >= read_percent);
+            }
+        }
+        return plan;
+    }
+
+    void PrintHeader() {
+        if (csv) {
+            std::printf("case,threads,ops_per_s,p50_ns,p99_ns,p999_ns,lock_wait_ns_per_write,"
+                        "lock_hold_ns_per_write\n");
+            return;
+        }
+        std::printf("%-36s %7s %12s %9s %9s %9s %12s %12s\n", "case", "threads", "ops/s", "p50 ns", "p99 ns",
+                    "p999 ns", "wait ns/wr", "hold ns/wr");
+    }
+
+    void Print(const bench::Result &result, double wait_per_write, double hold_per_write) {
+        const double rate = static_cast<double>(result.ops) / result.seconds;
+        const auto p50 = static_cast<unsigned long long>(result.p50);
+        const auto p99 = static_cast<unsigned long long>(result.p99);
+        const auto p999 = static_cast<unsigned long long>(result.p999);
+        if (csv) {
+            std::printf("%s,%d,%.0f,%llu,%llu,%llu,%.0f,%.0f\n", result.name.c_str(), result.threads, rate, p50, p99,
+                        p999, wait_per_write, hold_per_write);
+        } else {
+            std::printf("%-36s %7d %12.0f %9llu %9llu %9llu %12.0f %12.0f\n", result.name.c_str(), result.threads,
+                        rate, p50, p99, p999, wait_per_write, hold_per_write);
+        }
+        std::fflush(stdout);
+    }
+
+    // Run one case: get(key) for reads and put(key, i) for writes, keys drawn by
+    // plan, and report the lock times TrieStats recorded meanwhile.
+    template<class Get, class Put>
+    void Case(const std::string &name, int threads, size_t ops, const Plan &plan, Get &&get, Put &&put) {
+        const size_t ops_per_thread = std::max<size_t>(1, ops / threads);
+        const sjtu::TrieStats::Snapshot before = sjtu::TrieStats::Collect();
+        const bench::Result result = bench::Run(name, threads, ops_per_thread, [&](int t, size_t i) {
+            if (plan.writes[t][i]) {
+                put(plan.keys[t][i], static_cast<int>(i));
+            } else {
+                get(plan.keys[t][i]);
+            }
+        });
+        const sjtu::TrieStats::Snapshot after = sjtu::TrieStats::Collect();
+        size_t writes = 0;
+        for (int t = 0; t < threads; ++t) {
+            writes += static_cast<size_t>(std::count(plan.writes[t].begin(), plan.writes[t].begin() +
+                                                     static_cast<std::ptrdiff_t>(ops_per_thread), true));
+        }
+        auto per_write = [&](sjtu::TrieStats::Counter counter) {
+            const double total = static_cast<double>(after.counters[counter] - before.counters[counter]);
+            return writes == 0 ? 0.0 : total / static_cast<double>(writes);
+        };
+        Print(result, per_write(sjtu::TrieStats::kWriteLockWaitNanos),
+              per_write(sjtu::TrieStats::kWriteLockHoldNanos));
+    }
+
+    // Put every key, as one commit.
+    template<class Store>
+    void Fill(Store &store, const std::vector<std::string> &keys) {
+        sjtu::TrieStore::WriteBatch batch;
+        for (size_t k = 0; k < keys.size(); ++k) {
+            batch.Put<int>(keys[k], static_cast<int>(k));
+        }
+        store.Commit(std::move(batch));
+    }
+
+    void StrategyCases(const std::string &strategy, int read_percent, const std::string &distribution, int threads,
+                       const std::vector<std::string> &keys, const Zipf &zipf) {
+        const std::string name = strategy + "/read" + std::to_string(read_percent) + "/" + distribution;
+        if (!Selected(name)) return;
+        const size_t ops = quick ? 10000 : 100000;
+        const Plan plan = MakePlan(threads, std::max<size_t>(1, ops / threads), read_percent,
+                                   distribution == "zipf" ? &zipf : nullptr);
+        auto read = [&keys](auto &store) {
+            return [&keys, &store](uint32_t k) {
+                if (!store.template Get<int>(keys[k])) std::abort();
+            };
+        };
+        if (strategy == "sharded") {
+            sjtu::ShardedTrieStore store(16, sjtu::ShardedTrieStore::Routing::kHash, sjtu::RetentionPolicy{16});
+            Fill(store, keys);
+            Case(name, threads, ops, plan, read(store), [&](uint32_t k, int value) {
+                store.Put<int>(keys[k], value);
+            });
+            return;
+        }
+        sjtu::TrieStore store(sjtu::RetentionPolicy{16});
+        Fill(store, keys);
+        if (strategy == "store") {
+            Case(name, threads, ops, plan, read(store), [&](uint32_t k, int value) {
+                store.Put<int>(keys[k], value);
+            });
+        } else if (strategy == "group") {
+            Case(name, threads, ops, plan, read(store), [&](uint32_t k, int value) {
+                sjtu::TrieStore::WriteBatch batch;
+                batch.Put<int>(keys[k], value);
+                store.GroupCommit(std::move(batch));
+            });
+        } else {
+            Case(name, threads, ops, plan, read(store), [&](uint32_t k, int value) {
+                store.PutAsync<int>(keys[k], value).get();
+            });
+        }
+    }
+} // namespace
+
+int main(int argc, char **argv) {
+    int max_threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency())) * 2;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--quick") == 0) {
+            quick = true;
+        } else if (std::strcmp(argv[i], "--csv") == 0) {
+            csv = true;
+        } else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            max_threads = std::max(1, std::atoi(argv[++i]));
+        } else {
+            filters.emplace_back(argv[i]);
+        }
+    }
+    std::vector<std::string> keys;
+    for (size_t k = 0; k < kKeys; ++k) {
+        keys.push_back(Key(k));
+    }
+    const Zipf zipf(kKeys, 0.99);
+    PrintHeader();
+    for (const char *strategy: {"store", "group", "async", "sharded"}) {
+        for (int read_percent: {99, 90, 50}) {
+            for (const char *distribution: {"uniform", "zipf"}) {
+                for (int threads = 1; threads <= max_threads; threads *= 2) {
+                    StrategyCases(strategy, read_percent, distribution, threads, keys, zipf);
+                }
+            }
+        }
+    }
+    return 0;
+}
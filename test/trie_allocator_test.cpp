@@ -0,0 +1,163 @@
+#include "../trie/src.hpp"
+#include <atomic>
+#include <iostream>
+#include <memory_resource>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A resource that counts what is allocated from it.
+class CountingResource : public std::pmr::memory_resource {
+public:
+    std::atomic<long> live{0};
+    std::atomic<long> total{0};
+    std::atomic<size_t> largest{0};
+
+private:
+    auto do_allocate(size_t bytes, size_t alignment) -> void * override {
+        live++;
+        total++;
+        size_t seen = largest;
+        while (seen < bytes && !largest.compare_exchange_weak(seen, bytes)) {
+        }
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+        live--;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    auto do_is_equal(const std::pmr::memory_resource &other) const noexcept -> bool override {
+        return this == &other;
+    }
+};
+
+int main() {
+    // Every node and shared value comes from the trie's resource and goes back to it.
+    CountingResource counting;
+    {
+        sjtu::Trie trie(&counting);
+        for (int i = 0; i < 1000; i++) {
+            trie = trie.Put<std::string>("key" + std::to_string(i), std::string(40, 'v'));
+            trie = trie.Put<uint64_t>("num" + std::to_string(i), i);
+        }
+        for (int i = 0; i < 1000; i += 2) {
+            trie = trie.Remove("key" + std::to_string(i));
+        }
+        if (*trie.Get<uint64_t>("num999") != 999 || trie.Get<std::string>("key0") != nullptr) {
+            std::cout << "Test failed: wrong content with a custom resource" << std::endl;
+            return 1;
+        }
+
+        // Removing a missing key copies nothing, and a hit copies only its path.
+        const long before = counting.total;
+        for (const char *missing: {"key0", "key", "num1000", "nu", "x", ""}) {
+            trie = trie.Remove(missing);
+        }
+        if (counting.total != before) {
+            std::cout << "Test failed: removing missing keys allocated " << counting.total - before << " blocks"
+                    << std::endl;
+            return 1;
+        }
+        trie = trie.Remove("num500");
+        if (counting.total - before > 8) {
+            std::cout << "Test failed: removing one key allocated " << counting.total - before << " blocks"
+                    << std::endl;
+            return 1;
+        }
+    }
+    if (counting.total == 0 || counting.live != 0) {
+        std::cout << "Test failed: " << counting.live << " allocations were not returned" << std::endl;
+        return 1;
+    }
+
+    // The larger child tables come from the trie's resource too.
+    {
+        CountingResource wide;
+        {
+            sjtu::Trie trie(&wide);
+            for (int c = 0; c < 256; c++) {
+                trie = trie.Put<int>(std::string(1, static_cast<char>(c)) + "k", c);
+            }
+            for (int c = 0; c < 256; c += 2) {
+                trie = trie.Remove(std::string(1, static_cast<char>(c)) + "k");
+            }
+            if (*trie.Get<int>("\x7fk") != 127 || trie.Get<int>(std::string(1, '\0') + "k") != nullptr) {
+                std::cout << "Test failed: wrong content in a wide node" << std::endl;
+                return 1;
+            }
+        }
+        if (wide.largest < 256 * sizeof(std::shared_ptr<int>)) {
+            std::cout << "Test failed: a 256-way child table did not come from the trie's resource" << std::endl;
+            return 1;
+        }
+        if (wide.live != 0) {
+            std::cout << "Test failed: " << wide.live << " child tables were not returned" << std::endl;
+            return 1;
+        }
+    }
+
+    // A store on a NodePool, written by one thread and read and released by others.
+    {
+        sjtu::NodePool pool(&counting);
+        {
+            sjtu::TrieStore store(&pool);
+            std::thread writer([&store] {
+                for (int i = 0; i < 5000; i++) {
+                    store.Put<int>(std::to_string(i), i);
+                    if (i % 3 == 0) {
+                        store.Remove(std::to_string(i / 2));
+                    }
+                }
+            });
+            std::vector<std::thread> readers;
+            std::atomic<bool> failed{false};
+            for (int t = 0; t < 4; t++) {
+                readers.emplace_back([&store, &failed] {
+                    for (int i = 0; i < 5000; i++) {
+                        auto guard = store.Get<int>(std::to_string(4999));
+                        if (guard != std::nullopt && **guard != 4999) {
+                            failed = true;
+                        }
+                    }
+                });
+            }
+            writer.join();
+            for (auto &reader: readers) {
+                reader.join();
+            }
+            if (failed || **store.Get<int>("4999") != 4999) {
+                std::cout << "Test failed: wrong content with a NodePool" << std::endl;
+                return 1;
+            }
+        }
+    }
+    if (counting.live != 0) {
+        std::cout << "Test failed: the NodePool did not return its chunks" << std::endl;
+        return 1;
+    }
+
+    // A generation built in a monotonic arena is released in bulk.
+    {
+        std::pmr::monotonic_buffer_resource arena(&counting);
+        {
+            sjtu::Trie trie(&arena);
+            for (int i = 0; i < 1000; i++) {
+                trie = trie.Put<int>(std::to_string(i), i);
+            }
+            if (*trie.Get<int>("500") != 500) {
+                std::cout << "Test failed: wrong content in an arena" << std::endl;
+                return 1;
+            }
+        }
+        arena.release();
+    }
+    if (counting.live != 0) {
+        std::cout << "Test failed: the arena did not release its memory" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
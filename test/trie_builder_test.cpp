@@ -0,0 +1,74 @@
+#include "../trie/src.hpp"
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+// Bulk loading sorted keys must give the same content as a loop of Put, and
+// a transient must give the same content as the persistent operations.
+int main() {
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<> dis(0, 199999);
+    std::map<std::string, int> expected;
+    for (int i = 0; i < 20000; i++) {
+        std::stringstream ss;
+        ss << "tenant/" << std::setw(3) << std::setfill('0') << dis(gen) % 500 << "/session/" << dis(gen);
+        expected[ss.str()] = i;
+    }
+    expected[""] = -1;
+    expected["tenant"] = -2;
+    expected["tenant/"] = -3;
+    expected[std::string("\xff", 1)] = -4;
+
+    sjtu::TrieBuilder builder;
+    for (const auto &[key, value]: expected) {
+        builder.Add<int>(key, value);
+    }
+    sjtu::Trie built = builder.Build();
+
+    sjtu::TransientTrie transient = sjtu::Trie().Transient();
+    for (auto it = expected.rbegin(); it != expected.rend(); ++it) {
+        transient.Put<int>(it->first, it->second);
+    }
+    sjtu::Trie loaded = transient.Freeze();
+
+    for (const auto &[key, value]: expected) {
+        const int *a = built.Get<int>(key);
+        const int *b = loaded.Get<int>(key);
+        if (a == nullptr || *a != value || b == nullptr || *b != value) {
+            std::cout << "Test failed: '" << key << "' does not return " << value << std::endl;
+            return 1;
+        }
+    }
+    if (built.Get<int>("tenant/0") != nullptr || built.Get<int>("tenant/000/session") != nullptr) {
+        std::cout << "Test failed: built trie has keys that were never added" << std::endl;
+        return 1;
+    }
+
+    // The built trie is an ordinary trie.
+    for (const auto &[key, value]: expected) {
+        built = built.Remove(key);
+    }
+    if (!(built == sjtu::Trie())) {
+        std::cout << "Test failed: built trie is not empty after removing every key" << std::endl;
+        return 1;
+    }
+
+    bool threw = false;
+    builder.Add<int>("b", 1);
+    try {
+        builder.Add<int>("a", 2);
+    } catch (const std::invalid_argument &) {
+        threw = true;
+    }
+    if (!threw || *builder.Build().Get<int>("b") != 1 || !(builder.Build() == sjtu::Trie())) {
+        std::cout << "Test failed: out-of-order key was accepted" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include "../trie/src.hpp"
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+// Random keys of up to 12 bytes; a fifth of them start with 'k', so one
+// partition is much larger than the others.
+static auto RandomKey(std::mt19937 &gen) -> std::string {
+    std::string key(gen() % 13, '\0');
+    for (char &c: key) {
+        c = static_cast<char>(gen() % 256);
+    }
+    if (!key.empty() && gen() % 5 == 0) {
+        key[0] = 'k';
+    }
+    return key;
+}
+
+// Bulk-puts and bulk-gets on several threads and compares with Put and Get.
+int main() {
+    std::mt19937 gen(20230526);
+    sjtu::Trie base;
+    std::map<std::string, int> expected;
+    for (int i = 0; i < 5000; i++) {
+        const std::string key = RandomKey(gen);
+        base = base.Put<int>(key, i);
+        expected[key] = i;
+    }
+    const std::map<std::string, int> base_expected = expected;
+
+    // Duplicates within the batch, keys already in the trie, and the empty key.
+    std::vector<std::pair<std::string, int> > entries;
+    for (int i = 0; i < 40000; i++) {
+        std::string key = i % 10 == 0 ? std::next(expected.begin(), i % 1000)->first : RandomKey(gen);
+        if (i == 777 || i == 30000) key.clear();
+        entries.emplace_back(key, -i);
+    }
+    for (const auto &[key, value]: entries) {
+        expected[key] = value;
+    }
+    for (size_t threads: {1, 4}) {
+        const sjtu::Trie bulk = base.PutMany(entries, threads);
+        std::vector<std::string_view> keys;
+        for (const auto &[key, value]: expected) {
+            keys.emplace_back(key);
+        }
+        keys.emplace_back("\x01no such key");
+        const auto values = bulk.GetMany<int>(keys, threads);
+        size_t i = 0;
+        for (const auto &[key, value]: expected) {
+            if (values[i] == nullptr || *values[i] != value || bulk.Get<int>(key) != values[i]) {
+                std::cout << "Test failed: wrong value for a bulk-put key with " << threads << " threads"
+                        << std::endl;
+                return 1;
+            }
+            i++;
+        }
+        if (values.back() != nullptr || bulk.GetMany<double>(keys, threads)[0] != nullptr) {
+            std::cout << "Test failed: GetMany found a missing key" << std::endl;
+            return 1;
+        }
+        size_t count = 0;
+        for (auto it = bulk.Scan().begin(); it != sjtu::TrieIterator(); ++it) {
+            count++;
+        }
+        if (count != expected.size()) {
+            std::cout << "Test failed: the bulk-put trie has " << count << " keys, expected " << expected.size()
+                    << std::endl;
+            return 1;
+        }
+    }
+
+    // The base trie is left alone.
+    for (const auto &[key, value]: base_expected) {
+        if (*base.Get<int>(key) != value) {
+            std::cout << "Test failed: PutMany changed the trie it started from" << std::endl;
+            return 1;
+        }
+    }
+
+    // Non-copyable values are moved into place, and an untouched subtree is
+    // shared with the trie it came from.
+    const sjtu::Trie shared = sjtu::Trie().Put<int>("untouched", 1);
+    std::vector<std::pair<std::string, std::unique_ptr<int> > > owned;
+    owned.emplace_back("a", std::make_unique<int>(1));
+    owned.emplace_back("b", std::make_unique<int>(2));
+    const sjtu::Trie moved = shared.PutMany(std::move(owned));
+    if (**moved.Get<std::unique_ptr<int> >("b") != 2 || shared.Memory().shared_bytes == 0 ||
+        !(base.PutMany<int>({}) == base)) {
+        std::cout << "Test failed: wrong trie from a small PutMany" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include "../trie/src.hpp"
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+// Keys that share long prefixes make the trie split and merge compressed
+// segments. Compare against std::map after every operation.
+int main() {
+    sjtu::Trie trie;
+
+    trie = trie.Put<int>("tenant/0000123/session/a", 1);
+    sjtu::Trie one = trie;
+    if (trie.Get<int>("tenant/0000123/session/") != nullptr || trie.Get<int>("tenant") != nullptr) {
+        std::cout << "Test failed: prefix of a compressed segment was found" << std::endl;
+        return 1;
+    }
+    if (!(trie.Remove("tenant/0000123") == trie)) {
+        std::cout << "Test failed: removing a missing prefix changed the trie" << std::endl;
+        return 1;
+    }
+
+    trie = trie.Put<int>("tenant/0000123/session/b", 2);
+    trie = trie.Put<int>("tenant/0000124/session/a", 3);
+    trie = trie.Put<int>("tenant", 4);
+    trie = trie.Put<int>("", 5);
+    for (auto [key, value] : std::vector<std::pair<std::string, int> >{
+             {"tenant/0000123/session/a", 1}, {"tenant/0000123/session/b", 2},
+             {"tenant/0000124/session/a", 3}, {"tenant", 4}, {"", 5}}) {
+        const int *got = trie.Get<int>(key);
+        if (got == nullptr || *got != value) {
+            std::cout << "Test failed: '" << key << "' does not return " << value << std::endl;
+            return 1;
+        }
+    }
+    if (one.Get<int>("tenant") != nullptr || *one.Get<int>("tenant/0000123/session/a") != 1) {
+        std::cout << "Test failed: splitting a segment modified an old version" << std::endl;
+        return 1;
+    }
+
+    trie = trie.Remove("tenant/0000123/session/b");
+    trie = trie.Remove("tenant/0000124/session/a");
+    trie = trie.Remove("tenant");
+    trie = trie.Remove("");
+    if (*trie.Get<int>("tenant/0000123/session/a") != 1 || trie.Get<int>("tenant") != nullptr) {
+        std::cout << "Test failed: merging segments lost a key" << std::endl;
+        return 1;
+    }
+    trie = trie.Remove("tenant/0000123/session/a");
+    if (!(trie == sjtu::Trie())) {
+        std::cout << "Test failed: trie is not empty after removing every key" << std::endl;
+        return 1;
+    }
+
+    // Every prefix of a long key is a key, so paths are longer than the inline
+    // path buffer of Put and Remove.
+    for (int n = 1; n <= 100; n++) {
+        trie = trie.Put<int>(std::string(n, 'z'), n);
+    }
+    for (int n = 100; n >= 1; n -= 3) {
+        trie = trie.Remove(std::string(n, 'z'));
+    }
+    for (int n = 1; n <= 100; n++) {
+        const int *got = trie.Get<int>(std::string(n, 'z'));
+        if ((got != nullptr) != ((100 - n) % 3 != 0) || (got != nullptr && *got != n)) {
+            std::cout << "Test failed: long path lost key of length " << n << std::endl;
+            return 1;
+        }
+        if (got != nullptr) {
+            trie = trie.Remove(std::string(n, 'z'));
+        }
+    }
+    if (!(trie == sjtu::Trie())) {
+        std::cout << "Test failed: trie is not empty after removing every long key" << std::endl;
+        return 1;
+    }
+
+    // A tiny alphabet produces lots of splits and merges.
+    std::mt19937 gen(20230407);
+    std::uniform_int_distribution<> len(0, 8);
+    std::uniform_int_distribution<> letter(0, 2);
+    std::map<std::string, int> expected;
+    for (int i = 0; i < 20000; i++) {
+        std::string key;
+        for (int n = len(gen); n > 0; n--) {
+            key += static_cast<char>('a' + letter(gen));
+        }
+        if (i % 3 == 0) {
+            trie = trie.Remove(key);
+            expected.erase(key);
+        } else {
+            trie = trie.Put<int>(key, i);
+            expected[key] = i;
+        }
+        if (i % 97 != 0) {
+            continue;
+        }
+        for (const auto &[k, v] : expected) {
+            const int *got = trie.Get<int>(k);
+            if (got == nullptr || *got != v) {
+                std::cout << "Test failed: '" << k << "' does not return " << v << std::endl;
+                return 1;
+            }
+        }
+    }
+    for (auto it = expected.begin(); it != expected.end(); it = expected.erase(it)) {
+        trie = trie.Remove(it->first);
+        if (trie.Get<int>(it->first) != nullptr) {
+            std::cout << "Test failed: '" << it->first << "' still exists after removal" << std::endl;
+            return 1;
+        }
+    }
+    if (!(trie == sjtu::Trie())) {
+        std::cout << "Test failed: trie is not empty after removing every key" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include "../trie/src.hpp"
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+using Kind = sjtu::TrieChange::Kind;
+
+// The changes that turn one map into another, in key order.
+static auto Expected(const std::map<std::string, int> &older, const std::map<std::string, int> &newer)
+    -> std::vector<std::pair<Kind, std::string> > {
+    std::vector<std::pair<Kind, std::string> > changes;
+    auto a = older.begin();
+    auto b = newer.begin();
+    while (a != older.end() || b != newer.end()) {
+        if (b == newer.end() || (a != older.end() && a->first < b->first)) {
+            changes.emplace_back(Kind::kRemoved, (a++)->first);
+        } else if (a == older.end() || b->first < a->first) {
+            changes.emplace_back(Kind::kInserted, (b++)->first);
+        } else {
+            if (a->second != b->second) {
+                changes.emplace_back(Kind::kChanged, a->first);
+            }
+            ++a;
+            ++b;
+        }
+    }
+    return changes;
+}
+
+// Diffs random pairs of versions against std::map, including versions whose
+// paths are compressed differently, and diffs through a TrieStore.
+int main() {
+    std::mt19937 gen(20230512);
+    std::uniform_int_distribution<> len(0, 6);
+    std::uniform_int_distribution<> letter(0, 2);
+    std::vector<sjtu::Trie> tries{sjtu::Trie()};
+    std::vector<std::map<std::string, int> > maps{{}};
+    for (int i = 0; i < 3000; i++) {
+        std::string key;
+        for (int n = len(gen); n > 0; n--) {
+            key += static_cast<char>('a' + letter(gen));
+        }
+        std::map<std::string, int> map = maps.back();
+        if (i % 3 == 0) {
+            tries.push_back(tries.back().Remove(key));
+            map.erase(key);
+        } else {
+            tries.push_back(tries.back().Put<int>(key, i % 7));
+            map[key] = i % 7;
+        }
+        maps.push_back(std::move(map));
+    }
+    std::uniform_int_distribution<size_t> pick(0, tries.size() - 1);
+    for (int round = 0; round < 500; round++) {
+        const size_t x = round < 100 ? tries.size() - 2 - round : pick(gen);
+        const size_t y = round < 100 ? tries.size() - 1 - round : pick(gen);
+        const auto changes = tries[x].Diff(tries[y]);
+        const auto expected = Expected(maps[x], maps[y]);
+        if (changes.size() != expected.size()) {
+            std::cout << "Test failed: diff of versions " << x << " and " << y << " has " << changes.size()
+                    << " changes, expected " << expected.size() << std::endl;
+            return 1;
+        }
+        for (size_t i = 0; i < changes.size(); i++) {
+            const auto &change = changes[i];
+            const int *before = change.Before<int>();
+            const int *after = change.After<int>();
+            if (change.kind != expected[i].first || change.key != expected[i].second ||
+                (before != nullptr) != (change.kind != Kind::kInserted) ||
+                (after != nullptr) != (change.kind != Kind::kRemoved) ||
+                (after != nullptr && *after != maps[y].at(change.key))) {
+                std::cout << "Test failed: wrong change for key '" << change.key << "'" << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    // A value of another type under the same key is a change; re-putting an
+    // equal value is not.
+    sjtu::Trie base = sjtu::Trie().Put<int>("k", 1).Put<std::string>("s", std::string(40, 's'));
+    auto changes = base.Diff(base.Put<double>("k", 1.0).Put<std::string>("s", std::string(40, 's')));
+    if (changes.size() != 1 || changes[0].key != "k" || changes[0].kind != Kind::kChanged ||
+        *changes[0].After<double>() != 1.0 || !base.Diff(base).empty()) {
+        std::cout << "Test failed: wrong changes for values of another type" << std::endl;
+        return 1;
+    }
+
+    // Keys far longer than the call stack is deep, inserted, changed next to
+    // a branch near their end, and removed.
+    const std::string long_key(100000, 'L');
+    sjtu::Trie with_long = sjtu::Trie().Put<int>(long_key, 1);
+    sjtu::Trie branched = with_long.Put<int>(long_key, 2).Put<int>(long_key.substr(0, 99990) + "M", 3);
+    auto inserted = sjtu::Trie().Diff(with_long);
+    auto rewritten = with_long.Diff(branched);
+    auto removed = branched.Diff(sjtu::Trie());
+    if (inserted.size() != 1 || inserted[0].key != long_key || *inserted[0].After<int>() != 1 ||
+        rewritten.size() != 2 || rewritten[0].kind != Kind::kChanged || *rewritten[0].After<int>() != 2 ||
+        rewritten[1].key.back() != 'M' || removed.size() != 2 || removed[1].kind != Kind::kRemoved) {
+        std::cout << "Test failed: wrong changes for long keys" << std::endl;
+        return 1;
+    }
+
+    // Through a store, between retained versions.
+    sjtu::TrieStore store(sjtu::RetentionPolicy{4});
+    for (int i = 0; i < 1000; i++) {
+        store.Put<int>(std::to_string(i), i);
+    }
+    const size_t version = store.get_version();
+    store.Put<int>("5", 50);
+    store.Remove("6");
+    store.Put<int>("new", 1);
+    auto diff = store.Diff(version);
+    if (!diff || diff->size() != 3 || (*diff)[0].key != "5" || (*diff)[1].kind != Kind::kRemoved ||
+        (*diff)[2].kind != Kind::kInserted || store.Diff(version - 1)) {
+        std::cout << "Test failed: wrong diff between store versions" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include "../trie/src.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Exercises every child layout of a node (4, 16, 48 and 256 children) on the
+// way up and on the way back down, and checks that old versions are untouched.
+int main() {
+    sjtu::Trie trie;
+    std::vector<sjtu::Trie> versions;
+    versions.push_back(trie);
+
+    for (int b = 0; b < 256; b++) {
+        std::string key = "k" + std::string(1, static_cast<char>(b));
+        trie = trie.Put<int>(key, b);
+        versions.push_back(trie);
+    }
+
+    for (int b = 0; b < 256; b++) {
+        std::string key = "k" + std::string(1, static_cast<char>(b));
+        const int *value = trie.Get<int>(key);
+        if (value == nullptr || *value != b) {
+            std::cout << "Test failed: byte " << b << " is missing after insert" << std::endl;
+            return 1;
+        }
+    }
+
+    // Every version i holds exactly the keys with bytes [0, i).
+    for (int i = 0; i <= 256; i++) {
+        for (int b : {0, 3, 4, 15, 16, 47, 48, 127, 128, 255}) {
+            std::string key = "k" + std::string(1, static_cast<char>(b));
+            bool found = versions[i].Get<int>(key) != nullptr;
+            if (found != (b < i)) {
+                std::cout << "Test failed: version " << i << " has wrong content for byte " << b << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    // Shrink back down through every layout, from both ends.
+    for (int n = 0; n < 128; n++) {
+        trie = trie.Remove("k" + std::string(1, static_cast<char>(n)));
+        trie = trie.Remove("k" + std::string(1, static_cast<char>(255 - n)));
+        for (int b = 0; b < 256; b++) {
+            std::string key = "k" + std::string(1, static_cast<char>(b));
+            bool found = trie.Get<int>(key) != nullptr;
+            if (found != (b > n && b < 255 - n)) {
+                std::cout << "Test failed: byte " << b << " has wrong state after " << n + 1 << " removals"
+                        << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    if (!(trie == sjtu::Trie())) {
+        std::cout << "Test failed: trie is not empty after removing every key" << std::endl;
+        return 1;
+    }
+    if (versions[256].Get<int>(std::string("k") + static_cast<char>(200)) == nullptr) {
+        std::cout << "Test failed: old version lost a key" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
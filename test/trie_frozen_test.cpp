@@ -0,0 +1,145 @@
+#include "../trie/src.hpp"
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Integer = std::unique_ptr<int>;
+
+// Freezes tries of mixed value types, compares every lookup with the original
+// trie and thaws them back, then lets a store freeze its old versions.
+int main() {
+    std::mt19937 gen(20230529);
+    sjtu::Trie trie;
+    std::map<std::string, int> expected;
+    for (int i = 0; i < 20000; i++) {
+        std::string key;
+        for (int n = static_cast<int>(gen() % 10); n > 0; n--) {
+            key += static_cast<char>('a' + gen() % 20);
+        }
+        expected[key] = i;
+        switch (i % 4) {
+            case 0: trie = trie.Put<int>(key, i); break;
+            case 1: trie = trie.Put<std::string>(key, std::to_string(i)); break;
+            case 2: trie = trie.Put<std::string>(key, std::string(40, static_cast<char>('a' + i % 26))); break;
+            default: trie = trie.Put<Integer>(key, std::make_unique<int>(i)); break;
+        }
+    }
+    const sjtu::FrozenTrie frozen = trie.Freeze();
+    if (frozen.Size() != expected.size() || frozen.Bytes() * 3 > trie.Memory().Bytes()) {
+        std::cout << "Test failed: a frozen trie of " << frozen.Size() << " keys takes " << frozen.Bytes()
+                << " bytes" << std::endl;
+        return 1;
+    }
+    for (const auto &[key, i]: expected) {
+        const bool same = frozen.Get<int>(key) == nullptr ? trie.Get<int>(key) == nullptr
+                                                           : *frozen.Get<int>(key) == *trie.Get<int>(key);
+        const std::string *string = frozen.Get<std::string>(key);
+        const Integer *integer = frozen.Get<Integer>(key);
+        if (!same || !frozen.Contains(key) || (string != nullptr) != (trie.Get<std::string>(key) != nullptr) ||
+            (string != nullptr && *string != *trie.Get<std::string>(key)) ||
+            (integer != nullptr && integer != trie.Get<Integer>(key)) || frozen.Get<double>(key) != nullptr) {
+            std::cout << "Test failed: wrong frozen value for '" << key << "'" << std::endl;
+            return 1;
+        }
+    }
+    if (frozen.Contains("zzzzzzzzzzz") || frozen.Get<int>("zzzzzzzzzzz") || sjtu::FrozenTrie().Contains("")) {
+        std::cout << "Test failed: a frozen trie found a missing key" << std::endl;
+        return 1;
+    }
+
+    // Thawing gives the same content back, and frozen values outlive the trie.
+    const sjtu::Trie thawed = frozen.Thaw();
+    if (!trie.Diff(thawed).empty() || !thawed.Diff(trie).empty() || !sjtu::FrozenTrie().Thaw().Diff(
+            sjtu::Trie()).empty()) {
+        std::cout << "Test failed: a thawed trie differs from the original" << std::endl;
+        return 1;
+    }
+    trie = sjtu::Trie();
+    for (const auto &[key, i]: expected) {
+        const std::string *string = frozen.Get<std::string>(key);
+        const Integer *integer = frozen.Get<Integer>(key);
+        if ((i % 4 == 2 && *string != std::string(40, static_cast<char>('a' + i % 26))) ||
+            (i % 4 == 3 && **integer != i)) {
+            std::cout << "Test failed: a frozen value died with its trie" << std::endl;
+            return 1;
+        }
+    }
+
+    // A store freezes versions a rewrite of every key leaves behind, but not
+    // versions that share most of their nodes with the next one. Writes leave
+    // the freezing to CollectGarbage.
+    sjtu::RetentionPolicy policy;
+    policy.freeze_after = 2;
+    sjtu::TrieStore store(policy);
+    for (int i = 0; i < 200; i++) {
+        store.Put<int>(std::to_string(i), i);
+    }
+    store.CollectGarbage();
+    if (store.Stats().frozen_versions != 0) {
+        std::cout << "Test failed: versions that share nodes were frozen" << std::endl;
+        return 1;
+    }
+    const size_t first = store.get_version();
+    for (int round = 1; round <= 4; round++) {
+        sjtu::TrieStore::WriteBatch batch;
+        for (int i = 0; i < 2000; i++) {
+            batch.Put<int>(std::to_string(i), i * round);
+        }
+        store.Commit(std::move(batch));
+    }
+    if (store.Stats().frozen_versions != 0) {
+        std::cout << "Test failed: a write froze a version" << std::endl;
+        return 1;
+    }
+    store.CollectGarbage();
+    if (store.Stats().frozen_versions == 0 || store.Memory(first + 1, first + 1)->frozen_bytes == 0) {
+        std::cout << "Test failed: rewritten versions were not frozen" << std::endl;
+        return 1;
+    }
+    for (int round = 1; round <= 4; round++) {
+        auto value = store.Get<int>("1234", first + round);
+        if (!value || **value != 1234 * round || store.Get<int>("x", first + round)) {
+            std::cout << "Test failed: wrong value in version " << first + round << std::endl;
+            return 1;
+        }
+    }
+    auto diff = store.Diff(first + 1, first + 2);
+    const auto range = store.ScanPrefix("199", first + 1);
+    if (!diff || diff->size() != 1999 || !range || (*range).begin()->Key() != "199") {
+        std::cout << "Test failed: a frozen version cannot be scanned or diffed" << std::endl;
+        return 1;
+    }
+    auto guard = store.Get<int>("7", first + 1);
+    store.Put<int>("late", 1);
+    if (**guard != 7) {
+        std::cout << "Test failed: a guard on a frozen version lost its value" << std::endl;
+        return 1;
+    }
+
+    // The writer thread of the asynchronous writes freezes versions once it
+    // has nothing to write.
+    sjtu::TrieStore async_store(policy);
+    for (int round = 1; round <= 4; round++) {
+        sjtu::TrieStore::WriteBatch batch;
+        for (int i = 0; i < 2000; i++) {
+            batch.Put<int>(std::to_string(i), i * round);
+        }
+        async_store.CommitAsync(std::move(batch)).get();
+    }
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (async_store.Stats().frozen_versions == 0 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (async_store.Stats().frozen_versions == 0 || **async_store.Get<int>("1234", 1) != 1234) {
+        std::cout << "Test failed: the idle writer thread froze no version" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,132 @@
+#include "../trie/src.hpp"
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+// A value type with its own codec, registered before any trie stores it.
+struct Point {
+    int x;
+    int y;
+};
+
+template<>
+struct sjtu::TrieCodec<Point> : sjtu::TrivialTrieCodec<Point, sjtu::kUserTrieCodecId> {
+};
+
+// Counts heap allocations so the test can check that mapped reads make none.
+// GCC cannot tell that these replace the global operators and warns about
+// the malloc/free pairing.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+static long allocations = 0;
+
+void *operator new(size_t size) {
+    ++allocations;
+    if (void *p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+// Saves tries to images, queries them in place, and layers writes on top.
+int main() {
+    const std::string path = (std::filesystem::temp_directory_path() / "sjtu_trie_image_test.img").string();
+
+    sjtu::Trie trie;
+    trie = trie.Put<int>("", 1);
+    trie = trie.Put<uint64_t>("count", 1ULL << 40);
+    trie = trie.Put<double>("ratio", 0.25);
+    trie = trie.Put<std::string>("name", "copy-on-write trie");
+    trie = trie.Put<Point>("point", Point{3, -4});
+    std::map<std::string, int> expected;
+    std::mt19937 gen(20230415);
+    for (int i = 0; i < 2000; i++) {
+        std::string key = "user/" + std::to_string(gen() % 5000);
+        trie = trie.Put<int>(key, i);
+        expected[key] = i;
+    }
+    sjtu::TrieImage::Save(trie, path);
+
+    auto mapped = std::make_shared<const sjtu::MappedTrie>(sjtu::MappedTrie::Open(path));
+    const long before = allocations;
+    bool ok = *mapped->Get<int>("") == 1 && *mapped->Get<uint64_t>("count") == 1ULL << 40 &&
+              *mapped->Get<double>("ratio") == 0.25 && mapped->Get<Point>("point")->y == -4 &&
+              *mapped->GetBytes<std::string>("name") == "copy-on-write trie";
+    for (const auto &[key, value]: expected) {
+        const int *got = mapped->Get<int>(key);
+        ok = ok && got != nullptr && *got == value;
+    }
+    ok = ok && mapped->Get<int>("user/") == nullptr && mapped->Get<int>("count") == nullptr &&
+         mapped->Get<int>("missing") == nullptr && !mapped->GetBytes<std::string>("ratio");
+    if (allocations != before) {
+        std::cout << "Test failed: reading a mapped image allocated " << allocations - before << " times" << std::endl;
+        return 1;
+    }
+    if (!ok || mapped->Load<std::string>("name") != "copy-on-write trie") {
+        std::cout << "Test failed: mapped image returned wrong values" << std::endl;
+        return 1;
+    }
+
+    // The same image held in memory.
+    const std::string image = sjtu::TrieImage::Encode(trie);
+    const sjtu::MappedTrie in_memory = sjtu::MappedTrie::View(image);
+    const std::string empty_image = sjtu::TrieImage::Encode(sjtu::Trie());
+    if (in_memory.Load<Point>("point")->x != 3 || sjtu::MappedTrie::View(empty_image).Contains("")) {
+        std::cout << "Test failed: in-memory image returned wrong values" << std::endl;
+        return 1;
+    }
+
+    // Writes and removals layer over the base without changing it.
+    sjtu::LayeredTrie base(mapped);
+    sjtu::LayeredTrie layered = base.Put<int>("user/new", 7).Put<int>("", 2).Remove("ratio").Put<std::string>(
+        "name", "changed");
+    if (*layered.Get<int>("user/new") != 7 || *layered.Get<int>("") != 2 || layered.Get<double>("ratio") != nullptr ||
+        layered.Load<std::string>("name") != "changed" || *layered.Get<uint64_t>("count") != 1ULL << 40) {
+        std::cout << "Test failed: layered trie returned wrong values" << std::endl;
+        return 1;
+    }
+    if (*base.Get<int>("") != 1 || *base.Get<double>("ratio") != 0.25 || base.Get<int>("user/new") != nullptr) {
+        std::cout << "Test failed: layering changed the base" << std::endl;
+        return 1;
+    }
+    if (layered.Remove("").Put<double>("", 1.5).Get<int>("") != nullptr) {
+        std::cout << "Test failed: a value of another type in the overlay did not hide the base" << std::endl;
+        return 1;
+    }
+    for (const auto &[key, value]: expected) {
+        if (*layered.Get<int>(key) != value) {
+            std::cout << "Test failed: layered trie lost base key " << key << std::endl;
+            return 1;
+        }
+    }
+
+    // Values without a codec cannot be saved, and other files are rejected.
+    try {
+        sjtu::TrieImage::Encode(trie.Put<std::vector<int> >("vector", {1, 2}));
+        std::cout << "Test failed: a value without a codec was saved" << std::endl;
+        return 1;
+    } catch (const std::runtime_error &) {
+    }
+    std::string broken = image;
+    broken[0] = 'X';
+    try {
+        sjtu::MappedTrie::View(broken);
+        std::cout << "Test failed: an image with a bad magic was accepted" << std::endl;
+        return 1;
+    } catch (const std::runtime_error &) {
+    }
+
+    std::filesystem::remove(path);
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
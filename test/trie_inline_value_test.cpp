@@ -0,0 +1,44 @@
+#include "../trie/src.hpp"
+#include <array>
+#include <iostream>
+#include <string>
+
+// Small values are stored inside their node and copied when the node is
+// cloned; references into an old version must stay valid regardless.
+int main() {
+    const std::string long_value(100, 'x');
+    sjtu::Trie trie;
+    trie = trie.Put<uint64_t>("a", 1);
+    trie = trie.Put<uint32_t>("ab", 2);
+    trie = trie.Put<std::string>("abc", "short");
+    trie = trie.Put<std::string>("abcd", long_value);
+    trie = trie.Put<std::array<uint64_t, 4> >("abcde", {1, 2, 3, 4});
+
+    const sjtu::Trie old = trie;
+    const uint64_t *a = old.Get<uint64_t>("a");
+    const std::string *abc = old.Get<std::string>("abc");
+    const std::string *abcd = old.Get<std::string>("abcd");
+
+    // Every node on the path is cloned by this Put.
+    trie = trie.Put<int>("abcdef", 6);
+    trie = trie.Put<uint64_t>("a", 10);
+
+    if (old.Get<uint64_t>("a") != a || *a != 1 || *abc != "short" || *abcd != long_value) {
+        std::cout << "Test failed: values of an old version moved or changed" << std::endl;
+        return 1;
+    }
+    if (*trie.Get<uint64_t>("a") != 10 || *trie.Get<uint32_t>("ab") != 2 ||
+        *trie.Get<std::string>("abc") != "short" || *trie.Get<std::string>("abcd") != long_value ||
+        (*trie.Get<std::array<uint64_t, 4> >("abcde"))[3] != 4) {
+        std::cout << "Test failed: cloned nodes do not hold the same values" << std::endl;
+        return 1;
+    }
+    // Long strings are shared between the two versions rather than copied.
+    if (trie.Get<std::string>("abcd") != abcd) {
+        std::cout << "Test failed: a long string was copied by Clone" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,147 @@
+#include "../trie/src.hpp"
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <memory_resource>
+#include <random>
+#include <string>
+#include <vector>
+
+// A resource that counts the blocks allocated from it that are still live.
+class CountingResource : public std::pmr::memory_resource {
+public:
+    std::atomic<long> live{0};
+
+private:
+    auto do_allocate(size_t bytes, size_t alignment) -> void * override {
+        live++;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+        live--;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    auto do_is_equal(const std::pmr::memory_resource &other) const noexcept -> bool override {
+        return this == &other;
+    }
+};
+
+// Interns dictionary-style tries whose words share suffixes, checks that equal
+// subtrees collapse, and that the resulting DAG still behaves like a trie.
+int main() {
+    const std::vector<std::string> suffixes{"", "s", "ed", "ing", "er"};
+    std::mt19937 gen(20230519);
+    std::vector<std::string> stems;
+    for (int i = 0; i < 2000; i++) {
+        std::string stem;
+        for (int n = 0; n < 8; n++) {
+            stem += static_cast<char>('a' + gen() % 26);
+        }
+        stems.push_back(stem);
+    }
+    std::map<std::string, int> expected;
+    for (const auto &stem: stems) {
+        for (size_t s = 0; s < suffixes.size(); s++) {
+            expected[stem + suffixes[s]] = static_cast<int>(s);
+        }
+    }
+
+    CountingResource counting;
+    {
+        auto interner = std::make_shared<sjtu::TrieInterner>();
+        sjtu::Trie interned(&counting);
+        long plain_blocks;
+        {
+            sjtu::Trie plain(&counting);
+            for (const auto &[key, value]: expected) {
+                plain = plain.Put<int>(key, value);
+            }
+            plain_blocks = counting.live;
+            interned = interner->Intern(plain);
+        }
+        if (counting.live * 3 > plain_blocks) {
+            std::cout << "Test failed: interning kept " << counting.live << " of " << plain_blocks << " blocks"
+                    << std::endl;
+            return 1;
+        }
+
+        // The same content built in another order interns to the same root.
+        sjtu::Trie other(&counting);
+        for (auto it = expected.rbegin(); it != expected.rend(); ++it) {
+            other = other.Put<int>(it->first, it->second);
+        }
+        if (!(interner->Intern(other) == interned) || !(interner->Intern(interned) == interned)) {
+            std::cout << "Test failed: equal tries did not intern to one root" << std::endl;
+            return 1;
+        }
+        const size_t plain_image = sjtu::TrieImage::Encode(other).size();
+        other = sjtu::Trie();
+
+        // Writes to the DAG copy paths as usual and leave the shared nodes alone.
+        sjtu::Trie edited = interned;
+        std::map<std::string, int> edits = expected;
+        for (int i = 0; i < 3000; i++) {
+            const std::string key = stems[gen() % stems.size()] + suffixes[gen() % suffixes.size()];
+            if (i % 3 == 0) {
+                edited = edited.Remove(key);
+                edits.erase(key);
+            } else {
+                edited = interner->Intern(edited.Put<int>(key, i));
+                edits[key] = i;
+            }
+        }
+        for (const auto &[key, value]: expected) {
+            const int *got = interned.Get<int>(key);
+            const int *now = edited.Get<int>(key);
+            auto it = edits.find(key);
+            if (got == nullptr || *got != value || (now != nullptr) != (it != edits.end()) ||
+                (now != nullptr && *now != it->second)) {
+                std::cout << "Test failed: wrong value for '" << key << "' in an interned trie" << std::endl;
+                return 1;
+            }
+        }
+
+        // A DAG is saved with every shared node written once.
+        const std::string image = sjtu::TrieImage::Encode(interned);
+        const sjtu::MappedTrie mapped = sjtu::MappedTrie::View(image);
+        if (image.size() * 2 > plain_image || *mapped.Get<int>(stems[7] + "ing") != 3) {
+            std::cout << "Test failed: the image of an interned trie is wrong" << std::endl;
+            return 1;
+        }
+
+        // A store interns every version it publishes.
+        sjtu::TrieStore store(&counting);
+        store.SetInterner(interner);
+        for (const auto &stem: stems) {
+            sjtu::TrieStore::WriteBatch batch;
+            for (size_t s = 0; s < suffixes.size(); s++) {
+                batch.Put<int>(stem + suffixes[s], static_cast<int>(s));
+            }
+            store.Commit(std::move(batch));
+        }
+        if (**store.Get<int>(stems[3] + "er") != 4 || store.Get<int>(stems[3] + "e")) {
+            std::cout << "Test failed: an interning store returned wrong values" << std::endl;
+            return 1;
+        }
+
+        // Entries of destroyed nodes go away.
+        interned = sjtu::Trie();
+        edited = sjtu::Trie();
+        const size_t size = interner->Size();
+        interner->Purge();
+        if (interner->Size() >= size || interner->Size() == 0) {
+            std::cout << "Test failed: purging kept " << interner->Size() << " of " << size << " entries"
+                    << std::endl;
+            return 1;
+        }
+    }
+    if (counting.live != 0) {
+        std::cout << "Test failed: " << counting.live << " blocks were not returned" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
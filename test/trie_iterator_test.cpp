@@ -0,0 +1,151 @@
+#include "../trie/src.hpp"
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+// Walks tries through Scan, ScanPrefix, Range and LowerBound and compares the
+// visited keys with the same queries on std::map.
+namespace {
+    auto Collect(const sjtu::TrieRange &range) -> std::vector<std::pair<std::string, int> > {
+        std::vector<std::pair<std::string, int> > out;
+        for (const auto &entry: range) {
+            out.emplace_back(entry.Key(), *entry.Value<int>());
+        }
+        return out;
+    }
+
+    auto Expect(std::map<std::string, int>::const_iterator first, std::map<std::string, int>::const_iterator last)
+        -> std::vector<std::pair<std::string, int> > {
+        return {first, last};
+    }
+}
+
+int main() {
+    sjtu::Trie trie;
+    if (trie.Scan().begin() != trie.Scan().end() || trie.LowerBound("a") != sjtu::TrieIterator()) {
+        std::cout << "Test failed: empty trie has keys" << std::endl;
+        return 1;
+    }
+
+    // Bytes above 0x7f sort after ASCII, and a key sorts before its extensions.
+    std::map<std::string, int> expected;
+    for (const std::string key: {"", "a", "ab", "abc", "abd", "b", "user/42/x", "user/42/y", "user/43", "\xff",
+                                 "a\x80"}) {
+        trie = trie.Put<int>(key, static_cast<int>(expected.size()));
+        expected.emplace(key, static_cast<int>(expected.size()));
+    }
+    // std::map<std::string> agrees with the trie because std::string compares
+    // characters as unsigned char.
+    if (Collect(trie.Scan()) != Expect(expected.begin(), expected.end())) {
+        std::cout << "Test failed: Scan is not in ascending byte order" << std::endl;
+        return 1;
+    }
+    auto user = Collect(trie.ScanPrefix("user/42/"));
+    if (user.size() != 2 || user[0].first != "user/42/x" || user[1].first != "user/42/y") {
+        std::cout << "Test failed: ScanPrefix returned the wrong keys" << std::endl;
+        return 1;
+    }
+    if (!Collect(trie.ScanPrefix("user/44")).empty() || !Collect(trie.ScanPrefix("user/42/xx")).empty()) {
+        std::cout << "Test failed: ScanPrefix of a missing prefix returned keys" << std::endl;
+        return 1;
+    }
+    if (trie.LowerBound("user/42/").Key() != "user/42/x" || trie.LowerBound("user/42/z").Key() != "user/43") {
+        std::cout << "Test failed: LowerBound inside a compressed segment" << std::endl;
+        return 1;
+    }
+
+    // An iterator keeps its version alive after the trie is gone.
+    auto range = trie.ScanPrefix("ab");
+    trie = sjtu::Trie();
+    if (Collect(range).size() != 3) {
+        std::cout << "Test failed: range lost its version" << std::endl;
+        return 1;
+    }
+
+    // Randomized queries over a small alphabet, which makes many split segments.
+    std::mt19937 gen(20230410);
+    std::uniform_int_distribution<> len(0, 7);
+    std::uniform_int_distribution<> letter(0, 3);
+    auto random_key = [&] {
+        std::string key;
+        for (int n = len(gen); n > 0; n--) {
+            key += "ab\x7f\x80"[letter(gen)];
+        }
+        return key;
+    };
+    expected.clear();
+    for (int i = 0; i < 3000; i++) {
+        std::string key = random_key();
+        if (i % 4 == 0) {
+            trie = trie.Remove(key);
+            expected.erase(key);
+        } else {
+            trie = trie.Put<int>(key, i);
+            expected[key] = i;
+        }
+    }
+    if (Collect(trie.Scan()) != Expect(expected.begin(), expected.end())) {
+        std::cout << "Test failed: Scan does not match std::map" << std::endl;
+        return 1;
+    }
+    for (int i = 0; i < 2000; i++) {
+        std::string lo = random_key();
+        std::string hi = random_key();
+        if (hi < lo) {
+            std::swap(lo, hi);
+        }
+        if (Collect(trie.Range(lo, hi)) != Expect(expected.lower_bound(lo), expected.lower_bound(hi))) {
+            std::cout << "Test failed: Range does not match std::map" << std::endl;
+            return 1;
+        }
+        auto it = trie.LowerBound(lo);
+        auto want = expected.lower_bound(lo);
+        if ((it == sjtu::TrieIterator()) != (want == expected.end()) ||
+            (want != expected.end() && it.Key() != want->first)) {
+            std::cout << "Test failed: LowerBound does not match std::map" << std::endl;
+            return 1;
+        }
+        auto first = expected.lower_bound(lo);
+        auto last = first;
+        while (last != expected.end() && last->first.compare(0, lo.size(), lo) == 0) {
+            ++last;
+        }
+        if (Collect(trie.ScanPrefix(lo)) != Expect(first, last)) {
+            std::cout << "Test failed: ScanPrefix does not match std::map" << std::endl;
+            return 1;
+        }
+    }
+
+    // Interning shares one node between keys; iterators at those keys differ.
+    sjtu::TrieInterner interner;
+    const sjtu::Trie shared = interner.Intern(sjtu::Trie().Put<int>("a/x", 7).Put<int>("b/x", 7));
+    const sjtu::TrieRange both = shared.Scan();
+    auto at_a = both.begin();
+    auto at_b = at_a;
+    ++at_b;
+    if (at_a == at_b || at_b == both.end() || at_b.Key() != "b/x" || Collect(both).size() != 2) {
+        std::cout << "Test failed: iterators at keys sharing a node compare equal" << std::endl;
+        return 1;
+    }
+
+    // Store scans pin their version and report unavailable versions.
+    sjtu::TrieStore store;
+    store.Put<int>("k1", 1);
+    size_t v = store.Put<int>("k2", 2);
+    store.Remove("k1");
+    auto old_range = store.ScanPrefix("k", v);
+    auto new_range = store.Range("k", "l");
+    if (!old_range || !new_range || Collect(*old_range).size() != 2 || Collect(*new_range).size() != 1) {
+        std::cout << "Test failed: store scans returned the wrong versions" << std::endl;
+        return 1;
+    }
+    if (store.ScanPrefix("k", 100)) {
+        std::cout << "Test failed: scan of a future version succeeded" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include "../trie/src.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// Sorts keys and their encodings and checks that both orders agree and that
+// every encoding decodes back to its key.
+template<class K>
+static auto SameOrder(std::vector<K> keys) -> bool {
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    std::vector<std::string> encoded;
+    for (const K &key: keys) {
+        encoded.push_back(sjtu::EncodeKey(key));
+        if (!(sjtu::DecodeKey<K>(encoded.back()) == key)) return false;
+    }
+    return std::is_sorted(encoded.begin(), encoded.end()) &&
+           std::adjacent_find(encoded.begin(), encoded.end()) == encoded.end();
+}
+
+// Encodes integers, floats, strings with zero bytes and tuples of them, and
+// uses typed keys with a trie and a store.
+int main() {
+    std::mt19937_64 gen(20230601);
+    std::vector<int32_t> ints{0, -1, 1, std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::max()};
+    std::vector<uint64_t> longs{0, std::numeric_limits<uint64_t>::max()};
+    std::vector<int8_t> bytes;
+    std::vector<double> doubles{0.0, -0.5, 0.5, -1e300, 1e300, std::numeric_limits<double>::infinity(),
+                                -std::numeric_limits<double>::infinity()};
+    std::vector<std::string> strings{"", std::string(1, '\0'), std::string(2, '\0'), "a", std::string("a\0", 2),
+                                     "a\x01", "ab", "\xff", std::string("\0\xff", 2)};
+    std::vector<std::tuple<std::string, int32_t, uint8_t> > tuples;
+    for (int i = 0; i < 2000; i++) {
+        ints.push_back(static_cast<int32_t>(gen()));
+        longs.push_back(gen() >> (gen() % 64));
+        bytes.push_back(static_cast<int8_t>(gen()));
+        const int exponent = static_cast<int>(gen() % 200) - 100;
+        doubles.push_back(std::ldexp(static_cast<double>(static_cast<int64_t>(gen())), exponent));
+        std::string s(gen() % 4, '\0');
+        for (char &c: s) c = "\0\x01a\xff"[gen() % 4];
+        strings.push_back(s);
+        tuples.emplace_back(s, static_cast<int32_t>(gen() % 5) - 2, static_cast<uint8_t>(gen()));
+    }
+    if (!SameOrder(ints) || !SameOrder(longs) || !SameOrder(bytes) || !SameOrder(doubles)) {
+        std::cout << "Test failed: encoded numbers are out of order" << std::endl;
+        return 1;
+    }
+    if (!SameOrder(strings) || !SameOrder(tuples) ||
+        !SameOrder(std::vector<std::pair<uint16_t, std::string> >{{1, "b"}, {1, "a"}, {0, "z"}})) {
+        std::cout << "Test failed: encoded strings or tuples are out of order" << std::endl;
+        return 1;
+    }
+    if (sjtu::EncodeKey(uint32_t{0x01020304}) != "\x01\x02\x03\x04" ||
+        sjtu::EncodeKey(std::string("x"), int16_t{1}) !=
+        sjtu::EncodeKey(std::make_tuple(std::string("x"), int16_t{1}))) {
+        std::cout << "Test failed: wrong key bytes" << std::endl;
+        return 1;
+    }
+    auto throws = [](auto decode) {
+        try {
+            decode();
+        } catch (const std::runtime_error &) {
+            return true;
+        }
+        return false;
+    };
+    if (!throws([] { sjtu::DecodeKey<uint32_t>("\x01\x02"); }) ||
+        !throws([] { sjtu::DecodeKey<uint8_t>("\x01\x02"); }) || !throws([] { sjtu::DecodeKey<std::string>("ab"); }) ||
+        !throws([] { sjtu::DecodeKey<std::string>(std::string("a\0\x02", 3)); })) {
+        std::cout << "Test failed: bad key bytes were decoded" << std::endl;
+        return 1;
+    }
+
+    // A trie of typed keys iterates in key order, and takes fewer nodes than
+    // zero-padded decimal keys.
+    sjtu::Trie typed;
+    sjtu::Trie padded;
+    std::vector<int32_t> keys(ints.begin(), ints.begin() + 1000);
+    for (int32_t key: keys) {
+        typed = typed.Put<int32_t>(key, key);
+        std::stringstream ss;
+        ss << std::setfill('0') << std::setw(11) << static_cast<int64_t>(key) + 2147483648LL;
+        padded = padded.Put<int32_t>(ss.str(), key);
+    }
+    typed = typed.Remove(keys[0]).Put<int>(0, 7);
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    std::vector<int32_t> scanned;
+    for (auto it = typed.Scan().begin(); it != sjtu::TrieIterator(); ++it) {
+        scanned.push_back(sjtu::DecodeKey<int32_t>(it->Key()));
+    }
+    if (scanned != keys || *typed.Get<int>(0) != 7 || *typed.Get<int32_t>(keys[1]) != keys[1] ||
+        typed.Get<int32_t>(keys[0] == 12345 ? 54321 : 12345) || typed.Memory().Bytes() >= padded.Memory().Bytes()) {
+        std::cout << "Test failed: wrong trie of typed keys" << std::endl;
+        return 1;
+    }
+
+    sjtu::TrieStore store;
+    const auto key = std::make_tuple(std::string("user"), uint64_t{42});
+    store.Put<int>(key, 1);
+    const size_t version = store.Put<int>(std::make_pair(std::string("user"), uint64_t{43}), 2);
+    if (**store.Get<int>(key) != 1 || store.Remove(key) != version + 1 || store.Get<int>(key) ||
+        **store.Get<int>(key, version) != 1 || !store.Get<int>(sjtu::EncodeKey(std::string("user"), uint64_t{43}))) {
+        std::cout << "Test failed: wrong store of typed keys" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
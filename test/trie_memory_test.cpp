@@ -0,0 +1,109 @@
+#include "../trie/src.hpp"
+#include <atomic>
+#include <iostream>
+#include <memory_resource>
+#include <string>
+
+// A resource that counts the bytes allocated from it that are still live.
+class CountingResource : public std::pmr::memory_resource {
+public:
+    std::atomic<long> live{0};
+
+private:
+    auto do_allocate(size_t bytes, size_t alignment) -> void * override {
+        live += static_cast<long>(bytes);
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+        live -= static_cast<long>(bytes);
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    auto do_is_equal(const std::pmr::memory_resource &other) const noexcept -> bool override {
+        return this == &other;
+    }
+};
+
+// Keys over three letters, so that no child table leaves its node and every
+// byte of a trie is allocated from its resource.
+static auto Key(int i) -> std::string {
+    std::string key;
+    for (int n = i + 1; n > 0; n /= 3) {
+        key += static_cast<char>('a' + n % 3);
+    }
+    return key;
+}
+
+// Measures tries and store versions that share structure, and checks the
+// unique bytes against what dropping them frees.
+int main() {
+    CountingResource counting;
+    {
+        sjtu::Trie trie(&counting);
+        for (int i = 0; i < 3000; i++) {
+            trie = i % 2 == 0 ? trie.Put<int>(Key(i), i) : trie.Put<std::string>(Key(i), std::string(40, 'v'));
+        }
+        const sjtu::TrieMemory whole = trie.Memory();
+        if (whole.value_nodes != 3000 || whole.nodes < whole.value_nodes || whole.unique_bytes != whole.Bytes() ||
+            whole.shared_bytes != 0 || whole.map_bytes != 0 || whole.value_bytes == 0) {
+            std::cout << "Test failed: wrong memory of a trie held once" << std::endl;
+            return 1;
+        }
+        if (whole.Bytes() > static_cast<size_t>(counting.live) * 11 / 10 ||
+            whole.Bytes() * 11 / 10 < static_cast<size_t>(counting.live)) {
+            std::cout << "Test failed: a trie of " << counting.live << " bytes was measured at " << whole.Bytes()
+                    << std::endl;
+            return 1;
+        }
+
+        // A copy holds everything, so nothing is unique.
+        sjtu::Trie copy = trie;
+        if (trie.Memory().shared_bytes != whole.Bytes()) {
+            std::cout << "Test failed: a copied trie has unique bytes" << std::endl;
+            return 1;
+        }
+
+        // After a put the old version only owns the path that was copied, and a
+        // long string on that path is still shared with the new version.
+        copy = trie.Put<int>(Key(1), -1);
+        const sjtu::TrieMemory old = trie.Memory();
+        const long before = counting.live;
+        if (old.Bytes() != whole.Bytes() || old.unique_bytes == 0 || old.unique_bytes * 50 > old.Bytes()) {
+            std::cout << "Test failed: the old version owns " << old.unique_bytes << " of " << old.Bytes()
+                    << " bytes" << std::endl;
+            return 1;
+        }
+        trie = sjtu::Trie();
+        const long freed = before - counting.live;
+        if (old.unique_bytes > static_cast<size_t>(freed) * 11 / 10 ||
+            old.unique_bytes * 11 / 10 < static_cast<size_t>(freed)) {
+            std::cout << "Test failed: dropping a version freed " << freed << " bytes, measured "
+                    << old.unique_bytes << std::endl;
+            return 1;
+        }
+    }
+
+    // In a store the newest version's nodes are all held by the store.
+    sjtu::TrieStore store(sjtu::RetentionPolicy{8});
+    for (int i = 0; i < 1000; i++) {
+        store.Put<int>(Key(i), i);
+    }
+    const size_t newest = store.get_version();
+    const auto all = store.Memory(0);
+    const auto one = store.Memory(newest - 3, newest - 3);
+    if (!all || all->unique_bytes != all->Bytes() || !one || one->unique_bytes == 0 ||
+        one->unique_bytes * 20 > one->Bytes() || store.Memory(newest + 1) || store.Memory(0, 10)) {
+        std::cout << "Test failed: wrong memory of store versions" << std::endl;
+        return 1;
+    }
+    // A guard keeps its node alive apart from the versions.
+    auto guard = store.Get<int>(Key(0));
+    if (store.Memory(0)->shared_bytes == 0) {
+        std::cout << "Test failed: a node held by a guard is unique" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include "../trie/src.hpp"
+#include <atomic>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Every key of a store's newest version, with its int value.
+static auto Content(sjtu::TrieStore &store) -> std::vector<std::pair<std::string, int> > {
+    std::vector<std::pair<std::string, int> > content;
+    const auto range = store.ScanPrefix("");
+    for (const auto &entry: *range) {
+        content.emplace_back(entry.Key(), *entry.Value<int>());
+    }
+    return content;
+}
+
+// A follower replays a leader through deltas while the leader is written and
+// follower readers check that every version they see is consistent.
+int main() {
+    // The leader keeps few versions, so a follower that falls behind gets a full
+    // delta now and then.
+    sjtu::TrieStore leader(sjtu::RetentionPolicy{8});
+    sjtu::TrieStore follower;
+    std::atomic<bool> stop{false};
+    std::atomic<bool> failed{false};
+
+    std::thread writer([&] {
+        for (int i = 0; i < 3000; i++) {
+            sjtu::TrieStore::WriteBatch batch;
+            batch.Put<int>("pair/a", i).Put<int>("pair/b", i).Put<int>("key/" + std::to_string(i % 400), i);
+            leader.Commit(std::move(batch));
+            if (i % 3 == 0) {
+                leader.Remove("key/" + std::to_string((i * 7) % 400));
+            }
+        }
+        stop = true;
+    });
+    std::thread reader([&] {
+        while (!stop) {
+            const size_t version = follower.get_version();
+            auto a = follower.Get<int>("pair/a", version);
+            auto b = follower.Get<int>("pair/b", version);
+            if (a.has_value() != b.has_value() || (a && **a != **b)) {
+                failed = true;
+            }
+        }
+    });
+    size_t deltas = 0;
+    while (!stop) {
+        follower.ApplyDelta(leader.DeltaSince(follower.ReplicatedVersion()));
+        ++deltas;
+    }
+    writer.join();
+    reader.join();
+    follower.ApplyDelta(leader.DeltaSince(follower.ReplicatedVersion()));
+    if (failed) {
+        std::cout << "Test failed: a follower reader saw half of a batch" << std::endl;
+        return 1;
+    }
+    if (follower.ReplicatedVersion() != leader.get_version() || Content(follower) != Content(leader) ||
+        deltas == 0) {
+        std::cout << "Test failed: the follower does not match the leader" << std::endl;
+        return 1;
+    }
+
+    // An empty delta creates no version; a delta from another starting point is
+    // refused, and a damaged one is detected.
+    const size_t version = follower.get_version();
+    const std::string empty = leader.DeltaSince(leader.get_version());
+    if (follower.ApplyDelta(empty) != version || sjtu::TrieDelta(empty).Size() != 0) {
+        std::cout << "Test failed: an empty delta created a version" << std::endl;
+        return 1;
+    }
+    leader.Put<int>("late", 1);
+    const std::string next = leader.DeltaSince(leader.get_version() - 1);
+    leader.Put<int>("later", 2);
+    try {
+        follower.ApplyDelta(leader.DeltaSince(leader.get_version() - 1));
+        std::cout << "Test failed: a delta with a gap was applied" << std::endl;
+        return 1;
+    } catch (const std::invalid_argument &) {
+    }
+    std::string broken = next;
+    broken[broken.size() / 2] ^= 1;
+    try {
+        follower.ApplyDelta(broken);
+        std::cout << "Test failed: a damaged delta was applied" << std::endl;
+        return 1;
+    } catch (const std::runtime_error &) {
+    }
+    follower.ApplyDelta(next);
+    if (**follower.Get<int>("late") != 1 || follower.Get<int>("later")) {
+        std::cout << "Test failed: the next delta was not applied" << std::endl;
+        return 1;
+    }
+
+    // In one process a follower can adopt the leader's trie, sharing its nodes.
+    sjtu::TrieStore grafted;
+    grafted.Put<int>("stale", 1);
+    grafted.CatchUp(leader);
+    if (Content(grafted) != Content(leader) || grafted.ReplicatedVersion() != leader.get_version() ||
+        grafted.Get<int>("stale")) {
+        std::cout << "Test failed: catching up did not copy the leader" << std::endl;
+        return 1;
+    }
+    const size_t grafted_version = grafted.get_version();
+    if (grafted.CatchUp(leader) != grafted_version || !grafted.Diff(grafted_version - 1)) {
+        std::cout << "Test failed: catching up twice created a version" << std::endl;
+        return 1;
+    }
+
+    // A key far longer than the call stack is deep, through deltas and CatchUp.
+    {
+        const std::string long_key(100000, 'L');
+        sjtu::TrieStore long_leader;
+        long_leader.Put<int>(long_key, 1);
+        sjtu::TrieStore delta_follower;
+        sjtu::TrieStore catch_up_follower;
+        delta_follower.ApplyDelta(long_leader.DeltaSince(0));
+        catch_up_follower.CatchUp(long_leader);
+        long_leader.Put<int>(long_key, 2);
+        long_leader.Put<int>(long_key.substr(0, 99990), 3);
+        delta_follower.ApplyDelta(long_leader.DeltaSince(delta_follower.ReplicatedVersion()));
+        catch_up_follower.CatchUp(long_leader);
+        if (Content(delta_follower) != Content(long_leader) || Content(catch_up_follower) != Content(long_leader) ||
+            **delta_follower.Get<int>(long_key) != 2) {
+            std::cout << "Test failed: a long key was not replicated" << std::endl;
+            return 1;
+        }
+    }
+
+    // A durable follower logs what the deltas change and recovers it.
+    sjtu::DurabilityOptions options;
+    options.directory = (std::filesystem::temp_directory_path() / "sjtu_trie_replication_test").string();
+    std::filesystem::remove_all(options.directory);
+    {
+        sjtu::TrieStore durable(options);
+        durable.ApplyDelta(leader.DeltaSince(0));
+        leader.Remove("late");
+        durable.ApplyDelta(leader.DeltaSince(durable.ReplicatedVersion()));
+    }
+    {
+        sjtu::TrieStore durable(options);
+        if (Content(durable) != Content(leader)) {
+            std::cout << "Test failed: a durable follower lost replicated writes" << std::endl;
+            return 1;
+        }
+    }
+    std::filesystem::remove_all(options.directory);
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include "../trie/src.hpp"
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <stdexcept>
+#include <vector>
+
+// A value whose move throws while armed, to fail a batch as it is applied.
+struct Explosive {
+    static inline bool armed = false;
+
+    Explosive() = default;
+
+    Explosive(Explosive &&) {
+        if (armed) throw std::runtime_error("Explosive: moved while armed");
+    }
+
+    Explosive(const Explosive &) = default;
+};
+
+// Checks both routings of ShardedTrieStore, parallel writers, and that a
+// version vector never sees half of a cross-shard batch, also one that fails.
+int main() {
+    using Routing = sjtu::ShardedTrieStore::Routing;
+    for (Routing routing: {Routing::kHash, Routing::kFirstByte}) {
+        sjtu::ShardedTrieStore store(8, routing);
+        std::vector<std::thread> writers;
+        for (int t = 0; t < 8; t++) {
+            writers.emplace_back([&store, t] {
+                for (int i = 0; i < 500; i++) {
+                    std::string key = std::string(1, static_cast<char>('a' + t)) + "/" + std::to_string(i);
+                    store.Put<int>(key, i);
+                    if (i % 5 == 0) {
+                        store.Remove(key);
+                    }
+                }
+            });
+        }
+        for (auto &writer: writers) {
+            writer.join();
+        }
+        for (int t = 0; t < 8; t++) {
+            for (int i = 0; i < 500; i++) {
+                std::string key = std::string(1, static_cast<char>('a' + t)) + "/" + std::to_string(i);
+                auto value = store.Get<int>(key);
+                if ((i % 5 == 0) != !value || (value && **value != i)) {
+                    std::cout << "Test failed: wrong value for " << key << std::endl;
+                    return 1;
+                }
+            }
+        }
+
+        // First-byte routing keeps a prefix in one shard and shards in key order.
+        auto ranges = store.ScanPrefix("c/4", store.Versions());
+        if (!ranges || (routing == Routing::kFirstByte && ranges->size() != 1)) {
+            std::cout << "Test failed: prefix scan touched the wrong shards" << std::endl;
+            return 1;
+        }
+        size_t count = 0;
+        for (const auto &range: *ranges) {
+            for (const auto &entry: range) {
+                count += entry.Key().compare(0, 3, "c/4") == 0;
+            }
+        }
+        // c/4, c/4x and c/4xx for i < 500, minus the removed multiples of 5.
+        if (count != 111 - 22) {
+            std::cout << "Test failed: prefix scan found " << count << " keys" << std::endl;
+            return 1;
+        }
+        if (routing == Routing::kFirstByte && (store.ShardOf("a") > store.ShardOf("h") || store.ShardOf("") != 0)) {
+            std::cout << "Test failed: first-byte shards are not in key order" << std::endl;
+            return 1;
+        }
+    }
+
+    // One writer moves a counter on two shards in a batch; readers of version
+    // vectors must always see both halves agree.
+    sjtu::ShardedTrieStore store(4, Routing::kFirstByte);
+    if (store.ShardOf("0") == store.ShardOf("z")) {
+        std::cout << "Test failed: keys expected on different shards share one" << std::endl;
+        return 1;
+    }
+    std::atomic<bool> stop{false};
+    std::atomic<bool> failed{false};
+    std::thread reader([&] {
+        while (!stop) {
+            auto versions = store.Versions();
+            auto a = store.Get<int>("0", versions);
+            auto z = store.Get<int>("z", versions);
+            if (a.has_value() != z.has_value() || (a && **a != **z)) {
+                failed = true;
+            }
+        }
+    });
+    for (int i = 0; i < 3000; i++) {
+        sjtu::TrieStore::WriteBatch batch;
+        batch.Put<int>("0", i).Put<int>("z", i);
+        auto versions = store.Commit(std::move(batch));
+        if (**store.Get<int>("z", versions) != i) {
+            failed = true;
+        }
+    }
+    stop = true;
+    reader.join();
+    if (failed) {
+        std::cout << "Test failed: a version vector saw half of a batch" << std::endl;
+        return 1;
+    }
+
+    // A batch whose part for a later shard fails to apply publishes no part.
+    sjtu::TrieStore::WriteBatch failing;
+    failing.Put<int>("0", -1).Put<Explosive>("z", Explosive{});
+    const auto before = store.Versions();
+    Explosive::armed = true;
+    try {
+        store.Commit(std::move(failing));
+        std::cout << "Test failed: a failing batch was committed" << std::endl;
+        return 1;
+    } catch (const std::runtime_error &) {
+    }
+    Explosive::armed = false;
+    if (store.Versions() != before || **store.Get<int>("0") != 2999) {
+        std::cout << "Test failed: part of a failing batch was published" << std::endl;
+        return 1;
+    }
+
+    try {
+        sjtu::ShardedTrieStore too_many(300, Routing::kFirstByte);
+        std::cout << "Test failed: 300 first-byte shards were accepted" << std::endl;
+        return 1;
+    } catch (const std::invalid_argument &) {
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
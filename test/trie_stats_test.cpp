@@ -0,0 +1,100 @@
+#define SJTU_TRIE_STATS
+#include "../trie/src.hpp"
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Stats = sjtu::TrieStats;
+
+// Runs gets, puts, removes and commits on several threads and checks that the
+// counters and histograms add up to what was done, and that a store reports
+// its versions. Sharded commits are counted too.
+int main() {
+    const Stats::Snapshot before = Stats::Collect();
+    sjtu::TrieStore store(sjtu::RetentionPolicy{4});
+    constexpr int kThreads = 4;
+    constexpr int kOps = 2000;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+        threads.emplace_back([&store, t] {
+            for (int i = 0; i < kOps; i++) {
+                const std::string key = std::to_string(t) + "/" + std::to_string(i % 100);
+                store.Put<int>(key, i);
+                auto guard = store.Get<int>(key);
+                if (i % 4 == 0) {
+                    store.Remove(key);
+                }
+                if (i % 10 == 0) {
+                    sjtu::TrieStore::WriteBatch batch;
+                    batch.Put<int>(key + "/a", i).Put<int>(key + "/b", i);
+                    store.Commit(std::move(batch));
+                }
+            }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    // A historical read is a get as well.
+    auto old = store.Get<int>("0/1", store.get_version() - 1);
+
+    const sjtu::TrieStoreStats stats = store.Stats();
+    const Stats::Snapshot &after = stats.threads;
+    auto counted = [&](Stats::Counter counter) { return after.counters[counter] - before.counters[counter]; };
+    auto recorded = [&](Stats::Histogram histogram) { return after.Count(histogram) - before.Count(histogram); };
+    const uint64_t ops = kThreads * kOps;
+    if (counted(Stats::kGets) != ops + 1 || counted(Stats::kPuts) != ops || counted(Stats::kRemoves) != ops / 4 ||
+        counted(Stats::kCommits) != ops / 10) {
+        std::cout << "Test failed: the operation counters do not match the operations" << std::endl;
+        return 1;
+    }
+    if (recorded(Stats::kGetLatency) != ops + 1 || recorded(Stats::kPutLatency) != ops ||
+        recorded(Stats::kRemoveLatency) != ops / 4 || recorded(Stats::kCommitLatency) != ops / 10) {
+        std::cout << "Test failed: the histograms do not count every operation" << std::endl;
+        return 1;
+    }
+    if (counted(Stats::kClones) == 0 || counted(Stats::kNodesCreated) < counted(Stats::kClones) ||
+        counted(Stats::kWriteLockHoldNanos) == 0) {
+        std::cout << "Test failed: nodes or lock times were not counted" << std::endl;
+        return 1;
+    }
+    if (after.Percentile(Stats::kPutLatency, 0.5) == 0 ||
+        after.Percentile(Stats::kPutLatency, 0.5) > after.Percentile(Stats::kPutLatency, 0.99)) {
+        std::cout << "Test failed: wrong put latency percentiles" << std::endl;
+        return 1;
+    }
+
+    // The gauges describe the store's versions.
+    if (stats.newest_version != store.get_version() || stats.live_versions > 4 + stats.pinned_versions ||
+        stats.live_versions == 0 || stats.pinned_versions != 0) {
+        std::cout << "Test failed: wrong version gauges" << std::endl;
+        return 1;
+    }
+    store.Pin(store.get_version());
+    store.Put<int>("pinned", 1);
+    if (store.Stats().pinned_versions != 1) {
+        std::cout << "Test failed: a pinned version was not reported" << std::endl;
+        return 1;
+    }
+
+    // A commit across the shards of a ShardedTrieStore counts once, with the
+    // time it held the shards' write locks.
+    sjtu::ShardedTrieStore sharded(4, sjtu::ShardedTrieStore::Routing::kFirstByte);
+    const Stats::Snapshot before_sharded = Stats::Collect();
+    for (int i = 0; i < 10; i++) {
+        sjtu::TrieStore::WriteBatch batch;
+        batch.Put<int>("0", i).Put<int>("z", i);
+        sharded.Commit(std::move(batch));
+    }
+    const Stats::Snapshot after_sharded = Stats::Collect();
+    if (after_sharded.counters[Stats::kCommits] - before_sharded.counters[Stats::kCommits] != 10 ||
+        after_sharded.Count(Stats::kCommitLatency) - before_sharded.Count(Stats::kCommitLatency) != 10 ||
+        after_sharded.counters[Stats::kWriteLockHoldNanos] == before_sharded.counters[Stats::kWriteLockHoldNanos]) {
+        std::cout << "Test failed: sharded commits were not counted" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,198 @@
+#include "../trie/src.hpp"
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Set once a MoveBlocked starts waiting.
+static std::atomic<bool> moving{false};
+
+// A value whose first move waits until a promise is fulfilled, which keeps a
+// synchronous Put holding the write lock.
+class MoveBlocked {
+public:
+    explicit MoveBlocked(std::future<int> wait): wait_(std::move(wait)) {
+    }
+
+    MoveBlocked(MoveBlocked &&that) noexcept {
+        if (!that.waited_) {
+            moving = true;
+            that.wait_.get();
+        }
+        that.waited_ = waited_ = true;
+    }
+
+    bool waited_{false};
+    std::future<int> wait_;
+};
+
+// Set once a Gate starts waiting, and set to let it go on.
+static std::atomic<bool> gated{false};
+static std::atomic<bool> opened{false};
+
+// A value that waits for opened when it is moved on another thread than the
+// one that made it, which keeps the writer thread inside a group.
+struct Gate {
+    Gate() = default;
+
+    Gate(Gate &&that) noexcept: owner(that.owner) {
+        if (std::this_thread::get_id() != owner) {
+            gated = true;
+            while (!opened) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    std::thread::id owner{std::this_thread::get_id()};
+};
+
+template<>
+struct sjtu::TrieCodec<Gate> {
+    static constexpr uint32_t kId = sjtu::kUserTrieCodecId;
+
+    static void Encode(const Gate &, std::string &) {
+    }
+
+    static auto Decode(std::string_view) -> Gate { return {}; }
+};
+
+// Submits asynchronous writes from several threads and checks their versions,
+// that they do not wait for a blocked writer, and WaitForVersion.
+int main() {
+    sjtu::TrieStore store;
+    constexpr int kThreads = 4;
+    constexpr int kWrites = 500;
+    std::vector<std::vector<std::pair<std::string, std::future<size_t> > > > futures(kThreads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+        threads.emplace_back([&store, &futures, t] {
+            for (int i = 0; i < kWrites; i++) {
+                const std::string key = std::to_string(t) + "/" + std::to_string(i);
+                if (i % 5 == 4) {
+                    futures[t].emplace_back(key, store.RemoveAsync(std::to_string(t) + "/" + std::to_string(i - 1)));
+                } else if (i % 5 == 3) {
+                    sjtu::TrieStore::WriteBatch batch;
+                    batch.Put<int>(key, i).Put<int>(key + "/b", i);
+                    futures[t].emplace_back(key, store.CommitAsync(std::move(batch)));
+                } else {
+                    futures[t].emplace_back(key, store.PutAsync<int>(key, i));
+                }
+            }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    for (int t = 0; t < kThreads; t++) {
+        std::vector<size_t> versions;
+        for (auto &[key, future]: futures[t]) {
+            versions.push_back(future.get());
+        }
+        for (int i = 0; i < kWrites; i++) {
+            // The writes of one thread land in the order it submitted them; a
+            // commit may share its version with the remove that follows it.
+            const std::string &key = futures[t][i].first;
+            const bool removed = i % 5 == 4 || (i % 5 == 3 && versions[i + 1] == versions[i]);
+            const std::string target = i % 5 == 4 ? std::to_string(t) + "/" + std::to_string(i - 1) : key;
+            auto value = store.Get<int>(target, versions[i]);
+            if ((i > 0 && versions[i] < versions[i - 1]) || value.has_value() == removed || (value && **value != i)) {
+                std::cout << "Test failed: wrong version " << versions[i] << " for write " << key << std::endl;
+                return 1;
+            }
+        }
+    }
+    if (store.WaitForVersion(store.get_version()) != store.get_version()) {
+        std::cout << "Test failed: waiting for a published version" << std::endl;
+        return 1;
+    }
+
+    // While a synchronous Put holds the write lock, an asynchronous one returns
+    // at once, and a reader waiting for its version wakes when it lands.
+    std::promise<int> release;
+    std::thread blocked([&store, &release] {
+        store.Put<MoveBlocked>("blocked", MoveBlocked(release.get_future()));
+    });
+    while (!moving) {
+        std::this_thread::yield();
+    }
+    const size_t before = store.get_version();
+    std::future<size_t> pending = store.PutAsync<int>("async", 1);
+    std::future<size_t> waited = std::async(std::launch::async, [&store, before] {
+        return store.WaitForVersion(before + 2);
+    });
+    if (pending.wait_for(std::chrono::milliseconds(50)) != std::future_status::timeout ||
+        waited.wait_for(std::chrono::milliseconds(0)) != std::future_status::timeout) {
+        std::cout << "Test failed: an asynchronous write did not wait for the blocked writer" << std::endl;
+        return 1;
+    }
+    release.set_value(0);
+    blocked.join();
+    if (pending.get() != before + 2 || waited.get() < before + 2 || **store.Get<int>("async") != 1) {
+        std::cout << "Test failed: the asynchronous write after the blocked one" << std::endl;
+        return 1;
+    }
+
+    // A batch a durable store cannot log fails alone, and a batch queued with
+    // it still commits.
+    sjtu::TrieCodecRegistry::Register<Gate>();
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / "sjtu_trie_store_async_test";
+    std::filesystem::remove_all(directory);
+    sjtu::DurabilityOptions options;
+    options.directory = directory.string();
+    {
+        sjtu::TrieStore durable(options);
+        std::future<size_t> held = durable.PutAsync<Gate>("gate", Gate());
+        while (!gated) {
+            std::this_thread::yield();
+        }
+        sjtu::TrieStore::WriteBatch bad;
+        bad.Put<int>("bad", 1).Put<std::vector<int> >("vector", {1});
+        sjtu::TrieStore::WriteBatch good;
+        good.Put<int>("good", 2);
+        std::future<size_t> refused = durable.CommitAsync(std::move(bad));
+        std::future<size_t> committed = durable.CommitAsync(std::move(good));
+        opened = true;
+        const size_t gate = held.get();
+        try {
+            refused.get();
+            std::cout << "Test failed: a batch without a codec was committed" << std::endl;
+            return 1;
+        } catch (const std::runtime_error &) {
+        }
+        if (committed.get() != gate + 1 || **durable.Get<int>("good") != 2 || durable.Get<int>("bad")) {
+            std::cout << "Test failed: a failed batch took down its group" << std::endl;
+            return 1;
+        }
+    }
+    {
+        sjtu::TrieStore recovered(options);
+        if (recovered.get_version() != 2 || **recovered.Get<int>("good") != 2 || recovered.Get<int>("bad")) {
+            std::cout << "Test failed: a failed batch was logged" << std::endl;
+            return 1;
+        }
+    }
+    std::filesystem::remove_all(directory);
+
+    // Destroying a store applies the writes still queued.
+    std::vector<std::future<size_t> > queued;
+    {
+        sjtu::TrieStore doomed;
+        for (int i = 0; i < 1000; i++) {
+            queued.push_back(doomed.PutAsync<int>(std::to_string(i), i));
+        }
+    }
+    for (auto &future: queued) {
+        if (future.get() == 0) {
+            std::cout << "Test failed: a queued write was dropped" << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
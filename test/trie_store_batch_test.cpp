@@ -0,0 +1,82 @@
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "../trie/src.hpp"
+
+using Integer = std::unique_ptr<uint32_t>;
+
+// A batch becomes visible as exactly one version, all at once.
+int main() {
+    sjtu::TrieStore store;
+    store.Put<int>("gone", 0);
+    const size_t before = store.get_version();
+
+    std::atomic<bool> stop{false};
+    std::atomic<bool> torn{false};
+    std::thread reader([&store, &stop, &torn] {
+        while (!stop) {
+            // Any version either has all of the batch or none of it.
+            size_t version = store.get_version();
+            bool has_last = store.Get<int>("batch/999", version) != std::nullopt;
+            bool has_gone = store.Get<int>("gone", version) != std::nullopt;
+            auto first = store.Get<int>("batch/0", version);
+            if (has_last == has_gone || has_last != (first != std::nullopt && **first == -1)) {
+                torn = true;
+            }
+        }
+    });
+
+    sjtu::TrieStore::WriteBatch batch;
+    for (int i = 0; i < 1000; i++) {
+        batch.Put<int>("batch/" + std::to_string(i), i);
+    }
+    batch.Put<Integer>("batch/ptr", std::make_unique<uint32_t>(233));
+    batch.Remove("gone");
+    batch.Put<int>("batch/0", -1);
+    const size_t after = store.Commit(std::move(batch));
+    stop = true;
+    reader.join();
+
+    if (after != before + 1 || store.get_version() != after || torn) {
+        std::cout << "Test failed: batch was not published as one version" << std::endl;
+        return 1;
+    }
+    if (**store.Get<int>("batch/0") != -1 || **store.Get<int>("batch/999") != 999 ||
+        ***store.Get<Integer>("batch/ptr") != 233 || store.Get<int>("gone") != std::nullopt) {
+        std::cout << "Test failed: wrong content after the batch" << std::endl;
+        return 1;
+    }
+    if (store.Get<int>("batch/1", before) != std::nullopt || **store.Get<int>("gone", before) != 0) {
+        std::cout << "Test failed: the batch modified an older version" << std::endl;
+        return 1;
+    }
+
+    // A batch that changes nothing does not create a version.
+    sjtu::TrieStore::WriteBatch noop;
+    noop.Remove("missing").Remove("batch/");
+    if (store.Commit(std::move(noop)) != after || store.Commit({}) != after) {
+        std::cout << "Test failed: an empty batch created a version" << std::endl;
+        return 1;
+    }
+
+    // The working copy keeps editing the nodes it has already copied.
+    sjtu::Trie base;
+    base = base.Put<int>("ab", 1).Put<int>("ac", 2);
+    sjtu::TransientTrie transient(base);
+    transient.Put<int>("ad", 3);
+    transient.Put<int>("ae", 4);
+    transient.Remove("ab");
+    sjtu::Trie frozen = transient.Freeze();
+    transient.Put<int>("af", 5);
+    if (*base.Get<int>("ab") != 1 || base.Get<int>("ad") != nullptr || frozen.Get<int>("ab") != nullptr ||
+        *frozen.Get<int>("ae") != 4 || frozen.Get<int>("af") != nullptr || *transient.Get<int>("af") != 5) {
+        std::cout << "Test failed: transient edits leaked into another trie" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,353 @@
+#include "../trie/src.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef SJTU_TRIE_POSIX
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#endif
+
+// A value type with its own codec, registered so that recovery can rebuild it.
+struct Point {
+    int x;
+    int y;
+};
+
+template<>
+struct sjtu::TrieCodec<Point> : sjtu::TrivialTrieCodec<Point, sjtu::kUserTrieCodecId> {
+};
+
+namespace fs = std::filesystem;
+
+static auto Files(const fs::path &directory, const std::string &extension) -> std::vector<fs::path> {
+    std::vector<fs::path> files;
+    for (const auto &entry: fs::directory_iterator(directory)) {
+        if (entry.path().extension() == extension) {
+            files.push_back(entry.path());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// Writes to durable stores, reopens them, and checks what comes back: after a
+// clean close, after a torn log tail, from chains of incremental checkpoints,
+// after a write the log could not take, and through interrupted writes.
+int main() {
+    sjtu::TrieCodecRegistry::Register<Point>();
+    const fs::path directory = fs::temp_directory_path() / "sjtu_trie_store_durability_test";
+    fs::remove_all(directory);
+    sjtu::DurabilityOptions options;
+    options.directory = directory.string();
+
+    // Everything written comes back, as the same version.
+    size_t version;
+    {
+        sjtu::TrieStore store(options);
+        for (int i = 0; i < 300; i++) {
+            store.Put<int>("key" + std::to_string(i), i);
+        }
+        store.Remove("key7");
+        store.Put<std::string>("name", "durable");
+        store.Put<Point>("point", Point{1, 2});
+        sjtu::TrieStore::WriteBatch batch;
+        batch.Put<double>("ratio", 0.5).Remove("key8").Put<int>("key9", -9);
+        store.Commit(std::move(batch));
+        sjtu::TrieStore::WriteBatch group;
+        group.Put<int>("group", 1);
+        version = store.GroupCommit(std::move(group));
+    }
+    {
+        sjtu::TrieStore store(options);
+        auto point = store.Get<Point>("point");
+        if (store.get_version() != version || **store.Get<int>("key299") != 299 || store.Get<int>("key7") ||
+            store.Get<int>("key8") || **store.Get<int>("key9") != -9 || **store.Get<std::string>("name") != "durable" ||
+            !point || (**point).y != 2 || **store.Get<double>("ratio") != 0.5 || **store.Get<int>("group") != 1) {
+            std::cout << "Test failed: reopening the store lost writes" << std::endl;
+            return 1;
+        }
+        if (store.Lookup<int>("key1", version - 1).status != sjtu::LookupStatus::kVersionExpired) {
+            std::cout << "Test failed: a version before recovery is still available" << std::endl;
+            return 1;
+        }
+        if (store.Put<int>("after", 1) != version + 1) {
+            std::cout << "Test failed: versions do not continue after recovery" << std::endl;
+            return 1;
+        }
+    }
+
+    // Recovery folded the log into a checkpoint; a few changes make a small
+    // incremental checkpoint on top of it.
+    {
+        sjtu::TrieStore store(options);
+        for (int i = 0; i < 5000; i++) {
+            store.Put<std::string>("bulk/" + std::to_string(i), std::string(20, 'b'));
+        }
+        const size_t full = store.Checkpoint();
+        for (int i = 0; i < 10; i++) {
+            store.Put<int>("bulk/" + std::to_string(i * 500), i);
+        }
+        const size_t incremental = store.Checkpoint();
+        const auto checkpoints = Files(directory, ".ckpt");
+        if (checkpoints.size() < 2 || fs::file_size(checkpoints.back()) * 20 > fs::file_size(checkpoints[
+                checkpoints.size() - 2]) || incremental != full + 10 || store.Checkpoint() != incremental) {
+            std::cout << "Test failed: an incremental checkpoint is not small" << std::endl;
+            return 1;
+        }
+        if (Files(directory, ".log").size() != 1) {
+            std::cout << "Test failed: a checkpoint did not delete the log it covers" << std::endl;
+            return 1;
+        }
+        version = store.Remove("bulk/1");
+    }
+    {
+        sjtu::TrieStore store(options);
+        if (store.get_version() != version || **store.Get<int>("bulk/4500") != 9 || store.Get<std::string>("bulk/1") ||
+            **store.Get<std::string>("bulk/4999") != std::string(20, 'b') || **store.Get<int>("key9") != -9) {
+            std::cout << "Test failed: recovering from incremental checkpoints lost writes" << std::endl;
+            return 1;
+        }
+    }
+
+    // A torn record at the end of the log loses only the version it belongs to.
+    {
+        sjtu::TrieStore store(options);
+        store.Put<int>("torn", 1);
+        version = store.Put<int>("torn", 2);
+    }
+    {
+        const fs::path log = Files(directory, ".log").back();
+        fs::resize_file(log, fs::file_size(log) - 3);
+        sjtu::TrieStore store(options);
+        if (store.get_version() != version - 1 || **store.Get<int>("torn") != 1) {
+            std::cout << "Test failed: a torn log tail was not cut off" << std::endl;
+            return 1;
+        }
+        store.Put<int>("torn", 3);
+    }
+    {
+        sjtu::TrieStore store(options);
+        if (**store.Get<int>("torn") != 3) {
+            std::cout << "Test failed: a write after a torn tail was lost" << std::endl;
+            return 1;
+        }
+    }
+
+    // Writes after a torn record that was all of the newest segment, and after
+    // a corrupt record in the middle of one, are not logged behind it.
+    {
+        fs::remove_all(directory);
+        sjtu::DurabilityOptions every_op = options;
+        every_op.sync = sjtu::LogSync::kEveryOp;
+        {
+            sjtu::TrieStore store(every_op);
+            store.Put<int>("kept", 1);
+            store.Checkpoint();
+            store.Put<int>("torn", 1);
+        }
+        const fs::path log = Files(directory, ".log").back();
+        fs::resize_file(log, fs::file_size(log) - 3);
+        {
+            sjtu::TrieStore store(every_op);
+            store.Put<int>("after", 2);
+            version = store.Put<int>("after", 3);
+        }
+        sjtu::TrieStore store(every_op);
+        if (store.get_version() != version || version != 3 || **store.Get<int>("after") != 3 ||
+            store.Get<int>("torn") || !store.Get<int>("kept")) {
+            std::cout << "Test failed: writes after a torn segment were lost" << std::endl;
+            return 1;
+        }
+    }
+    {
+        sjtu::TrieStore store(options);
+        for (int i = 4; i <= 6; i++) {
+            store.Put<int>("middle", i);
+        }
+    }
+    {
+        const fs::path log = Files(directory, ".log").back();
+        std::fstream file(log, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(static_cast<std::streamoff>(fs::file_size(log) / 2));
+        file.put('\x7f');
+    }
+    {
+        sjtu::TrieStore store(options);
+        if (store.get_version() != 4 || **store.Get<int>("middle") != 4) {
+            std::cout << "Test failed: recovery read past a corrupt record" << std::endl;
+            return 1;
+        }
+        store.Put<int>("middle", 7);
+    }
+    {
+        sjtu::TrieStore store(options);
+        if (store.get_version() != 5 || **store.Get<int>("middle") != 7) {
+            std::cout << "Test failed: a write after a corrupt record was lost" << std::endl;
+            return 1;
+        }
+    }
+
+    // Every sync mode, and automatic checkpoints in a short chain.
+    for (sjtu::LogSync sync: {sjtu::LogSync::kEveryOp, sjtu::LogSync::kGroupCommit, sjtu::LogSync::kInterval}) {
+        fs::remove_all(directory);
+        sjtu::DurabilityOptions synced = options;
+        synced.sync = sync;
+        synced.checkpoint_every = 25;
+        synced.max_checkpoint_chain = 2;
+        {
+            sjtu::TrieStore store(synced);
+            for (int i = 0; i < 200; i++) {
+                sjtu::TrieStore::WriteBatch batch;
+                batch.Put<int>("a" + std::to_string(i), i).Put<int>("b" + std::to_string(i), i);
+                store.Commit(std::move(batch));
+                store.Remove("a" + std::to_string(i - 1));
+            }
+            store.Sync();
+        }
+        if (Files(directory, ".ckpt").size() > 3) {
+            std::cout << "Test failed: old checkpoint chains were kept" << std::endl;
+            return 1;
+        }
+        sjtu::TrieStore store(synced);
+        for (int i = 0; i < 200; i++) {
+            auto a = store.Get<int>("a" + std::to_string(i));
+            if ((i == 199) != a.has_value() || **store.Get<int>("b" + std::to_string(i)) != i) {
+                std::cout << "Test failed: wrong value for key " << i << " after recovery" << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    // A value that cannot be logged is refused before it is published.
+    {
+        sjtu::TrieStore store(options);
+        version = store.get_version();
+        try {
+            store.Put<std::vector<int> >("vector", {1, 2});
+            std::cout << "Test failed: a value without a codec was written to a durable store" << std::endl;
+            return 1;
+        } catch (const std::runtime_error &) {
+        }
+        if (store.get_version() != version || store.Get<std::vector<int> >("vector")) {
+            std::cout << "Test failed: a refused write was published" << std::endl;
+            return 1;
+        }
+    }
+#ifdef SJTU_TRIE_POSIX
+    // A version whose records could not all be written is cut from the log, so
+    // the write that reuses its version number comes back without them. The
+    // file size limit makes the log fail a few bytes into the version.
+    {
+        fs::remove_all(directory);
+        sjtu::DurabilityOptions every_op = options;
+        every_op.sync = sjtu::LogSync::kEveryOp;
+        {
+            sjtu::TrieStore store(every_op);
+            store.Put<int>("before", 1);
+            std::signal(SIGXFSZ, SIG_IGN);
+            rlimit saved{};
+            getrlimit(RLIMIT_FSIZE, &saved);
+            rlimit limit = saved;
+            limit.rlim_cur = fs::file_size(Files(directory, ".log").back()) + 40;
+            setrlimit(RLIMIT_FSIZE, &limit);
+            sjtu::TrieStore::WriteBatch batch;
+            batch.Put<int>("lost1", 1).Put<int>("lost2", 2).Put<int>("lost3", 3);
+            bool failed = false;
+            try {
+                store.Commit(std::move(batch));
+            } catch (const std::runtime_error &) {
+                failed = true;
+            }
+            setrlimit(RLIMIT_FSIZE, &saved);
+            if (!failed || store.Get<int>("lost1")) {
+                std::cout << "Test failed: a write the log could not take was published" << std::endl;
+                return 1;
+            }
+            sjtu::TrieStore::WriteBatch retry;
+            retry.Put<int>("retry", 2);
+            store.Commit(std::move(retry));
+            store.Put<int>("after", 3);
+        }
+        sjtu::TrieStore store(every_op);
+        if (!store.Get<int>("before") || !store.Get<int>("retry") || !store.Get<int>("after") ||
+            store.Get<int>("lost1") || store.get_version() != 3) {
+            std::cout << "Test failed: a failed write came back after recovery" << std::endl;
+            return 1;
+        }
+    }
+
+    // A write interrupted by a signal carries on where it stopped. The file is
+    // a FIFO read slowly, so the writer blocks and the signals land in write.
+    {
+        const std::string fifo = (fs::temp_directory_path() / "sjtu_trie_store_durability_fifo").string();
+        fs::remove(fifo);
+        mkfifo(fifo.c_str(), 0600);
+        struct sigaction action{};
+        struct sigaction saved{};
+        action.sa_handler = [](int) {};
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGUSR1, &action, &saved);
+        const std::string payload(1 << 20, 'p');
+        std::atomic<bool> opened{false};
+        std::atomic<bool> written{false};
+        std::thread writer([&] {
+            try {
+                sjtu::TrieFile file(fifo);
+                opened = true;
+                file.Write(payload);
+                written = true;
+            } catch (const std::runtime_error &) {
+                opened = true;
+            }
+        });
+        const int fd = open(fifo.c_str(), O_RDONLY);
+        while (!opened) {
+            std::this_thread::yield();
+        }
+        std::string received;
+        char buffer[16384];
+        while (received.size() < payload.size()) {
+            // The first signal may cut a write short; the second one finds the
+            // writer blocked on the full FIFO with nothing written yet.
+            for (int i = 0; i < 2 && !written; i++) {
+                pthread_kill(writer.native_handle(), SIGUSR1);
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            const ssize_t n = read(fd, buffer, sizeof(buffer));
+            if (n <= 0) break;
+            received.append(buffer, static_cast<size_t>(n));
+        }
+        close(fd);
+        writer.join();
+        sigaction(SIGUSR1, &saved, nullptr);
+        fs::remove(fifo);
+        if (!written || received != payload) {
+            std::cout << "Test failed: an interrupted write lost data" << std::endl;
+            return 1;
+        }
+    }
+#endif
+
+    try {
+        sjtu::TrieStore plain;
+        plain.Checkpoint();
+        std::cout << "Test failed: a store without a directory took a checkpoint" << std::endl;
+        return 1;
+    } catch (const std::logic_error &) {
+    }
+
+    fs::remove_all(directory);
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
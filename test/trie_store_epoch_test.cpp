@@ -0,0 +1,67 @@
+#include "../trie/src.hpp"
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Reads of the newest version walk the trie inside an epoch guard and pin only
+// the node of the key. With a store that keeps a single version, every write
+// retires the trie readers may still be walking.
+int main() {
+    sjtu::TrieStore store(sjtu::RetentionPolicy{1});
+    for (int i = 0; i < 64; i++) {
+        store.Put<int>("key" + std::to_string(i), 0);
+    }
+
+    // A guard keeps its value after the key is overwritten and every version
+    // that held it has been reclaimed.
+    store.Put<std::string>("", std::string(100, 'x'));
+    auto old = store.Get<std::string>("");
+    for (int i = 0; i < 100; i++) {
+        store.Put<std::string>("", std::to_string(i));
+    }
+    if (!old || *(*old) != std::string(100, 'x')) {
+        std::cout << "Test failed: a guard lost its value" << std::endl;
+        return 1;
+    }
+    old.reset();
+
+    std::atomic<bool> stop{false};
+    std::atomic<bool> failed{false};
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 4; r++) {
+        readers.emplace_back([&, r] {
+            while (!stop.load()) {
+                for (int i = r; i < 64; i += 4) {
+                    auto value = store.Get<int>("key" + std::to_string(i));
+                    if (!value || *(*value) < 0) {
+                        failed = true;
+                    }
+                }
+            }
+        });
+    }
+    for (int round = 1; round <= 2000; round++) {
+        store.Put<int>("key" + std::to_string(round % 64), round);
+    }
+    stop = true;
+    for (auto &reader: readers) {
+        reader.join();
+    }
+    if (failed) {
+        std::cout << "Test failed: a reader saw a missing key" << std::endl;
+        return 1;
+    }
+    for (int i = 0; i < 64; i++) {
+        auto value = store.Get<int>("key" + std::to_string(i));
+        int want = 1984 + i <= 2000 ? 1984 + i : 1920 + i;
+        if (!value || *(*value) != want) {
+            std::cout << "Test failed: key" << i << " does not hold its last write" << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
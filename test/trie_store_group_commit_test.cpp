@@ -0,0 +1,74 @@
+#include "../trie/src.hpp"
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Many writers submit batches through GroupCommit at once, mixed with plain
+// writes. Every batch must land in the version it is told about, and the writes
+// of one thread must apply in the order it made them.
+int main() {
+    sjtu::TrieStore store;
+    constexpr int kThreads = 16;
+    constexpr int kBatches = 200;
+
+    std::atomic<bool> failed{false};
+    std::vector<std::thread> writers;
+    for (int t = 0; t < kThreads; t++) {
+        writers.emplace_back([&, t] {
+            const std::string own = "t" + std::to_string(t);
+            size_t last_version = 0;
+            for (int b = 0; b < kBatches; b++) {
+                sjtu::TrieStore::WriteBatch batch;
+                batch.Put<int>(own + "/" + std::to_string(b), b);
+                batch.Put<int>(own, b);
+                if (b > 0) {
+                    batch.Remove(own + "/" + std::to_string(b - 1));
+                }
+                size_t version = t % 4 == 0 ? store.Commit(std::move(batch)) : store.GroupCommit(std::move(batch));
+                if (version <= last_version && b > 0) {
+                    failed = true;
+                }
+                last_version = version;
+                auto value = store.Get<int>(own, version);
+                auto removed = store.Get<int>(own + "/" + std::to_string(b - 1), version);
+                if (!value || **value != b || removed) {
+                    failed = true;
+                }
+            }
+        });
+    }
+    for (auto &writer: writers) {
+        writer.join();
+    }
+    if (failed) {
+        std::cout << "Test failed: a batch is missing from the version it was committed to" << std::endl;
+        return 1;
+    }
+    for (int t = 0; t < kThreads; t++) {
+        const std::string own = "t" + std::to_string(t);
+        auto value = store.Get<int>(own);
+        auto last = store.Get<int>(own + "/" + std::to_string(kBatches - 1));
+        if (!value || **value != kBatches - 1 || !last || store.Get<int>(own + "/0")) {
+            std::cout << "Test failed: writes of thread " << t << " applied out of order" << std::endl;
+            return 1;
+        }
+    }
+    if (store.get_version() > static_cast<size_t>(kThreads * kBatches)) {
+        std::cout << "Test failed: more versions than batches" << std::endl;
+        return 1;
+    }
+
+    // A batch that changes nothing does not create a version.
+    const size_t version = store.get_version();
+    sjtu::TrieStore::WriteBatch noop;
+    noop.Remove("missing");
+    if (store.GroupCommit(std::move(noop)) != version || store.get_version() != version) {
+        std::cout << "Test failed: an empty group created a version" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "../trie/src.hpp"
+
+using sjtu::LookupStatus;
+
+// Keeps the newest versions, honours pins and time windows, and reports
+// reclaimed versions as expired while version numbers keep growing.
+int main() {
+    {
+        sjtu::TrieStore store(sjtu::RetentionPolicy{3});
+        size_t last = 0;
+        for (int i = 1; i <= 10; i++) {
+            size_t version = store.Put<int>("k", i);
+            if (version != static_cast<size_t>(i) || version <= last) {
+                std::cout << "Test failed: version numbers are not monotonic" << std::endl;
+                return 1;
+            }
+            last = version;
+            if (i == 5 && !store.Pin(5)) {
+                std::cout << "Test failed: could not pin a live version" << std::endl;
+                return 1;
+            }
+        }
+        for (size_t v = 0; v <= 10; v++) {
+            auto result = store.Lookup<int>("k", v);
+            bool live = v >= 8 || v == 5;
+            if (live != (result.status == LookupStatus::kFound) ||
+                (!live && result.status != LookupStatus::kVersionExpired)) {
+                std::cout << "Test failed: version " << v << " has the wrong status" << std::endl;
+                return 1;
+            }
+            if (live && **result.value != static_cast<int>(v)) {
+                std::cout << "Test failed: version " << v << " has the wrong value" << std::endl;
+                return 1;
+            }
+        }
+        if (store.Pin(2)) {
+            std::cout << "Test failed: pinned an expired version" << std::endl;
+            return 1;
+        }
+        if (store.Lookup<int>("k", 11).status != LookupStatus::kVersionNotFound ||
+            store.Lookup<int>("x", 10).status != LookupStatus::kKeyNotFound) {
+            std::cout << "Test failed: missing version and missing key are not told apart" << std::endl;
+            return 1;
+        }
+
+        // A guard keeps its value alive after the version is reclaimed.
+        auto guard = store.Get<int>("k", 8);
+        store.Unpin(5);
+        if (store.Lookup<int>("k", 5).status != LookupStatus::kVersionExpired) {
+            std::cout << "Test failed: unpinned version was not reclaimed" << std::endl;
+            return 1;
+        }
+        store.Remove("k");
+        store.Remove("k");
+        store.Put<int>("j", 0);
+        if (store.get_version() != 12 || store.Get<int>("k", 8) != std::nullopt || **guard != 8) {
+            std::cout << "Test failed: wrong state after trimming" << std::endl;
+            return 1;
+        }
+    }
+
+    {
+        sjtu::TrieStore store(sjtu::RetentionPolicy{0, std::chrono::milliseconds(50)});
+        store.Put<int>("a", 1);
+        store.Put<int>("a", 2);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (store.Lookup<int>("a", 1).status != LookupStatus::kFound) {
+            std::cout << "Test failed: version expired without a sweep" << std::endl;
+            return 1;
+        }
+        store.CollectGarbage();
+        if (store.Lookup<int>("a", 1).status != LookupStatus::kVersionExpired ||
+            **store.Get<int>("a") != 2) {
+            std::cout << "Test failed: time window was not applied" << std::endl;
+            return 1;
+        }
+    }
+
+    {
+        // Without a policy every version is kept.
+        sjtu::TrieStore store;
+        for (int i = 1; i <= 100; i++) {
+            store.Put<int>("a", i);
+        }
+        store.CollectGarbage();
+        if (**store.Get<int>("a", 1) != 1) {
+            std::cout << "Test failed: default store dropped a version" << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
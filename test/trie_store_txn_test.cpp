@@ -0,0 +1,98 @@
+#include "../trie/src.hpp"
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+
+// Reads many keys through read transactions while a writer keeps rewriting
+// them, and checks that each transaction sees exactly one version, including
+// versions the retention policy drops or freezes while the transaction runs.
+int main() {
+    sjtu::RetentionPolicy policy;
+    policy.max_versions = 4;
+    policy.freeze_after = 2;
+    sjtu::TrieStore store(policy);
+    constexpr int kKeys = 200;
+    sjtu::TrieStore::WriteBatch batch;
+    for (int i = 0; i < kKeys; i++) {
+        batch.Put<int>(std::to_string(i), 0);
+    }
+    store.Commit(std::move(batch));
+
+    // Every version sets all keys to the same round number.
+    std::atomic<int> round{0};
+    auto rewrite = [&store, &round] {
+        sjtu::TrieStore::WriteBatch next;
+        const int current = ++round;
+        for (int i = 0; i < kKeys; i++) {
+            next.Put<int>(std::to_string(i), current);
+        }
+        store.Commit(std::move(next));
+    };
+    std::atomic<bool> stop{false};
+    std::thread writer([&store, &rewrite, &stop] {
+        while (!stop) {
+            rewrite();
+            store.CollectGarbage();
+        }
+    });
+    for (int n = 0; n < 200; n++) {
+        auto txn = store.BeginRead();
+        if (!txn || txn->Version() == 0) {
+            std::cout << "Test failed: no transaction on the newest version" << std::endl;
+            return 1;
+        }
+        const int *first = txn->Get<int>("0");
+        for (int i = 0; i < kKeys; i++) {
+            const int *value = txn->Get<int>(std::to_string(i));
+            if (value == nullptr || *value != *first) {
+                std::cout << "Test failed: a transaction saw two versions" << std::endl;
+                return 1;
+            }
+        }
+        size_t count = 0;
+        for (const auto &entry: txn->Scan()) {
+            count += entry.Value<int>() != nullptr && *entry.Value<int>() == *first;
+        }
+        if (count != kKeys || txn->Get<std::string>("0") || txn->Get<int>("missing")) {
+            std::cout << "Test failed: a scan in a transaction saw another version" << std::endl;
+            return 1;
+        }
+    }
+    stop = true;
+    writer.join();
+    // Versions a transaction held while they aged are not frozen, as nothing of
+    // them was unique then; add some that no transaction saw.
+    for (int i = 0; i < 3; i++) {
+        rewrite();
+    }
+    store.CollectGarbage();
+
+    // A transaction on a frozen version reads it in place, and a transaction
+    // keeps a version the policy has since reclaimed.
+    auto frozen = store.BeginRead(store.get_version() - 2);
+    if (!frozen || store.Stats().frozen_versions == 0 || frozen->Get<int>("0") == nullptr ||
+        *frozen->Get<int>("42") != *frozen->Get<int>("0") || *frozen->Get<int>("0") == **store.Get<int>("0") ||
+        *frozen->Range("1", "2").begin()->Value<int>() != *frozen->Get<int>("0")) {
+        std::cout << "Test failed: wrong reads in a transaction on a frozen version" << std::endl;
+        return 1;
+    }
+    auto old = store.BeginRead(store.get_version() - 3);
+    const int old_round = *old->Get<int>("7");
+    for (int i = 0; i < 8; i++) {
+        store.Put<int>("7", -1);
+        store.Remove("7");
+    }
+    if (store.BeginRead(old->Version()) || *old->Get<int>("7") != old_round || *old->Get<int>("199") != old_round ||
+        old->ScanPrefix("19").begin()->Key() != "19") {
+        std::cout << "Test failed: a transaction lost its version" << std::endl;
+        return 1;
+    }
+    if (store.BeginRead(store.get_version() + 1) || store.BeginRead(0)) {
+        std::cout << "Test failed: a transaction on an unavailable version" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include "../trie/src.hpp"
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Log = sjtu::VersionLog<size_t>;
+
+// Appends and trims a VersionLog across several segments, then reads old
+// versions of a store on several threads while a writer keeps adding versions
+// and the retention policy trims them, and the newest version while segments
+// are freed.
+int main() {
+    Log log(5);
+    for (size_t i = 5; i < 5 + 3 * Log::kSegmentSize; i++) {
+        log.PushBack(i * 2);
+    }
+    if (log.Begin() != 5 || log.End() != 5 + 3 * Log::kSegmentSize || log.Find(4) || *log.Find(5) != 10 ||
+        log[2000] != 4000 || log.Back() != log.End() * 2 - 2 || log.Find(log.End())) {
+        std::cout << "Test failed: wrong slots in a version log" << std::endl;
+        return 1;
+    }
+    log.TrimFront(5 + Log::kSegmentSize + 1);
+    if (log.Begin() != 6 + Log::kSegmentSize || log.Find(5) || log.Find(4 + Log::kSegmentSize) ||
+        *log.Find(5 + Log::kSegmentSize) != (5 + Log::kSegmentSize) * 2) {
+        std::cout << "Test failed: a trimmed segment is still in the version log" << std::endl;
+        return 1;
+    }
+    log.PushBack(0);
+    log.TrimFront(log.End());
+    log.PushBack(1);
+    if (log.Begin() != log.End() - 1 || *log.Find(log.End() - 1) != 1) {
+        std::cout << "Test failed: appending after trimming to the end" << std::endl;
+        return 1;
+    }
+
+    // Each version v sets "v" to v, and "last" to v.
+    sjtu::TrieStore store(sjtu::RetentionPolicy{16});
+    constexpr size_t kVersions = 5000;
+    std::atomic<bool> done{false};
+    std::vector<std::thread> readers;
+    std::atomic<size_t> failures{0};
+    std::atomic<size_t> found{0};
+    for (int t = 0; t < 3; t++) {
+        readers.emplace_back([&] {
+            while (!done) {
+                const size_t newest = store.get_version();
+                const size_t version = newest > 8 ? newest - 8 : 0;
+                auto result = store.Lookup<size_t>("last", version);
+                if (result.status == sjtu::LookupStatus::kFound) {
+                    found++;
+                    failures += **result.value != version;
+                } else {
+                    failures += version != 0 && result.status == sjtu::LookupStatus::kVersionNotFound;
+                }
+            }
+        });
+    }
+    for (size_t v = 1; v <= kVersions; v++) {
+        sjtu::TrieStore::WriteBatch batch;
+        batch.Put<size_t>(std::to_string(v), v).Put<size_t>("last", v);
+        store.Commit(std::move(batch));
+    }
+    done = true;
+    for (auto &reader: readers) {
+        reader.join();
+    }
+    if (failures != 0 || found == 0) {
+        std::cout << "Test failed: " << failures << " wrong reads of old versions" << std::endl;
+        return 1;
+    }
+
+    // Newest-version reads while the writer frees whole segments behind them.
+    {
+        sjtu::TrieStore short_store(sjtu::RetentionPolicy{2});
+        std::atomic<bool> stop{false};
+        std::atomic<size_t> wrong{0};
+        std::vector<std::thread> newest_readers;
+        for (int t = 0; t < 3; t++) {
+            newest_readers.emplace_back([&] {
+                while (!stop) {
+                    auto txn = short_store.BeginRead();
+                    const size_t *last = txn ? txn->Get<size_t>("last") : nullptr;
+                    wrong += txn && txn->Version() != 0 && (last == nullptr || *last != txn->Version());
+                }
+            });
+        }
+        for (size_t v = 1; v <= 16 * Log::kSegmentSize; v++) {
+            short_store.Put<size_t>("last", v);
+        }
+        stop = true;
+        for (auto &reader: newest_readers) {
+            reader.join();
+        }
+        if (wrong != 0) {
+            std::cout << "Test failed: " << wrong << " wrong reads of the newest version" << std::endl;
+            return 1;
+        }
+    }
+
+    const sjtu::TrieStoreStats stats = store.Stats();
+    if (stats.live_versions != 16 || store.Get<size_t>("last", kVersions - 16) ||
+        **store.Get<size_t>("last", kVersions - 15) != kVersions - 15 || store.Memory(0, kVersions - 16)) {
+        std::cout << "Test failed: wrong versions kept after trimming" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
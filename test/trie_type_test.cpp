@@ -0,0 +1,42 @@
+#include "../trie/src.hpp"
+#include <iostream>
+#include <memory>
+#include <string>
+
+// A value can only be read back with the exact type it was stored with, also
+// after its node has been cloned by later splits and merges.
+int main() {
+    sjtu::Trie trie;
+    trie = trie.Put<uint32_t>("ab", 1);
+    trie = trie.Put<std::string>("abc", "two");
+    trie = trie.Put<std::unique_ptr<int> >("abd", std::make_unique<int>(3));
+    trie = trie.Put<int>("a", 4);
+
+    if (trie.Get<int>("ab") != nullptr || trie.Get<uint64_t>("ab") != nullptr ||
+        trie.Get<std::string>("ab") != nullptr) {
+        std::cout << "Test failed: 'ab' can be read with the wrong type" << std::endl;
+        return 1;
+    }
+    if (trie.Get<uint32_t>("a") != nullptr || trie.Get<const int>("a") != nullptr) {
+        std::cout << "Test failed: 'a' can be read with the wrong type" << std::endl;
+        return 1;
+    }
+    if (*trie.Get<uint32_t>("ab") != 1 || *trie.Get<std::string>("abc") != "two" ||
+        **trie.Get<std::unique_ptr<int> >("abd") != 3 || *trie.Get<int>("a") != 4) {
+        std::cout << "Test failed: values do not round-trip with their own type" << std::endl;
+        return 1;
+    }
+
+    // Removing "a" and "abc" merges and clones the nodes holding the other values.
+    trie = trie.Remove("a");
+    trie = trie.Remove("abc");
+    trie = trie.Put<std::string>("abdx", "five");
+    if (*trie.Get<uint32_t>("ab") != 1 || **trie.Get<std::unique_ptr<int> >("abd") != 3 ||
+        trie.Get<std::string>("abd") != nullptr || *trie.Get<std::string>("abdx") != "five") {
+        std::cout << "Test failed: cloned nodes lost their value type" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed!" << std::endl;
+    return 0;
+}
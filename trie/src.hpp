@@ -2,376 +2,6037 @@
 #define SJTU_TRIE_HPP
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <concepts>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
 #include <future>
 #include <iostream>
-#include <map>
 #include <memory>
+#include <memory_resource>
 #include <mutex>
+#include <new>
 #include <optional>
 #include <shared_mutex>
-#include <stack>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
+#include <variant>
 #include <vector>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SJTU_TRIE_POSIX 1
+#endif
+
 namespace sjtu {
-    //——————————————————————————————————TrieNode—————————————————————————————————————————————————————————————————————//
-    // A TrieNode is a node in a Trie.
-    class TrieNode {
+    class TrieNode;
+
+    //——————————————————————————————————NodePool——————————————————————————————————————————————————————————————————————//
+
+    // Allocate a T (a node or a shared value) and its control block from resource.
+    template<class T, class... Args>
+    auto AllocateShared(std::pmr::memory_resource *resource, Args &&... args) -> std::shared_ptr<T> {
+        return std::allocate_shared<T>(std::pmr::polymorphic_allocator<T>(resource), std::forward<Args>(args)...);
+    }
+
+    // About what the control block made by AllocateShared adds to its object: the
+    // vtable pointer, the two use counts and the allocator.
+    inline constexpr size_t kSharedControlBytes =
+            sizeof(void *) + 2 * sizeof(int) + sizeof(std::pmr::polymorphic_allocator<char>);
+
+    // Ask the CPU to start loading the cache line at p.
+    inline void Prefetch(const void *p) {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(p);
+#else
+        (void) p;
+#endif
+    }
+
+    // The bytes a string allocated for characters that did not fit inside it.
+    inline auto StringHeapBytes(const std::string &s) -> size_t {
+        return s.capacity() > std::string().capacity() ? s.capacity() + 1 : 0;
+    }
+
+    // NodePool is a memory resource for trie nodes. Small blocks are served from
+    // fixed-size classes, each with a per-thread free list, so the common path
+    // takes no lock. Free lists are refilled from and drained to a shared depot
+    // in batches, and a block may be freed by any thread. Memory goes back to the
+    // upstream resource when the pool is destroyed, which must happen after every
+    // node allocated from it is gone. Plug it into a Trie or TrieStore to take
+    // node allocation off malloc.
+    class NodePool : public std::pmr::memory_resource {
     public:
-        friend class Trie;
+        // Blocks up to kMaxPooledSize bytes are pooled in classes kSizeClassBytes
+        // apart; larger or over-aligned blocks go straight to the upstream resource.
+        static constexpr size_t kMaxPooledSize = 512;
+        static constexpr size_t kSizeClassBytes = 16;
+        static constexpr size_t kClasses = kMaxPooledSize / kSizeClassBytes;
+        // The number of blocks moved between a thread and the depot at a time.
+        static constexpr size_t kBatch = 64;
 
-        // Create a TrieNode with no children.
-        TrieNode() = default;
+        explicit NodePool(std::pmr::memory_resource *upstream = std::pmr::new_delete_resource())
+            : depot_(std::make_shared<Depot>(upstream)) {
+        }
+
+        NodePool(const NodePool &) = delete;
+
+        auto operator=(const NodePool &) -> NodePool & = delete;
+
+        // The process-wide pool. It is never destroyed, so nodes that outlive
+        // static destruction can still be freed into it.
+        static auto Global() -> NodePool & {
+            static auto *pool = new NodePool();
+            return *pool;
+        }
+
+    private:
+        struct FreeBlock {
+            FreeBlock *next;
+        };
+
+        struct FreeList {
+            FreeBlock *head{nullptr};
+            size_t count{0};
+
+            void Push(void *p) {
+                auto *block = static_cast<FreeBlock *>(p);
+                block->next = head;
+                head = block;
+                ++count;
+            }
+
+            auto Pop() -> void * {
+                FreeBlock *block = head;
+                head = block->next;
+                --count;
+                return block;
+            }
+
+            // Move up to n blocks to other.
+            void MoveTo(FreeList &other, size_t n) {
+                while (n-- > 0 && head != nullptr) {
+                    other.Push(Pop());
+                }
+            }
+        };
+
+        // The blocks shared by all threads, and the chunks they were carved from.
+        struct Depot {
+            explicit Depot(std::pmr::memory_resource *upstream): upstream(upstream) {
+            }
+
+            ~Depot() {
+                for (auto [chunk, bytes]: chunks) {
+                    upstream->deallocate(chunk, bytes, kSizeClassBytes);
+                }
+            }
+
+            std::pmr::memory_resource *upstream;
+            std::mutex mutex;
+            FreeList lists[kClasses];
+            std::vector<std::pair<void *, size_t> > chunks;
+        };
+
+        // The free lists of one thread for one pool. They go back to the depot
+        // when the thread exits, unless the pool is gone by then.
+        struct ThreadCache {
+            explicit ThreadCache(const std::shared_ptr<Depot> &depot): owner(depot.get()), depot(depot) {
+            }
+
+            ~ThreadCache() {
+                if (auto shared = depot.lock()) {
+                    std::lock_guard<std::mutex> lock(shared->mutex);
+                    for (size_t i = 0; i < kClasses; ++i) {
+                        lists[i].MoveTo(shared->lists[i], lists[i].count);
+                    }
+                }
+            }
+
+            Depot *owner;
+            std::weak_ptr<Depot> depot;
+            FreeList lists[kClasses];
+        };
+
+        struct ThreadCaches {
+            ~ThreadCaches() { Exited() = true; }
+
+            std::vector<std::unique_ptr<ThreadCache> > caches;
+        };
+
+        // Set once the calling thread's caches are destroyed. Nodes released by
+        // later thread_local destructors go to the depot directly.
+        static auto Exited() -> bool & {
+            thread_local bool exited = false;
+            return exited;
+        }
+
+        auto LocalCache() -> ThreadCache * {
+            if (Exited()) {
+                return nullptr;
+            }
+            thread_local ThreadCaches local;
+            for (auto &cache: local.caches) {
+                // A live depot at the same address is necessarily this pool's.
+                if (cache->owner == depot_.get() && !cache->depot.expired()) {
+                    return cache.get();
+                }
+            }
+            // Drop the caches of pools that no longer exist while we are here.
+            std::erase_if(local.caches, [](const auto &cache) { return cache->depot.expired(); });
+            local.caches.push_back(std::make_unique<ThreadCache>(depot_));
+            return local.caches.back().get();
+        }
+
+        static auto ClassOf(size_t bytes) -> size_t {
+            return bytes == 0 ? 0 : (bytes - 1) / kSizeClassBytes;
+        }
+
+        // Take a batch of blocks of class idx from the depot, carving a new chunk
+        // from upstream if the depot has none.
+        void Refill(FreeList &list, size_t idx) {
+            std::lock_guard<std::mutex> lock(depot_->mutex);
+            FreeList &shared = depot_->lists[idx];
+            if (shared.count == 0) {
+                const size_t block = (idx + 1) * kSizeClassBytes;
+                auto *chunk = static_cast<std::byte *>(depot_->upstream->allocate(block * kBatch, kSizeClassBytes));
+                depot_->chunks.emplace_back(chunk, block * kBatch);
+                for (size_t i = 0; i < kBatch; ++i) {
+                    shared.Push(chunk + i * block);
+                }
+            }
+            shared.MoveTo(list, kBatch);
+        }
+
+        auto do_allocate(size_t bytes, size_t alignment) -> void * override {
+            if (bytes > kMaxPooledSize || alignment > kSizeClassBytes) {
+                return depot_->upstream->allocate(bytes, alignment);
+            }
+            const size_t idx = ClassOf(bytes);
+            ThreadCache *cache = LocalCache();
+            if (cache == nullptr) {
+                FreeList list;
+                Refill(list, idx);
+                void *p = list.Pop();
+                std::lock_guard<std::mutex> lock(depot_->mutex);
+                list.MoveTo(depot_->lists[idx], list.count);
+                return p;
+            }
+            FreeList &list = cache->lists[idx];
+            if (list.count == 0) {
+                Refill(list, idx);
+            }
+            return list.Pop();
+        }
+
+        void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+            if (bytes > kMaxPooledSize || alignment > kSizeClassBytes) {
+                depot_->upstream->deallocate(p, bytes, alignment);
+                return;
+            }
+            const size_t idx = ClassOf(bytes);
+            ThreadCache *cache = LocalCache();
+            if (cache == nullptr) {
+                std::lock_guard<std::mutex> lock(depot_->mutex);
+                depot_->lists[idx].Push(p);
+                return;
+            }
+            FreeList &list = cache->lists[idx];
+            list.Push(p);
+            if (list.count > 2 * kBatch) {
+                std::lock_guard<std::mutex> lock(depot_->mutex);
+                list.MoveTo(depot_->lists[idx], kBatch);
+            }
+        }
+
+        auto do_is_equal(const std::pmr::memory_resource &other) const noexcept -> bool override {
+            return this == &other;
+        }
+
+        std::shared_ptr<Depot> depot_;
+    };
+
+    //——————————————————————————————————TrieChildren——————————————————————————————————————————————————————————————————//
+
+    // TrieChildren is the child table of a TrieNode. It uses ART-style adaptive
+    // layouts: up to 4 children live in a sorted array inside the node itself, up
+    // to 16 in a sorted array, up to 48 in an indexed node (a 256-byte index into
+    // 48 slots) and anything larger in a direct 256-slot array. The layout is
+    // promoted on insert and demoted on erase as the fan-out changes. The larger
+    // layouts are allocated from the memory resource of the node's trie.
+    // Children are ordered by the unsigned value of their byte.
+    class TrieChildren {
+    public:
+        using Child = std::shared_ptr<const TrieNode>;
+
+        TrieChildren() = default;
+
+        // Copy other, allocating a layout kept outside the node from resource.
+        TrieChildren(const TrieChildren &other, std::pmr::memory_resource *resource)
+            : size_(other.size_), wide_(CopyWide(other.wide_, resource)) {
+            std::copy(std::begin(other.keys4_), std::end(other.keys4_), keys4_);
+            std::copy(std::begin(other.children4_), std::end(other.children4_), children4_);
+        }
+
+        // Copy other, allocating from the resource its own layout came from.
+        TrieChildren(const TrieChildren &other): TrieChildren(other, other.Resource()) {
+        }
+
+        TrieChildren(TrieChildren &&other) noexcept = default;
+
+        auto operator=(const TrieChildren &other) -> TrieChildren & {
+            if (this != &other) {
+                *this = TrieChildren(other);
+            }
+            return *this;
+        }
+
+        auto operator=(TrieChildren &&other) noexcept -> TrieChildren & = default;
+
+        // Return the slot holding the child for byte c, or nullptr if there is none.
+        auto Find(char c) const -> const Child * {
+            const auto b = static_cast<unsigned char>(c);
+            switch (wide_.index()) {
+                case kNode4:
+                    for (uint16_t i = 0; i < size_; ++i) {
+                        if (keys4_[i] == b) {
+                            return &children4_[i];
+                        }
+                    }
+                    return nullptr;
+                case kNode16: {
+                    const auto &node = *std::get<kNode16>(wide_);
+                    const int i = FindKey16(node.keys, size_, b);
+                    return i < 0 ? nullptr : &node.children[i];
+                }
+                case kNode48: {
+                    const auto &node = *std::get<kNode48>(wide_);
+                    return node.index[b] == 0 ? nullptr : &node.children[node.index[b] - 1];
+                }
+                default: {
+                    const auto &slot = std::get<kNode256>(wide_)->children[b];
+                    return slot ? &slot : nullptr;
+                }
+            }
+        }
+
+        // Insert the child for byte c, replacing any existing one. A larger layout
+        // is allocated from resource.
+        void Set(char c, Child child, std::pmr::memory_resource *resource) {
+            const auto b = static_cast<unsigned char>(c);
+            if (auto *slot = const_cast<Child *>(Find(c))) {
+                *slot = std::move(child);
+                return;
+            }
+            switch (wide_.index()) {
+                case kNode4:
+                    if (size_ < 4) {
+                        InsertSorted(keys4_, children4_, b, std::move(child));
+                        return;
+                    }
+                    Grow(resource);
+                    break;
+                case kNode16:
+                    if (size_ < 16) {
+                        auto &node = *std::get<kNode16>(wide_);
+                        InsertSorted(node.keys, node.children, b, std::move(child));
+                        return;
+                    }
+                    Grow(resource);
+                    break;
+                case kNode48:
+                    if (size_ < 48) {
+                        auto &node = *std::get<kNode48>(wide_);
+                        uint8_t free_slot = 0;
+                        while (node.children[free_slot]) {
+                            ++free_slot;
+                        }
+                        node.children[free_slot] = std::move(child);
+                        node.index[b] = free_slot + 1;
+                        ++size_;
+                        return;
+                    }
+                    Grow(resource);
+                    break;
+                default:
+                    std::get<kNode256>(wide_)->children[b] = std::move(child);
+                    ++size_;
+                    return;
+            }
+            // The node has just been promoted; the new layout has room for c.
+            Set(c, std::move(child), resource);
+        }
+
+        // Remove the child for byte c. Returns false if there was none.
+        auto Erase(char c) -> bool {
+            const auto b = static_cast<unsigned char>(c);
+            switch (wide_.index()) {
+                case kNode4:
+                    if (!EraseSorted(keys4_, children4_, b)) {
+                        return false;
+                    }
+                    break;
+                case kNode16:
+                    if (!EraseSorted(std::get<kNode16>(wide_)->keys, std::get<kNode16>(wide_)->children, b)) {
+                        return false;
+                    }
+                    break;
+                case kNode48: {
+                    auto &node = *std::get<kNode48>(wide_);
+                    if (node.index[b] == 0) {
+                        return false;
+                    }
+                    node.children[node.index[b] - 1].reset();
+                    node.index[b] = 0;
+                    --size_;
+                    break;
+                }
+                default: {
+                    auto &slot = std::get<kNode256>(wide_)->children[b];
+                    if (!slot) {
+                        return false;
+                    }
+                    slot.reset();
+                    --size_;
+                    break;
+                }
+            }
+            Shrink();
+            return true;
+        }
+
+        // Return the first child whose byte is not less than from (0..256, as an
+        // unsigned byte), or a null child slot if there is none.
+        auto LowerBound(int from) const -> std::pair<char, const Child *> {
+            switch (wide_.index()) {
+                case kNode4:
+                    for (uint16_t i = 0; i < size_; ++i) {
+                        if (keys4_[i] >= from) {
+                            return {static_cast<char>(keys4_[i]), &children4_[i]};
+                        }
+                    }
+                    break;
+                case kNode16: {
+                    const auto &node = *std::get<kNode16>(wide_);
+                    for (uint16_t i = 0; i < size_; ++i) {
+                        if (node.keys[i] >= from) {
+                            return {static_cast<char>(node.keys[i]), &node.children[i]};
+                        }
+                    }
+                    break;
+                }
+                case kNode48: {
+                    const auto &node = *std::get<kNode48>(wide_);
+                    for (int b = from; b < 256; ++b) {
+                        if (node.index[b] != 0) {
+                            return {static_cast<char>(b), &node.children[node.index[b] - 1]};
+                        }
+                    }
+                    break;
+                }
+                default: {
+                    const auto &node = *std::get<kNode256>(wide_);
+                    for (int b = from; b < 256; ++b) {
+                        if (node.children[b]) {
+                            return {static_cast<char>(b), &node.children[b]};
+                        }
+                    }
+                    break;
+                }
+            }
+            return {0, nullptr};
+        }
+
+        auto Empty() const -> bool { return size_ == 0; }
+
+        auto Size() const -> size_t { return size_; }
+
+        // Start loading the layout kept outside the node, if there is one.
+        void Prefetch() const {
+            switch (wide_.index()) {
+                case kNode4:
+                    break;
+                case kNode16:
+                    sjtu::Prefetch(std::get<kNode16>(wide_).get());
+                    break;
+                case kNode48:
+                    sjtu::Prefetch(std::get<kNode48>(wide_).get());
+                    break;
+                default:
+                    sjtu::Prefetch(std::get<kNode256>(wide_).get());
+                    break;
+            }
+        }
+
+        // The bytes of the layout kept outside the node, see TrieMemory.
+        auto HeapBytes() const -> size_t {
+            switch (wide_.index()) {
+                case kNode4:
+                    return 0;
+                case kNode16:
+                    return sizeof(Node16);
+                case kNode48:
+                    return sizeof(Node48);
+                default:
+                    return sizeof(Node256);
+            }
+        }
+
+        // Call f(c, child) for every child in ascending byte order.
+        template<class F>
+        void ForEach(F &&f) const {
+            switch (wide_.index()) {
+                case kNode4:
+                    for (uint16_t i = 0; i < size_; ++i) {
+                        f(static_cast<char>(keys4_[i]), children4_[i]);
+                    }
+                    break;
+                case kNode16: {
+                    const auto &node = *std::get<kNode16>(wide_);
+                    for (uint16_t i = 0; i < size_; ++i) {
+                        f(static_cast<char>(node.keys[i]), node.children[i]);
+                    }
+                    break;
+                }
+                case kNode48: {
+                    const auto &node = *std::get<kNode48>(wide_);
+                    for (int b = 0; b < 256; ++b) {
+                        if (node.index[b] != 0) {
+                            f(static_cast<char>(b), node.children[node.index[b] - 1]);
+                        }
+                    }
+                    break;
+                }
+                default: {
+                    const auto &node = *std::get<kNode256>(wide_);
+                    for (int b = 0; b < 256; ++b) {
+                        if (node.children[b]) {
+                            f(static_cast<char>(b), node.children[b]);
+                        }
+                    }
+                    break;
+                }
+            }
+        }
+
+    private:
+        // The keys fill the start of one cache line, so a search of them touches
+        // a single line.
+        struct alignas(64) Node16 {
+            unsigned char keys[16]{};
+            std::pmr::memory_resource *resource;
+            Child children[16];
+        };
+
+        // The position of b among the first size of 16 keys, or -1. The keys are
+        // compared all at once where SSE2 or NEON is available.
+        static auto FindKey16(const unsigned char *keys, uint16_t size, unsigned char b) -> int {
+#if defined(__SSE2__)
+            const __m128i matches = _mm_cmpeq_epi8(_mm_set1_epi8(static_cast<char>(b)),
+                                                   _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys)));
+            const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(matches)) & ((1u << size) - 1);
+            return mask == 0 ? -1 : __builtin_ctz(mask);
+#elif defined(__ARM_NEON)
+            // Narrowing the 16 byte results by 4 bits leaves 4 bits per key.
+            const uint8x16_t matches = vceqq_u8(vdupq_n_u8(b), vld1q_u8(keys));
+            uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0);
+            mask &= size == 16 ? ~uint64_t{0} : (uint64_t{1} << (4 * size)) - 1;
+            return mask == 0 ? -1 : __builtin_ctzll(mask) / 4;
+#else
+            for (uint16_t i = 0; i < size; ++i) {
+                if (keys[i] == b) {
+                    return i;
+                }
+            }
+            return -1;
+#endif
+        }
+
+        struct Node48 {
+            // index[b] is one plus the slot of byte b in children, or 0 if b is absent.
+            unsigned char index[256]{};
+            std::pmr::memory_resource *resource;
+            Child children[48];
+        };
+
+        struct Node256 {
+            std::pmr::memory_resource *resource;
+            Child children[256];
+        };
+
+        // Every layout records the resource it was allocated from, so that it can
+        // go back there without making the node larger.
+        struct WideDeleter {
+            template<class Node>
+            void operator()(Node *node) const {
+                std::pmr::polymorphic_allocator<Node>(node->resource).delete_object(node);
+            }
+        };
+
+        template<class Node>
+        using WidePtr = std::unique_ptr<Node, WideDeleter>;
+
+        // Allocate a layout from resource, constructed from args.
+        template<class Node, class... Args>
+        static auto MakeWide(std::pmr::memory_resource *resource, Args &&... args) -> WidePtr<Node> {
+            Node *node = std::pmr::polymorphic_allocator<Node>(resource).template new_object<Node>(std::forward<Args>(args)...);
+            node->resource = resource;
+            return WidePtr<Node>(node);
+        }
+
+        // wide_.index() doubles as the layout tag.
+        enum : size_t { kNode4, kNode16, kNode48, kNode256 };
+
+        using Wide = std::variant<std::monostate, WidePtr<Node16>, WidePtr<Node48>, WidePtr<Node256> >;
+
+        static auto CopyWide(const Wide &wide, std::pmr::memory_resource *resource) -> Wide {
+            switch (wide.index()) {
+                case kNode16:
+                    return MakeWide<Node16>(resource, *std::get<kNode16>(wide));
+                case kNode48:
+                    return MakeWide<Node48>(resource, *std::get<kNode48>(wide));
+                case kNode256:
+                    return MakeWide<Node256>(resource, *std::get<kNode256>(wide));
+                default:
+                    return {};
+            }
+        }
+
+        // The resource of the layout kept outside the node, or the default one.
+        auto Resource() const -> std::pmr::memory_resource * {
+            switch (wide_.index()) {
+                case kNode16:
+                    return std::get<kNode16>(wide_)->resource;
+                case kNode48:
+                    return std::get<kNode48>(wide_)->resource;
+                case kNode256:
+                    return std::get<kNode256>(wide_)->resource;
+                default:
+                    return std::pmr::get_default_resource();
+            }
+        }
+
+        // Insert (b, child) into a sorted array that has room for one more entry.
+        void InsertSorted(unsigned char *keys, Child *children, unsigned char b, Child child) {
+            uint16_t pos = 0;
+            while (pos < size_ && keys[pos] < b) {
+                ++pos;
+            }
+            for (uint16_t i = size_; i > pos; --i) {
+                keys[i] = keys[i - 1];
+                children[i] = std::move(children[i - 1]);
+            }
+            keys[pos] = b;
+            children[pos] = std::move(child);
+            ++size_;
+        }
+
+        auto EraseSorted(unsigned char *keys, Child *children, unsigned char b) -> bool {
+            uint16_t pos = 0;
+            while (pos < size_ && keys[pos] != b) {
+                ++pos;
+            }
+            if (pos == size_) {
+                return false;
+            }
+            for (uint16_t i = pos + 1; i < size_; ++i) {
+                keys[i - 1] = keys[i];
+                children[i - 1] = std::move(children[i]);
+            }
+            children[--size_].reset();
+            return true;
+        }
+
+        // Move every child into the next larger layout, allocated from resource.
+        // The current layout is full.
+        void Grow(std::pmr::memory_resource *resource) {
+            switch (wide_.index()) {
+                case kNode4: {
+                    auto node = MakeWide<Node16>(resource);
+                    for (uint16_t i = 0; i < size_; ++i) {
+                        node->keys[i] = keys4_[i];
+                        node->children[i] = std::move(children4_[i]);
+                    }
+                    wide_ = std::move(node);
+                    break;
+                }
+                case kNode16: {
+                    auto node = MakeWide<Node48>(resource);
+                    auto &old = *std::get<kNode16>(wide_);
+                    for (uint16_t i = 0; i < size_; ++i) {
+                        node->index[old.keys[i]] = i + 1;
+                        node->children[i] = std::move(old.children[i]);
+                    }
+                    wide_ = std::move(node);
+                    break;
+                }
+                case kNode48: {
+                    auto node = MakeWide<Node256>(resource);
+                    auto &old = *std::get<kNode48>(wide_);
+                    for (int b = 0; b < 256; ++b) {
+                        if (old.index[b] != 0) {
+                            node->children[b] = std::move(old.children[old.index[b] - 1]);
+                        }
+                    }
+                    wide_ = std::move(node);
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+
+        // Demote to the next smaller layout once the fan-out has dropped well below
+        // its capacity. The slack avoids thrashing between layouts at the boundary.
+        void Shrink() {
+            switch (wide_.index()) {
+                case kNode16: {
+                    if (size_ > 3) {
+                        return;
+                    }
+                    auto &old = *std::get<kNode16>(wide_);
+                    for (uint16_t i = 0; i < size_; ++i) {
+                        keys4_[i] = old.keys[i];
+                        children4_[i] = std::move(old.children[i]);
+                    }
+                    wide_ = std::monostate{};
+                    break;
+                }
+                case kNode48: {
+                    if (size_ > 12) {
+                        return;
+                    }
+                    auto &old = *std::get<kNode48>(wide_);
+                    auto node = MakeWide<Node16>(old.resource);
+                    uint16_t n = 0;
+                    for (int b = 0; b < 256; ++b) {
+                        if (old.index[b] != 0) {
+                            node->keys[n] = static_cast<unsigned char>(b);
+                            node->children[n++] = std::move(old.children[old.index[b] - 1]);
+                        }
+                    }
+                    wide_ = std::move(node);
+                    break;
+                }
+                case kNode256: {
+                    if (size_ > 40) {
+                        return;
+                    }
+                    auto &old = *std::get<kNode256>(wide_);
+                    auto node = MakeWide<Node48>(old.resource);
+                    uint8_t n = 0;
+                    for (int b = 0; b < 256; ++b) {
+                        if (old.children[b]) {
+                            node->index[b] = n + 1;
+                            node->children[n++] = std::move(old.children[b]);
+                        }
+                    }
+                    wide_ = std::move(node);
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+
+        // What Find reads first comes first.
+        uint16_t size_{0};
+        unsigned char keys4_[4]{};
+        Wide wide_;
+        Child children4_[4];
+    };
+
+    //——————————————————————————————————TrieCodec—————————————————————————————————————————————————————————————————————//
+
+    // TrieCodec<T> stores values of type T in a trie image, see TrieImage. A codec
+    // provides
+    //   static constexpr uint32_t kId;                          // recorded with every value
+    //   static void Encode(const T &value, std::string &out);  // append the bytes of value
+    //   static auto Decode(std::string_view bytes) -> T;
+    // and, if the bytes can be used where they are,
+    //   static auto View(std::string_view bytes) -> const T *;
+    // Codecs are built in for arithmetic types and std::string. Specialize
+    // TrieCodec for other value types, with an id of kUserTrieCodecId or above,
+    // before the type is first stored in a trie.
+    template<class T, class = void>
+    struct TrieCodec {
+    };
+
+    inline constexpr uint32_t kUserTrieCodecId = 256;
+
+    template<class T, class = void>
+    inline constexpr bool kHasTrieCodec = false;
+
+    template<class T>
+    inline constexpr bool kHasTrieCodec<T, std::void_t<decltype(TrieCodec<T>::kId)> > = true;
+
+    template<class T, class = void>
+    inline constexpr bool kViewableTrieCodec = false;
+
+    template<class T>
+    inline constexpr bool kViewableTrieCodec<T, std::void_t<decltype(TrieCodec<T>::View(std::string_view()))> > =
+            true;
+
+    // A codec that stores the bytes of a trivially copyable value, which can be
+    // read in place.
+    template<class T, uint32_t Id>
+    struct TrivialTrieCodec {
+        static_assert(std::is_trivially_copyable_v<T> && alignof(T) <= 8);
+
+        static constexpr uint32_t kId = Id;
+
+        static void Encode(const T &value, std::string &out) {
+            out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+        }
+
+        static auto Decode(std::string_view bytes) -> T {
+            if (bytes.size() != sizeof(T)) {
+                throw std::runtime_error("TrieCodec: value has the wrong size");
+            }
+            T value;
+            std::memcpy(&value, bytes.data(), sizeof(T));
+            return value;
+        }
+
+        // bytes must be suitably aligned, which images guarantee.
+        static auto View(std::string_view bytes) -> const T * {
+            return bytes.size() == sizeof(T) ? std::launder(reinterpret_cast<const T *>(bytes.data())) : nullptr;
+        }
+    };
+
+    template<> struct TrieCodec<bool> : TrivialTrieCodec<bool, 1> {};
+    template<> struct TrieCodec<char> : TrivialTrieCodec<char, 2> {};
+    template<> struct TrieCodec<signed char> : TrivialTrieCodec<signed char, 3> {};
+    template<> struct TrieCodec<unsigned char> : TrivialTrieCodec<unsigned char, 4> {};
+    template<> struct TrieCodec<short> : TrivialTrieCodec<short, 5> {};
+    template<> struct TrieCodec<unsigned short> : TrivialTrieCodec<unsigned short, 6> {};
+    template<> struct TrieCodec<int> : TrivialTrieCodec<int, 7> {};
+    template<> struct TrieCodec<unsigned int> : TrivialTrieCodec<unsigned int, 8> {};
+    template<> struct TrieCodec<long> : TrivialTrieCodec<long, 9> {};
+    template<> struct TrieCodec<unsigned long> : TrivialTrieCodec<unsigned long, 10> {};
+    template<> struct TrieCodec<long long> : TrivialTrieCodec<long long, 11> {};
+    template<> struct TrieCodec<unsigned long long> : TrivialTrieCodec<unsigned long long, 12> {};
+    template<> struct TrieCodec<float> : TrivialTrieCodec<float, 13> {};
+    template<> struct TrieCodec<double> : TrivialTrieCodec<double, 14> {};
+
+    // Strings are stored as their characters; read them in place with
+    // MappedTrie::GetBytes.
+    template<>
+    struct TrieCodec<std::string> {
+        static constexpr uint32_t kId = 15;
+
+        static void Encode(const std::string &value, std::string &out) { out += value; }
+
+        static auto Decode(std::string_view bytes) -> std::string { return std::string(bytes); }
+    };
+
+    //——————————————————————————————————TrieKey———————————————————————————————————————————————————————————————————————//
+
+    // TrieKey<K> turns keys of type K into bytes whose order is the order of the
+    // keys, so that typed keys can be used with Put, Get and Remove and iterated
+    // in order. A key type provides
+    //   static void Encode(const K &key, std::string &out);  // append the bytes of key
+    //   static auto Decode(std::string_view &bytes) -> K;   // consume them again
+    // Built in are arithmetic types, as fixed-width big-endian bytes; std::string,
+    // with its zero bytes escaped and a terminator, so that a shorter string comes
+    // first and any key may follow it; and std::pair and std::tuple of key types,
+    // as their elements one after another. Decode throws std::runtime_error if the
+    // bytes were not made by Encode.
+    template<class K, class = void>
+    struct TrieKey {
+    };
+
+    template<class K, class = void>
+    inline constexpr bool kHasTrieKey = false;
+
+    template<class K>
+    inline constexpr bool kHasTrieKey<K, std::void_t<decltype(TrieKey<K>::Encode(std::declval<const K &>(),
+                                                                                 std::declval<std::string &>()))> > =
+            true;
+
+    // Whether K is a typed key rather than something keys are spelled with.
+    template<class K>
+    inline constexpr bool kTypedTrieKey = kHasTrieKey<K> && !std::is_convertible_v<const K &, std::string_view>;
+
+    template<class K>
+    struct TrieKey<K, std::enable_if_t<std::is_arithmetic_v<K> > > {
+        using Bits = std::conditional_t<sizeof(K) == 1, uint8_t, std::conditional_t<sizeof(K) == 2, uint16_t,
+                                        std::conditional_t<sizeof(K) == 4, uint32_t, uint64_t> > >;
+        static_assert(sizeof(Bits) == sizeof(K));
+
+        static void Encode(const K &key, std::string &out) {
+            Bits bits;
+            std::memcpy(&bits, &key, sizeof(K));
+            bits = Order(bits);
+            for (size_t i = sizeof(K); i-- > 0;) {
+                out += static_cast<char>(bits >> (8 * i));
+            }
+        }
+
+        static auto Decode(std::string_view &bytes) -> K {
+            if (bytes.size() < sizeof(K)) {
+                throw std::runtime_error("TrieKey: the key is cut short");
+            }
+            Bits bits = 0;
+            for (size_t i = 0; i < sizeof(K); i++) {
+                bits = static_cast<Bits>(bits << 8 | static_cast<unsigned char>(bytes[i]));
+            }
+            bytes.remove_prefix(sizeof(K));
+            bits = Unorder(bits);
+            K key;
+            std::memcpy(&key, &bits, sizeof(K));
+            return key;
+        }
+
+    private:
+        static constexpr Bits kSign = static_cast<Bits>(Bits{1} << (8 * sizeof(K) - 1));
+
+        // Signed integers flip the sign bit; floats flip it when positive and
+        // flip every bit when negative, so that unsigned order is key order.
+        static auto Order(Bits bits) -> Bits {
+            if constexpr (std::is_floating_point_v<K>) {
+                return static_cast<Bits>((bits & kSign) ? ~bits : bits | kSign);
+            } else if constexpr (std::is_signed_v<K>) {
+                return static_cast<Bits>(bits ^ kSign);
+            } else {
+                return bits;
+            }
+        }
+
+        static auto Unorder(Bits bits) -> Bits {
+            if constexpr (std::is_floating_point_v<K>) {
+                return static_cast<Bits>((bits & kSign) ? bits & ~kSign : ~bits);
+            } else if constexpr (std::is_signed_v<K>) {
+                return static_cast<Bits>(bits ^ kSign);
+            } else {
+                return bits;
+            }
+        }
+    };
+
+    // A zero byte is written as 0x00 0xff and the string ends with 0x00 0x01.
+    template<>
+    struct TrieKey<std::string> {
+        static void Encode(const std::string &key, std::string &out) {
+            for (char c: key) {
+                out += c;
+                if (c == '\0') out += '\xff';
+            }
+            out += '\0';
+            out += '\x01';
+        }
+
+        static auto Decode(std::string_view &bytes) -> std::string {
+            std::string key;
+            for (size_t i = 0; i < bytes.size(); i++) {
+                if (bytes[i] != '\0') {
+                    key += bytes[i];
+                } else if (i + 1 < bytes.size() && bytes[i + 1] == '\x01') {
+                    bytes.remove_prefix(i + 2);
+                    return key;
+                } else if (i + 1 < bytes.size() && bytes[i + 1] == '\xff') {
+                    key += '\0';
+                    i++;
+                } else {
+                    break;
+                }
+            }
+            throw std::runtime_error("TrieKey: the string is not terminated");
+        }
+    };
+
+    template<class... Ks>
+    struct TrieKey<std::tuple<Ks...> > {
+        static void Encode(const std::tuple<Ks...> &key, std::string &out) {
+            std::apply([&out](const Ks &... parts) { (TrieKey<Ks>::Encode(parts, out), ...); }, key);
+        }
+
+        static auto Decode(std::string_view &bytes) -> std::tuple<Ks...> {
+            // Braced initializers are evaluated in order.
+            return std::tuple<Ks...>{TrieKey<Ks>::Decode(bytes)...};
+        }
+    };
+
+    template<class A, class B>
+    struct TrieKey<std::pair<A, B> > {
+        static void Encode(const std::pair<A, B> &key, std::string &out) {
+            TrieKey<A>::Encode(key.first, out);
+            TrieKey<B>::Encode(key.second, out);
+        }
+
+        static auto Decode(std::string_view &bytes) -> std::pair<A, B> {
+            return std::pair<A, B>{TrieKey<A>::Decode(bytes), TrieKey<B>::Decode(bytes)};
+        }
+    };
+
+    // Return the bytes of the key made of parts, one after another, which are
+    // also the bytes of the tuple of them.
+    template<class... Ks>
+    auto EncodeKey(const Ks &... parts) -> std::string {
+        std::string out;
+        (TrieKey<Ks>::Encode(parts, out), ...);
+        return out;
+    }
+
+    // Decode the bytes of a key of type K, such as a key a TrieIterator is at.
+    // Throws std::runtime_error if they are not exactly one encoded K.
+    template<class K>
+    auto DecodeKey(std::string_view bytes) -> K {
+        K key = TrieKey<K>::Decode(bytes);
+        if (!bytes.empty()) {
+            throw std::runtime_error("TrieKey: bytes are left after the key");
+        }
+        return key;
+    }
+
+    //——————————————————————————————————TrieStats———————————————————————————————————————————————————————————————————//
+
+#ifdef SJTU_TRIE_STATS
+    inline constexpr bool kTrieStats = true;
+#else
+    // Define SJTU_TRIE_STATS before including this header to turn on TrieStats.
+    // Without it every recording call compiles to nothing.
+    inline constexpr bool kTrieStats = false;
+#endif
+
+    // TrieStats counts what tries and stores do, in counters and latency
+    // histograms kept per thread and summed by Collect. A thread only ever writes
+    // its own slot, with plain relaxed stores, so recording costs no contended
+    // atomic operation. Slots of exited threads are reused and keep their counts,
+    // so totals only grow.
+    class TrieStats {
+    public:
+        enum Counter : size_t {
+            kGets,
+            kPuts,
+            kRemoves,
+            kCommits,
+            // Nodes made by Put, Remove and transients, including clones.
+            kNodesCreated,
+            kClones,
+            // Time spent waiting for and holding TrieStore::write_lock_.
+            kWriteLockWaitNanos,
+            kWriteLockHoldNanos,
+            kCounterCount,
+        };
+
+        enum Histogram : size_t { kGetLatency, kPutLatency, kRemoveLatency, kCommitLatency, kHistogramCount };
+
+        // Bucket b of a histogram counts latencies below 2^b nanoseconds (and at
+        // least 2^(b-1)); the last bucket takes everything longer.
+        static constexpr size_t kBuckets = 40;
+
+        struct Snapshot {
+            std::array<uint64_t, kCounterCount> counters{};
+            std::array<std::array<uint64_t, kBuckets>, kHistogramCount> histograms{};
+
+            auto Count(Histogram histogram) const -> uint64_t {
+                uint64_t count = 0;
+                for (uint64_t n: histograms[histogram]) {
+                    count += n;
+                }
+                return count;
+            }
+
+            // An upper bound of the p-th quantile (0 <= p <= 1) of a histogram, in
+            // nanoseconds, or 0 if nothing was recorded.
+            auto Percentile(Histogram histogram, double p) const -> uint64_t {
+                const uint64_t count = Count(histogram);
+                if (count == 0) return 0;
+                const auto rank = static_cast<uint64_t>(p * static_cast<double>(count - 1));
+                uint64_t seen = 0;
+                for (size_t b = 0; b < kBuckets; ++b) {
+                    seen += histograms[histogram][b];
+                    if (seen > rank) return uint64_t{1} << b;
+                }
+                return uint64_t{1} << (kBuckets - 1);
+            }
+        };
+
+        static void Add(Counter counter, uint64_t n = 1) {
+            if constexpr (kTrieStats) {
+                auto &cell = LocalSlot()->counters[counter];
+                cell.store(cell.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+            }
+        }
+
+        static void Record(Histogram histogram, uint64_t nanos) {
+            if constexpr (kTrieStats) {
+                size_t bucket = 0;
+                while (bucket + 1 < kBuckets && (nanos >> bucket) != 0) {
+                    ++bucket;
+                }
+                auto &cell = LocalSlot()->histograms[histogram][bucket];
+                cell.store(cell.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            }
+        }
+
+        // Return the sums over all threads.
+        static auto Collect() -> Snapshot {
+            Snapshot snapshot;
+            if constexpr (kTrieStats) {
+                for (Slot *slot = Slots().load(std::memory_order_acquire); slot != nullptr; slot = slot->next) {
+                    for (size_t c = 0; c < kCounterCount; ++c) {
+                        snapshot.counters[c] += slot->counters[c].load(std::memory_order_relaxed);
+                    }
+                    for (size_t h = 0; h < kHistogramCount; ++h) {
+                        for (size_t b = 0; b < kBuckets; ++b) {
+                            snapshot.histograms[h][b] += slot->histograms[h][b].load(std::memory_order_relaxed);
+                        }
+                    }
+                }
+            }
+            return snapshot;
+        }
+
+        // The current time when stats are on, for Elapsed.
+        static auto Now() -> std::chrono::steady_clock::time_point {
+            if constexpr (kTrieStats) {
+                return std::chrono::steady_clock::now();
+            } else {
+                return {};
+            }
+        }
+
+        static auto Elapsed(std::chrono::steady_clock::time_point since) -> uint64_t {
+            if constexpr (kTrieStats) {
+                return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since)
+                        .count();
+            } else {
+                return 0;
+            }
+        }
+
+        // Records its own lifetime in a histogram, or adds it to a counter of
+        // nanoseconds.
+        class Timer {
+        public:
+            explicit Timer(Histogram histogram): index_(histogram), histogram_(true), start_(Now()) {
+            }
+
+            explicit Timer(Counter counter): index_(counter), histogram_(false), start_(Now()) {
+            }
+
+            Timer(const Timer &) = delete;
+
+            auto operator=(const Timer &) -> Timer & = delete;
+
+            ~Timer() {
+                if constexpr (kTrieStats) {
+                    if (histogram_) {
+                        Record(static_cast<Histogram>(index_), Elapsed(start_));
+                    } else {
+                        Add(static_cast<Counter>(index_), Elapsed(start_));
+                    }
+                }
+            }
+
+        private:
+            size_t index_;
+            bool histogram_;
+            std::chrono::steady_clock::time_point start_;
+        };
+
+    private:
+        struct alignas(64) Slot {
+            std::atomic<uint64_t> counters[kCounterCount]{};
+            std::atomic<uint64_t> histograms[kHistogramCount][kBuckets]{};
+            std::atomic<bool> in_use{true};
+            Slot *next{nullptr};
+        };
+
+        static auto Slots() -> std::atomic<Slot *> & {
+            static std::atomic<Slot *> slots{nullptr};
+            return slots;
+        }
+
+        // Return the slot of this thread, reusing one left by an exited thread.
+        static auto LocalSlot() -> Slot * {
+            struct Owner {
+                ~Owner() {
+                    if (slot != nullptr) {
+                        slot->in_use.store(false, std::memory_order_release);
+                    }
+                }
+
+                Slot *slot{nullptr};
+            };
+            thread_local Owner owner;
+            if (owner.slot == nullptr) {
+                for (Slot *slot = Slots().load(std::memory_order_acquire); slot != nullptr; slot = slot->next) {
+                    bool expected = false;
+                    if (slot->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                        owner.slot = slot;
+                        return slot;
+                    }
+                }
+                auto *slot = new Slot();
+                slot->next = Slots().load(std::memory_order_relaxed);
+                while (!Slots().compare_exchange_weak(slot->next, slot, std::memory_order_release,
+                                                      std::memory_order_relaxed)) {
+                }
+                owner.slot = slot;
+            }
+            return owner.slot;
+        }
+    };
+
+    class FrozenTrieValues;
+
+    // The memory of one node, see TrieNodeType::memory.
+    struct TrieNodeMemory {
+        // The size of the node object, including a value stored inline.
+        size_t node_bytes;
+        // The bytes of the value kept outside the node, and the shared block that
+        // holds them with its use count. The block is null if the node owns them.
+        size_t value_bytes;
+        const void *value_block;
+        long value_use_count;
+    };
+
+    //——————————————————————————————————TrieNodeType——————————————————————————————————————————————————————————————————//
+
+    // TrieNodeType describes the kind of value a node carries. Every node points
+    // at the table of its value type, so the address of the table doubles as a
+    // compact type tag: Get<T> checks the type of a node with one pointer compare,
+    // and Clone dispatches through the table instead of a vtable.
+    struct TrieNodeType {
+        // Copy a node of this type, including its value, into a new shared node
+        // allocated from resource.
+        std::shared_ptr<TrieNode> (*clone)(const TrieNode &node, std::pmr::memory_resource *resource);
+
+        // Append the value of a node of this type to out with its TrieCodec and
+        // return the codec id. Null for nodes without a value.
+        uint32_t (*encode)(const TrieNode &node, std::string &out);
+
+        // Whether two nodes of this type hold the same value: the same shared
+        // value, or equal values if the type has operator==. Null for nodes
+        // without a value.
+        bool (*same)(const TrieNode &a, const TrieNode &b);
+
+        // A hash of the value of a node of this type that agrees with same. Null
+        // for nodes without a value.
+        size_t (*hash)(const TrieNode &node);
+
+        // The memory taken by a node of this type and its value.
+        TrieNodeMemory (*memory)(const TrieNode &node);
+
+        // Add the value of a node of this type to values and return where it went,
+        // and make a node with that value back from it, see FrozenTrie. Null for
+        // nodes without a value.
+        uint32_t (*freeze)(const TrieNode &node, FrozenTrieValues &values);
+        std::shared_ptr<TrieNode> (*thaw)(const FrozenTrieValues &values, uint32_t index, TrieChildren children,
+                                          std::pmr::memory_resource *resource);
+    };
+
+    //——————————————————————————————————TrieNode—————————————————————————————————————————————————————————————————————//
+    // A TrieNode is a node in a Trie.
+    class TrieNode {
+    private:
+        friend class TrieBuilder;
+        friend class TrieIterator;
+        friend class TransientTrie;
+        friend class TrieImage;
+        friend class LayeredTrie;
+        friend class TrieCheckpoint;
+        friend class TrieLog;
+        friend class TrieDelta;
+        friend class TrieInterner;
+        friend struct TrieMemory;
+        friend class FrozenTrie;
+
+        static auto ClonePlain(const TrieNode &node, std::pmr::memory_resource *resource) -> std::shared_ptr<TrieNode> {
+            return AllocateShared<TrieNode>(resource, node, resource);
+        }
+
+        static auto MeasurePlain(const TrieNode &) -> TrieNodeMemory {
+            return {sizeof(TrieNode), 0, nullptr, 0};
+        }
+
+    public:
+        friend class Trie;
+
+        // The type tag of nodes without a value.
+        static constexpr TrieNodeType kType{&ClonePlain, nullptr, nullptr, nullptr, &MeasurePlain, nullptr, nullptr};
+
+        // Create a TrieNode with no children.
+        TrieNode() = default;
+
+        // Create a TrieNode with some children.
+        explicit TrieNode(TrieChildren children): children_(std::move(children)) {
+        }
+
+        // Copy other, allocating its child table from resource; see Clone.
+        TrieNode(const TrieNode &other, std::pmr::memory_resource *resource)
+            : prefix_(other.prefix_), type_(other.type_), is_value_node_(other.is_value_node_),
+              children_(other.children_, resource) {
+        }
+
+        // Nodes are only ever owned through shared_ptrs created for their dynamic
+        // type, so the destructor does not need to be virtual.
+        ~TrieNode() = default;
+
+        // Clone returns a copy of this TrieNode, allocated from resource. If the
+        // TrieNode has a value, the value is copied. The return type of this
+        // function is a shared_ptr to a TrieNode.
+        // You cannot use the copy constructor to clone the node because it doesn't
+        // know whether a `TrieNode` contains a value or not.
+        auto Clone(std::pmr::memory_resource *resource = std::pmr::get_default_resource()) const
+            -> std::shared_ptr<TrieNode> {
+            TrieStats::Add(TrieStats::kClones);
+            TrieStats::Add(TrieStats::kNodesCreated);
+            return type_->clone(*this, resource);
+        }
+
+    protected:
+        // A lookup reads the prefix, the type and the first part of the children,
+        // so those are laid out together at the start of the node.
+
+        // The key bytes consumed on entering this node, after the byte that selects
+        // it in its parent. A chain of single-child nodes is stored as one node
+        // holding the whole segment (path compression), so every non-root node
+        // either has a value or branches. The root's prefix is always empty.
+        std::string prefix_;
+
+        // The type tag of this node, see TrieNodeType.
+        const TrieNodeType *type_{&kType};
+
+        // Indicates if the node is the terminal node.
+        bool is_value_node_{false};
+
+        // The children, keyed by the next character in the key.
+        TrieChildren children_;
+
+        // Which checkpoint saved this node, see TrieCheckpoint. A copy of a node
+        // is a new node, so it starts out unsaved.
+        struct CheckpointTag {
+            CheckpointTag() = default;
+
+            CheckpointTag(const CheckpointTag &) {
+            }
+
+            auto operator=(const CheckpointTag &) -> CheckpointTag & { return *this; }
+
+            mutable std::atomic<uint64_t> id{0};
+        };
+
+        CheckpointTag checkpoint_;
+    };
+
+
+    //——————————————————————————————————TrieValueHolder——————————————————————————————————————————————————————————————//
+
+    // Values up to this size that are trivially copyable are stored inside their node.
+    inline constexpr size_t kInlineValueSize = 16;
+
+    template<class T>
+    inline constexpr bool kInlineTrieValue = std::is_trivially_copyable_v<T> && std::is_copy_constructible_v<T> &&
+                                             sizeof(T) <= kInlineValueSize;
+
+    // The values of a FrozenTrie, kept the way the TrieValueHolder of their type
+    // asks for: small trivially copyable values are copied into 16-byte cells,
+    // short strings into an array of strings, and shared values stay shared with
+    // the trie that was frozen.
+    class FrozenTrieValues {
+    public:
+        template<class T>
+        auto AddInline(const T &value) -> uint32_t {
+            static_assert(sizeof(T) <= sizeof(Cell) && alignof(T) <= alignof(Cell));
+            cells_.emplace_back();
+            new(cells_.back().bytes) T(value);
+            return Index(cells_.size() - 1);
+        }
+
+        template<class T>
+        auto Inline(uint32_t index) const -> const T * {
+            return std::launder(reinterpret_cast<const T *>(cells_[index].bytes));
+        }
+
+        auto AddString(const std::string &value) -> uint32_t {
+            strings_.push_back(value);
+            return Index(strings_.size() - 1);
+        }
+
+        auto String(uint32_t index) const -> const std::string * { return &strings_[index]; }
+
+        auto AddShared(std::shared_ptr<const void> value) -> uint32_t {
+            shared_.push_back(std::move(value));
+            return Index(shared_.size() - 1);
+        }
+
+        auto Shared(uint32_t index) const -> const std::shared_ptr<const void> & { return shared_[index]; }
+
+        // The bytes of the arrays, leaving out the values that are shared.
+        auto Bytes() const -> size_t {
+            size_t bytes = cells_.capacity() * sizeof(Cell) + strings_.capacity() * sizeof(std::string) +
+                           shared_.capacity() * sizeof(std::shared_ptr<const void>);
+            for (const std::string &string: strings_) {
+                bytes += StringHeapBytes(string);
+            }
+            return bytes;
+        }
+
+        void ShrinkToFit() {
+            cells_.shrink_to_fit();
+            strings_.shrink_to_fit();
+            shared_.shrink_to_fit();
+        }
+
+    private:
+        struct alignas(16) Cell {
+            unsigned char bytes[kInlineValueSize];
+        };
+
+        static auto Index(size_t index) -> uint32_t {
+            if (index > UINT32_MAX) {
+                throw std::length_error("FrozenTrie: too many values");
+            }
+            return static_cast<uint32_t>(index);
+        }
+
+        std::vector<Cell> cells_;
+        std::vector<std::string> strings_;
+        std::vector<std::shared_ptr<const void> > shared_;
+    };
+
+    // TrieValueHolder is how a TrieNodeWithValue stores its value. By default the
+    // value is shared, so cloning a node only bumps a refcount and non-copyable
+    // values are supported.
+    template<class T, class = void>
+    class TrieValueHolder {
+    public:
+        TrieValueHolder(std::in_place_t, T value, std::pmr::memory_resource *resource)
+            : value_(AllocateShared<T>(resource, std::move(value))) {
+        }
+
+        explicit TrieValueHolder(std::shared_ptr<T> value): value_(std::move(value)) {
+        }
+
+        auto Get() const -> const T * { return value_.get(); }
+
+        auto Memory() const -> TrieNodeMemory {
+            return {0, sizeof(T) + kSharedControlBytes, value_.get(), value_.use_count()};
+        }
+
+        auto Freeze(FrozenTrieValues &values) const -> uint32_t { return values.AddShared(value_); }
+
+        static auto Frozen(const FrozenTrieValues &values, uint32_t index) -> const T * {
+            return static_cast<const T *>(values.Shared(index).get());
+        }
+
+        static auto Thaw(const FrozenTrieValues &values, uint32_t index, std::pmr::memory_resource *)
+            -> TrieValueHolder {
+            const std::shared_ptr<const void> &shared = values.Shared(index);
+            return TrieValueHolder(std::shared_ptr<T>(shared, const_cast<T *>(Frozen(values, index))));
+        }
+
+    private:
+        std::shared_ptr<T> value_;
+    };
+
+    // Small trivially copyable values live in the node itself. That saves the
+    // second allocation and control block, and the pointer chase on every read.
+    template<class T>
+    class TrieValueHolder<T, std::enable_if_t<kInlineTrieValue<T> > > {
+    public:
+        TrieValueHolder(std::in_place_t, T value, std::pmr::memory_resource *): value_(std::move(value)) {
+        }
+
+        explicit TrieValueHolder(const std::shared_ptr<T> &value): value_(*value) {
+        }
+
+        auto Get() const -> const T * { return &value_; }
+
+        auto Memory() const -> TrieNodeMemory { return {0, 0, nullptr, 0}; }
+
+        auto Freeze(FrozenTrieValues &values) const -> uint32_t { return values.AddInline(value_); }
+
+        static auto Frozen(const FrozenTrieValues &values, uint32_t index) -> const T * {
+            return values.Inline<T>(index);
+        }
+
+        static auto Thaw(const FrozenTrieValues &values, uint32_t index, std::pmr::memory_resource *resource)
+            -> TrieValueHolder {
+            return TrieValueHolder(std::in_place, *Frozen(values, index), resource);
+        }
+
+    private:
+        T value_;
+    };
+
+    // Strings short enough for the small-string buffer are kept in the node, where
+    // copying them allocates nothing. Longer strings are shared.
+    template<>
+    class TrieValueHolder<std::string> {
+    public:
+        static constexpr size_t kInlineLength = 15;
+
+        TrieValueHolder(std::in_place_t, std::string value, std::pmr::memory_resource *resource) {
+            if (value.size() <= kInlineLength) {
+                inline_ = std::move(value);
+            } else {
+                shared_ = AllocateShared<std::string>(resource, std::move(value));
+            }
+        }
+
+        explicit TrieValueHolder(std::shared_ptr<std::string> value): shared_(std::move(value)) {
+        }
+
+        auto Get() const -> const std::string * { return shared_ ? shared_.get() : &inline_; }
+
+        auto Memory() const -> TrieNodeMemory {
+            if (!shared_) return {0, StringHeapBytes(inline_), nullptr, 0};
+            return {0, sizeof(std::string) + kSharedControlBytes + StringHeapBytes(*shared_), shared_.get(),
+                    shared_.use_count()};
+        }
+
+        // The lowest bit of the index tells a shared string from a copied one.
+        auto Freeze(FrozenTrieValues &values) const -> uint32_t {
+            const uint32_t index = shared_ ? values.AddShared(shared_) : values.AddString(inline_);
+            if (index > UINT32_MAX / 2) {
+                throw std::length_error("FrozenTrie: too many values");
+            }
+            return index << 1 | (shared_ ? 1 : 0);
+        }
+
+        static auto Frozen(const FrozenTrieValues &values, uint32_t index) -> const std::string * {
+            if (index & 1) {
+                return static_cast<const std::string *>(values.Shared(index >> 1).get());
+            }
+            return values.String(index >> 1);
+        }
+
+        static auto Thaw(const FrozenTrieValues &values, uint32_t index, std::pmr::memory_resource *resource)
+            -> TrieValueHolder {
+            if (index & 1) {
+                const std::shared_ptr<const void> &shared = values.Shared(index >> 1);
+                return TrieValueHolder(std::shared_ptr<std::string>(shared, const_cast<std::string *>(
+                                                                        Frozen(values, index))));
+            }
+            return TrieValueHolder(std::in_place, *Frozen(values, index), resource);
+        }
+
+    private:
+        std::string inline_;
+        std::shared_ptr<std::string> shared_;
+    };
+
+    //——————————————————————————————————TrieNodeWithValue————————————————————————————————————————————————————————————//
+
+    // A TrieNodeWithValue is a TrieNode that also has a value of type T associated
+    // with it.
+    template<class T>
+    class TrieNodeWithValue : public TrieNode {
+    private:
+        static auto CloneWithValue(const TrieNode &node, std::pmr::memory_resource *resource)
+            -> std::shared_ptr<TrieNode> {
+            return AllocateShared<TrieNodeWithValue<T> >(resource, static_cast<const TrieNodeWithValue<T> &>(node),
+                                                         resource);
+        }
+
+        static auto EncodeValue(const TrieNode &node, std::string &out) -> uint32_t {
+            if constexpr (kHasTrieCodec<T>) {
+                TrieCodec<T>::Encode(*static_cast<const TrieNodeWithValue<T> &>(node).value_.Get(), out);
+                return TrieCodec<T>::kId;
+            } else {
+                throw std::runtime_error("TrieImage: a value type has no TrieCodec");
+            }
+        }
+
+        static auto SameValue(const TrieNode &a, const TrieNode &b) -> bool {
+            const T *x = static_cast<const TrieNodeWithValue<T> &>(a).value_.Get();
+            const T *y = static_cast<const TrieNodeWithValue<T> &>(b).value_.Get();
+            if constexpr (std::equality_comparable<T>) {
+                return x == y || *x == *y;
+            } else {
+                return x == y;
+            }
+        }
+
+        static auto HashValue(const TrieNode &node) -> size_t {
+            const T *x = static_cast<const TrieNodeWithValue<T> &>(node).value_.Get();
+            if constexpr (!std::equality_comparable<T>) {
+                return std::hash<const T *>{}(x);
+            } else if constexpr (requires { std::hash<T>{}(*x); }) {
+                return std::hash<T>{}(*x);
+            } else {
+                return 0;
+            }
+        }
+
+        static auto MeasureValue(const TrieNode &node) -> TrieNodeMemory {
+            TrieNodeMemory memory = static_cast<const TrieNodeWithValue<T> &>(node).value_.Memory();
+            memory.node_bytes = sizeof(TrieNodeWithValue<T>);
+            return memory;
+        }
+
+        static auto FreezeValue(const TrieNode &node, FrozenTrieValues &values) -> uint32_t {
+            return static_cast<const TrieNodeWithValue<T> &>(node).value_.Freeze(values);
+        }
+
+        static auto ThawValue(const FrozenTrieValues &values, uint32_t index, TrieChildren children,
+                              std::pmr::memory_resource *resource) -> std::shared_ptr<TrieNode> {
+            return AllocateShared<TrieNodeWithValue<T> >(resource, std::move(children),
+                                                         TrieValueHolder<T>::Thaw(values, index, resource));
+        }
+
+    public:
+        friend class Trie;
+
+        // The type tag of nodes holding a T.
+        static constexpr TrieNodeType kType{
+            &CloneWithValue, &EncodeValue, &SameValue, &HashValue, &MeasureValue, &FreezeValue, &ThawValue
+        };
+
+        // Create a trie node with no children and a value.
+        explicit TrieNodeWithValue(std::shared_ptr<T> value)
+            : value_(std::move(value)) {
+            this->type_ = &kType;
+            this->is_value_node_ = true;
+        }
+
+        // Create a trie node with children and a value, stored as TrieValueHolder<T>
+        // chooses. A value that is not stored inline is allocated from resource.
+        TrieNodeWithValue(std::in_place_t, TrieChildren children, T value, std::pmr::memory_resource *resource)
+            : TrieNode(std::move(children)), value_(std::in_place, std::move(value), resource) {
+            this->type_ = &kType;
+            this->is_value_node_ = true;
+        }
+
+        // Create a trie node with children and a value.
+        TrieNodeWithValue(TrieChildren children,
+                          std::shared_ptr<T> value)
+            : TrieNode(std::move(children)), value_(std::move(value)) {
+            this->type_ = &kType;
+            this->is_value_node_ = true;
+        }
+
+        // Create a trie node with children and a value that is already held.
+        TrieNodeWithValue(TrieChildren children, TrieValueHolder<T> value)
+            : TrieNode(std::move(children)), value_(std::move(value)) {
+            this->type_ = &kType;
+            this->is_value_node_ = true;
+        }
+
+        // Copying copies an inline value and shares any other, which is how Clone
+        // copies a value node. The child table is allocated from resource.
+        TrieNodeWithValue(const TrieNodeWithValue &other, std::pmr::memory_resource *resource)
+            : TrieNode(other, resource), value_(other.value_) {
+        }
+
+    protected:
+        // The value associated with this trie node.
+        TrieValueHolder<T> value_;
+    };
+
+    //——————————————————————————————————Trie—————————————————————————————————————————————————————————————————————————//
+
+    class TransientTrie;
+    class TrieIterator;
+    class TrieRange;
+    struct TrieChange;
+    struct TrieMemory;
+    class FrozenTrie;
+
+    // A Trie is a data structure that maps strings to values of type T. All
+    // operations on a Trie should not modify the trie itself. It should reuse the
+    // existing nodes as much as possible, and create new nodes to represent the new
+    // trie.
+    class Trie {
+    private:
+        friend class TrieStore;
+        friend class TransientTrie;
+        friend class TrieBuilder;
+        friend class TrieIterator;
+        friend class TrieImage;
+        friend class LayeredTrie;
+        friend class TrieCheckpoint;
+        friend class TrieInterner;
+        friend struct TrieChange;
+        friend struct TrieMemory;
+        friend class FrozenTrie;
+
+        template<class T>
+        friend class ValueGuard;
+
+        // The root of the trie.
+        std::shared_ptr<const TrieNode> root_{nullptr};
+
+        // Where the nodes created by this trie and the tries derived from it are
+        // allocated. The resource must outlive all of them.
+        std::pmr::memory_resource *resource_{std::pmr::get_default_resource()};
+
+        // Create a new trie with the given root.
+        Trie(std::shared_ptr<const TrieNode> root, std::pmr::memory_resource *resource)
+            : root_(std::move(root)), resource_(resource) {
+        }
+
+    public:
+        // Create an empty trie.
+        Trie() = default;
+
+        // Create an empty trie whose nodes are allocated from resource, for example
+        // a NodePool, or a std::pmr::monotonic_buffer_resource that is released in
+        // bulk once every trie of a generation is gone.
+        explicit Trie(std::pmr::memory_resource *resource): resource_(resource) {
+        }
+
+        auto GetResource() const -> std::pmr::memory_resource * { return resource_; }
+
+        bool operator==(const Trie &other) const {
+            if (root_ == other.root_) {
+                return true;
+            } else {
+                return false;
+            }
+        }
+
+        // Get the value associated with the given key.
+        // 1. If the key is not in the trie, return nullptr.
+        // 2. If the key is in the trie but the type is mismatched, return nullptr.
+        // 3. Otherwise, return the value.
+        template<class T>
+        auto Get(std::string_view key) const -> const T * {
+            return GetValue<T>(FindNode(root_, key));
+        }
+
+        // Put a new key-value pair into the trie. If the key already exists,
+        // overwrite the value. Returns the new trie.
+        template<class T>
+        auto Put(std::string_view key, T value) const -> Trie {
+            std::shared_ptr<const TrieNode> root = root_;
+            CopyingEditor editor{resource_};
+            PutNode<T>(editor, root, key, std::move(value));
+            return Trie(std::move(root), resource_);
+        }
+
+        // Get, Put and Remove with a typed key, stored as its TrieKey bytes.
+        template<class T, class K> requires kTypedTrieKey<K>
+        auto Get(const K &key) const -> const T * {
+            return Get<T>(EncodeKey(key));
+        }
+
+        template<class T, class K> requires kTypedTrieKey<K>
+        auto Put(const K &key, T value) const -> Trie {
+            return Put<T>(EncodeKey(key), std::move(value));
+        }
+
+        template<class K> requires kTypedTrieKey<K>
+        auto Remove(const K &key) const -> Trie {
+            return Remove(EncodeKey(key));
+        }
+
+
+        // Remove the key from the trie. If the key does not exist, return the
+        // original trie. Otherwise, returns the new trie.
+        auto Remove(std::string_view key) const -> Trie {
+            std::shared_ptr<const TrieNode> root = root_;
+            CopyingEditor editor{resource_};
+            if (!RemoveNode(editor, root, key)) {
+                return *this;
+            }
+            return Trie(std::move(root), resource_);
+        }
+
+        // Put every key-value pair of entries, later entries winning over earlier
+        // ones with the same key, and return the new trie. Keys are partitioned by
+        // their first byte, and the subtrees of the partitions are built on up to
+        // threads threads (0 for one per core) and joined under one new root.
+        // Keys that all start with the same byte are put on one thread. With more
+        // than one thread the resource of this trie must be thread-safe, which
+        // std::pmr::monotonic_buffer_resource is not.
+        template<class T>
+        auto PutMany(std::vector<std::pair<std::string, T> > entries, size_t threads = 0) const -> Trie;
+
+        // Get the value of every key, like Get. Each thread looks up several keys
+        // at once, prefetching the next node of each, so that the cache misses of
+        // the lookups overlap. threads is as for PutMany.
+        template<class T>
+        auto GetMany(const std::vector<std::string_view> &keys, size_t threads = 0) const
+            -> std::vector<const T *> {
+            std::vector<const T *> values(keys.size());
+            const size_t chunks = ParallelThreads(keys.size(), threads);
+            ForEachParallel(chunks, chunks, [&](size_t chunk) {
+                GetRun<T>(keys, keys.size() * chunk / chunks, keys.size() * (chunk + 1) / chunks, values);
+            });
+            return values;
+        }
+
+        // Return a mutable working copy of this trie for a run of writes, see
+        // TransientTrie.
+        auto Transient() const -> TransientTrie;
+
+        // Iterate over all keys in ascending order.
+        auto Scan() const -> TrieRange;
+
+        // Iterate over the keys that start with prefix, in ascending order.
+        auto ScanPrefix(std::string_view prefix) const -> TrieRange;
+
+        // Iterate over the keys in [lo, hi), in ascending order.
+        auto Range(std::string_view lo, std::string_view hi) const -> TrieRange;
+
+        // Return an iterator at the first key that is not less than key.
+        auto LowerBound(std::string_view key) const -> TrieIterator;
+
+        // Return the keys that newer inserts, removes or changes relative to this
+        // trie, in ascending order. Subtrees the two tries share are skipped, so
+        // the cost follows the number of changed nodes, not the size of the tries.
+        auto Diff(const Trie &newer) const -> std::vector<TrieChange>;
+
+        // Count the nodes and bytes of this trie, see TrieMemory. The unique bytes
+        // are what destroying this trie would free, so none while a copy of it
+        // is alive.
+        auto Memory() const -> TrieMemory;
+
+        // Return a compact read-only copy of this trie, see FrozenTrie.
+        auto Freeze() const -> FrozenTrie;
+
+    private:
+        struct DiffCursor;
+
+        // Bulk operations give each thread at least this many keys.
+        static constexpr size_t kParallelGrain = 4096;
+
+        // How many keys GetRun looks up at once.
+        static constexpr size_t kLookupLanes = 8;
+
+        // The number of threads to use for count keys when asked for threads.
+        static auto ParallelThreads(size_t count, size_t threads) -> size_t {
+            if (threads == 0) {
+                threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+            }
+            return std::max<size_t>(1, std::min(threads, count / kParallelGrain));
+        }
+
+        // Run task(i) for every i in [0, count) on up to threads threads, the
+        // calling thread among them, and rethrow the first exception a task threw.
+        template<class F>
+        static void ForEachParallel(size_t count, size_t threads, F &&task) {
+            std::atomic<size_t> next{0};
+            std::exception_ptr error;
+            std::mutex error_lock;
+            auto work = [&] {
+                for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;) {
+                    try {
+                        task(i);
+                    } catch (...) {
+                        std::lock_guard<std::mutex> lock(error_lock);
+                        if (!error) error = std::current_exception();
+                    }
+                }
+            };
+            std::vector<std::thread> workers;
+            for (size_t t = 1; t < std::min(threads, count); ++t) {
+                try {
+                    workers.emplace_back(work);
+                } catch (const std::system_error &) {
+                    // Run on the threads there are.
+                    break;
+                }
+            }
+            work();
+            for (auto &worker: workers) {
+                worker.join();
+            }
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+
+        // Look up keys[begin, end) into values, kLookupLanes keys at a time. Every
+        // round moves each lane one node down and prefetches the node it moved
+        // to, which the next round reads.
+        template<class T>
+        void GetRun(const std::vector<std::string_view> &keys, size_t begin, size_t end,
+                    std::vector<const T *> &values) const {
+            struct Lane {
+                size_t key;
+                // The node reached, whose prefix starts at key[i].
+                const TrieNode *node;
+                size_t i;
+            };
+            Lane lanes[kLookupLanes];
+            size_t active = 0;
+            size_t next = begin;
+            while (active < kLookupLanes && next < end) {
+                lanes[active++] = {next++, root_.get(), 0};
+            }
+            while (active > 0) {
+                for (size_t l = 0; l < active;) {
+                    Lane &lane = lanes[l];
+                    const std::string_view key = keys[lane.key];
+                    const TrieNode *node = lane.node;
+                    if (node != nullptr) {
+                        const std::string &prefix = node->prefix_;
+                        if (key.substr(lane.i, prefix.size()) != prefix) {
+                            node = nullptr;
+                        } else if (lane.i + prefix.size() < key.size()) {
+                            const size_t i = lane.i + prefix.size();
+                            if (const auto *child = node->children_.Find(key[i])) {
+                                lane.node = child->get();
+                                lane.i = i + 1;
+                                Prefetch(lane.node);
+                                ++l;
+                                continue;
+                            }
+                            node = nullptr;
+                        }
+                    }
+                    values[lane.key] = GetValue<T>(node);
+                    if (next < end) {
+                        lane = {next++, root_.get(), 0};
+                        ++l;
+                    } else {
+                        lane = lanes[--active];
+                    }
+                }
+            }
+        }
+
+        // Append the differences below two positions at key to out.
+        static void DiffNodes(DiffCursor older, DiffCursor newer, std::string &key, std::vector<TrieChange> &out);
+
+        // Return the pointer that owns the node of key, so that the node can be
+        // kept alive on its own, or nullptr if the trie has no such node.
+        static auto FindSlot(const std::shared_ptr<const TrieNode> &root, std::string_view key)
+            -> const std::shared_ptr<const TrieNode> * {
+            if (root == nullptr) {
+                return nullptr;
+            }
+            const std::shared_ptr<const TrieNode> *slot = &root;
+            size_t i = 0;
+            while (i < key.size()) {
+                slot = (*slot)->children_.Find(key[i++]);
+                if (slot == nullptr) {
+                    return nullptr;
+                }
+                // The child table is a separate block: start loading it while the
+                // prefix, which may be a block of its own, is compared.
+                (*slot)->children_.Prefetch();
+                const std::string &prefix = (*slot)->prefix_;
+                if (key.substr(i, prefix.size()) != prefix) {
+                    return nullptr;
+                }
+                i += prefix.size();
+            }
+            return slot;
+        }
+
+        // Return the node of key, or nullptr if the trie has no such node.
+        static auto FindNode(const std::shared_ptr<const TrieNode> &root, std::string_view key) -> const TrieNode * {
+            const auto *slot = FindSlot(root, key);
+            return slot == nullptr ? nullptr : slot->get();
+        }
+
+        // Return the value of node if it holds a T.
+        template<class T>
+        static auto GetValue(const TrieNode *node) -> const T * {
+            // The type tag also rules out nodes without a value.
+            if (node == nullptr || node->type_ != &TrieNodeWithValue<T>::kType) {
+                return nullptr;
+            }
+            return static_cast<const TrieNodeWithValue<T> *>(node)->value_.Get();
+        }
+
+        // PutNode and RemoveNode edit a tree through an Editor, which decides how a
+        // node that is about to change is obtained: Mutable(node) returns a node
+        // that may be modified in place of node, Create<NodeT>(args...) makes a new
+        // one, TakeChildren(node) returns the children of a node that is about to
+        // be replaced, and Release(node) is told when an obtained node leaves the
+        // tree.
+        // The CopyingEditor clones every node it touches, which is what keeps a Trie
+        // persistent; a TransientTrie clones a node only the first time.
+        struct CopyingEditor {
+            std::pmr::memory_resource *resource;
+
+            auto Mutable(const std::shared_ptr<const TrieNode> &node) const -> std::shared_ptr<TrieNode> {
+                return node->Clone(resource);
+            }
+
+            template<class NodeT, class... Args>
+            auto Create(Args &&... args) const -> std::shared_ptr<NodeT> {
+                TrieStats::Add(TrieStats::kNodesCreated);
+                return AllocateShared<NodeT>(resource, std::forward<Args>(args)...);
+            }
+
+            auto TakeChildren(const std::shared_ptr<const TrieNode> &node) const -> TrieChildren {
+                return TrieChildren(node->children_, resource);
+            }
+
+            void Release(const TrieNode *) const {
+            }
+
+            auto Resource() const -> std::pmr::memory_resource * { return resource; }
+        };
+
+        // The nodes on the way from the root to a key: the pointer that owns each
+        // node, and the byte that leads to it from the node before. Paths up to
+        // kInlineDepth nodes deep need no allocation.
+        class PathBuffer {
+        public:
+            struct Entry {
+                const std::shared_ptr<const TrieNode> *slot;
+                char c;
+            };
+
+            void Push(Entry entry) {
+                if (size_ < kInlineDepth) {
+                    inline_[size_] = entry;
+                } else {
+                    overflow_.push_back(entry);
+                }
+                ++size_;
+            }
+
+            auto operator[](size_t i) const -> const Entry & {
+                return i < kInlineDepth ? inline_[i] : overflow_[i - kInlineDepth];
+            }
+
+            auto Size() const -> size_t { return size_; }
+
+        private:
+            static constexpr size_t kInlineDepth = 32;
+
+            Entry inline_[kInlineDepth];
+            std::vector<Entry> overflow_;
+            size_t size_{0};
+        };
+
+        // Walk from a non-null root towards key without changing anything,
+        // recording every node whose whole segment matches. Returns how much of
+        // key the last recorded node covers.
+        static auto Descend(const std::shared_ptr<const TrieNode> &root, std::string_view key, PathBuffer &path)
+            -> size_t {
+            path.Push({&root, 0});
+            size_t i = 0;
+            while (i < key.size()) {
+                const auto *child = (*path[path.Size() - 1].slot)->children_.Find(key[i]);
+                if (child == nullptr) {
+                    break;
+                }
+                const std::string &prefix = (*child)->prefix_;
+                if (key.substr(i + 1, prefix.size()) != prefix) {
+                    break;
+                }
+                path.Push({child, key[i]});
+                i += 1 + prefix.size();
+            }
+            return i;
+        }
+
+        // Put replacement in place of the node at path[level] and copy its
+        // ancestors up to root. The walk stops at the first node that is still the
+        // one its parent points to, which happens when the editor changed it in
+        // place.
+        template<class Editor>
+        static void Propagate(Editor &editor, std::shared_ptr<const TrieNode> &root, const PathBuffer &path,
+                              size_t level, std::shared_ptr<const TrieNode> replacement) {
+            for (; level > 0; --level) {
+                if (replacement.get() == path[level].slot->get()) {
+                    return;
+                }
+                std::shared_ptr<TrieNode> parent = editor.Mutable(*path[level - 1].slot);
+                parent->children_.Set(path[level].c, std::move(replacement), editor.Resource());
+                replacement = std::move(parent);
+            }
+            root = std::move(replacement);
+        }
+
+        // Return a value node for key[from..] with no children.
+        template<class T, class Editor>
+        static auto MakeLeaf(Editor &editor, std::string_view key, size_t from, T value)
+            -> std::shared_ptr<TrieNodeWithValue<T> > {
+            auto leaf = editor.template Create<TrieNodeWithValue<T> >(std::in_place, TrieChildren(), std::move(value),
+                                                                      editor.Resource());
+            leaf->prefix_ = key.substr(from);
+            return leaf;
+        }
+
+        // Store value under key in the tree rooted at root, replacing root. The
+        // path is found first and only then copied, bottom-up.
+        template<class T, class Editor>
+        static void PutNode(Editor &editor, std::shared_ptr<const TrieNode> &root, std::string_view key, T value) {
+            if (!root) {
+                if (key.empty()) {
+                    root = MakeLeaf<T>(editor, key, 0, std::move(value));
+                    return;
+                }
+                auto new_root = editor.template Create<TrieNode>();
+                new_root->children_.Set(key[0], MakeLeaf<T>(editor, key, 1, std::move(value)), editor.Resource());
+                root = std::move(new_root);
+                return;
+            }
+
+            PathBuffer path;
+            const size_t i = Descend(root, key, path);
+            const size_t level = path.Size() - 1;
+            const std::shared_ptr<const TrieNode> &last = *path[level].slot;
+            if (i == key.size()) {
+                // 节点已存在：换成带值的节点，继承原有子节点
+                auto value_node = editor.template Create<TrieNodeWithValue<T> >(std::in_place,
+                                                                                editor.TakeChildren(last),
+                                                                                std::move(value), editor.Resource());
+                value_node->prefix_ = last->prefix_;
+                editor.Release(last.get());
+                Propagate(editor, root, path, level, std::move(value_node));
+                return;
+            }
+
+            const char c = key[i];
+            const auto *child = last->children_.Find(c);
+            std::shared_ptr<TrieNode> branch;
+            if (child == nullptr) {
+                // 子节点不存在：新建一个叶子，直接保存剩余的整段key
+                branch = MakeLeaf<T>(editor, key, i + 1, std::move(value));
+            } else {
+                // 部分匹配：在分叉处拆分压缩路径
+                const std::string_view rest = key.substr(i + 1);
+                const std::string &prefix = (*child)->prefix_;
+                size_t match = 0;
+                while (match < prefix.size() && match < rest.size() && prefix[match] == rest[match]) {
+                    ++match;
+                }
+                std::string split_prefix = prefix.substr(0, match);
+                const char tail_c = prefix[match];
+                std::string tail_prefix = prefix.substr(match + 1);
+                std::shared_ptr<TrieNode> tail = editor.Mutable(*child);
+                tail->prefix_ = std::move(tail_prefix);
+                TrieChildren children;
+                children.Set(tail_c, std::move(tail), editor.Resource());
+                if (match == rest.size()) {
+                    branch = editor.template Create<TrieNodeWithValue<T> >(std::in_place, std::move(children),
+                                                                           std::move(value), editor.Resource());
+                } else {
+                    branch = editor.template Create<TrieNode>(std::move(children));
+                    branch->children_.Set(rest[match], MakeLeaf<T>(editor, rest, match + 1, std::move(value)),
+                                          editor.Resource());
+                }
+                branch->prefix_ = std::move(split_prefix);
+            }
+            std::shared_ptr<TrieNode> parent = editor.Mutable(last);
+            parent->children_.Set(c, std::move(branch), editor.Resource());
+            Propagate(editor, root, path, level, std::move(parent));
+        }
+
+        // Remove key from the tree rooted at root, replacing root. Returns false if
+        // the key was not there; nothing is copied then and root is unchanged.
+        template<class Editor>
+        static auto RemoveNode(Editor &editor, std::shared_ptr<const TrieNode> &root, std::string_view key) -> bool {
+            if (!root) {
+                return false;
+            }
+            PathBuffer path;
+            if (Descend(root, key, path) != key.size() || !(*path[path.Size() - 1].slot)->is_value_node_) {
+                return false;
+            }
+
+            // 用不带值的节点替换值节点：没有孩子的节点直接删除，只剩一个孩子的非根节点与孩子合并
+            size_t level = path.Size() - 1;
+            const std::shared_ptr<const TrieNode> &target = *path[level].slot;
+            std::shared_ptr<const TrieNode> replacement;
+            if (level > 0 && target->children_.Size() == 1) {
+                replacement = MergeWithOnlyChild(editor, *target);
+            } else if (!target->children_.Empty()) {
+                auto plain = editor.template Create<TrieNode>(editor.TakeChildren(target));
+                plain->prefix_ = target->prefix_;
+                replacement = std::move(plain);
+            }
+            editor.Release(target.get());
+
+            // 反向遍历：从父节点中删除空节点，父节点因此只剩一个孩子时再与孩子合并
+            while (replacement == nullptr && level > 0) {
+                std::shared_ptr<TrieNode> parent = editor.Mutable(*path[level - 1].slot);
+                parent->children_.Erase(path[level].c);
+                --level;
+                if (level > 0 && !parent->is_value_node_ && parent->children_.Size() <= 1) {
+                    editor.Release(parent.get());
+                    if (!parent->children_.Empty()) {
+                        replacement = MergeWithOnlyChild(editor, *parent);
+                    }
+                } else {
+                    replacement = std::move(parent);
+                }
+            }
+
+            if (replacement == nullptr || (level == 0 && replacement->children_.Empty() &&
+                                           !replacement->is_value_node_)) {
+                editor.Release(replacement.get());
+                root = nullptr;
+                return true;
+            }
+            Propagate(editor, root, path, level, std::move(replacement));
+            return true;
+        }
+
+        // Collapse a non-value node with exactly one child into a copy of that child
+        // whose prefix covers both segments.
+        template<class Editor>
+        static auto MergeWithOnlyChild(Editor &editor, const TrieNode &node) -> std::shared_ptr<const TrieNode> {
+            std::shared_ptr<TrieNode> merged;
+            node.children_.ForEach([&](char c, const TrieChildren::Child &child) {
+                merged = editor.Mutable(child);
+                std::string joined = node.prefix_ + c + merged->prefix_;
+                merged->prefix_ = std::move(joined);
+            });
+            return merged;
+        }
+    };
+
+
+    //——————————————————————————————————TransientTrie————————————————————————————————————————————————————————————————//
+
+    // A TransientTrie is a mutable working copy of a Trie. It copies a node the
+    // first time a write touches it and edits that copy in place afterwards, so a
+    // run of writes copies every shared node at most once. Freeze returns the
+    // content as an ordinary immutable Trie.
+    // A TransientTrie is not thread-safe.
+    class TransientTrie {
+    public:
+        explicit TransientTrie(const Trie &base): root_(base.root_), resource_(base.resource_) {
+        }
+
+        TransientTrie(const TransientTrie &) = delete;
+
+        TransientTrie(TransientTrie &&) = default;
+
+        auto operator=(const TransientTrie &) -> TransientTrie & = delete;
+
+        auto operator=(TransientTrie &&) -> TransientTrie & = default;
+
+        // Same as Trie::Get.
+        template<class T>
+        auto Get(std::string_view key) const -> const T * {
+            return Trie::GetValue<T>(Trie::FindNode(root_, key));
+        }
+
+        // Put a new key-value pair, overwriting the value if the key exists.
+        template<class T>
+        void Put(std::string_view key, T value) {
+            Trie::PutNode<T>(*this, root_, key, std::move(value));
+        }
+
+        // Remove the key. Returns false if it did not exist.
+        auto Remove(std::string_view key) -> bool {
+            return Trie::RemoveNode(*this, root_, key);
+        }
+
+        // Return the current content as an immutable Trie. The transient stays
+        // usable; nodes now shared with the returned Trie are copied again on the
+        // next write that touches them.
+        auto Freeze() -> Trie {
+            owned_.clear();
+            return Trie(root_, resource_);
+        }
+
+    private:
+        friend class Trie;
+
+        // The editor interface used by Trie::PutNode and Trie::RemoveNode.
+        auto Mutable(const std::shared_ptr<const TrieNode> &node) -> std::shared_ptr<TrieNode> {
+            if (owned_.count(node.get()) != 0) {
+                // Every owned node was created non-const by this transient.
+                return std::const_pointer_cast<TrieNode>(node);
+            }
+            std::shared_ptr<TrieNode> copy = node->Clone(resource_);
+            owned_.insert(copy.get());
+            return copy;
+        }
+
+        template<class NodeT, class... Args>
+        auto Create(Args &&... args) -> std::shared_ptr<NodeT> {
+            TrieStats::Add(TrieStats::kNodesCreated);
+            auto node = AllocateShared<NodeT>(resource_, std::forward<Args>(args)...);
+            owned_.insert(node.get());
+            return node;
+        }
+
+        auto TakeChildren(const std::shared_ptr<const TrieNode> &node) -> TrieChildren {
+            if (owned_.count(node.get()) != 0) {
+                return std::move(std::const_pointer_cast<TrieNode>(node)->children_);
+            }
+            return TrieChildren(node->children_, resource_);
+        }
+
+        void Release(const TrieNode *node) { owned_.erase(node); }
+
+        auto Resource() const -> std::pmr::memory_resource * { return resource_; }
+
+        std::shared_ptr<const TrieNode> root_;
+        std::pmr::memory_resource *resource_;
+
+        // The nodes only this transient can see; they may be modified in place.
+        std::unordered_set<const TrieNode *> owned_;
+    };
+
+
+    template<class T>
+    auto Trie::PutMany(std::vector<std::pair<std::string, T> > entries, size_t threads) const -> Trie {
+        if (entries.empty()) {
+            return *this;
+        }
+        // The entries of each first byte, in order; the empty key goes last.
+        std::vector<std::vector<size_t> > partitions(257);
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const std::string &key = entries[i].first;
+            partitions[key.empty() ? 256 : static_cast<unsigned char>(key[0])].push_back(i);
+        }
+        std::vector<size_t> used;
+        for (size_t c = 0; c < 256; ++c) {
+            if (!partitions[c].empty()) used.push_back(c);
+        }
+
+        // Every partition is put into a trie holding only its subtree, so the
+        // partitions share no node that is written.
+        std::vector<std::shared_ptr<const TrieNode> > subtrees(256);
+        ForEachParallel(used.size(), ParallelThreads(entries.size(), threads), [&](size_t n) {
+            const size_t c = used[n];
+            auto root = AllocateShared<TrieNode>(resource_);
+            if (root_ != nullptr) {
+                if (const auto *child = root_->children_.Find(static_cast<char>(c))) {
+                    root->children_.Set(static_cast<char>(c), *child, resource_);
+                }
+            }
+            TransientTrie partition(Trie(std::move(root), resource_));
+            for (size_t i: partitions[c]) {
+                partition.Put<T>(entries[i].first, std::move(entries[i].second));
+            }
+            subtrees[c] = *partition.Freeze().root_->children_.Find(static_cast<char>(c));
+        });
+
+        CopyingEditor editor{resource_};
+        std::shared_ptr<TrieNode> joined = root_ != nullptr ? root_->Clone(resource_) : editor.Create<TrieNode>();
+        for (size_t c: used) {
+            joined->children_.Set(static_cast<char>(c), std::move(subtrees[c]), resource_);
+        }
+        std::shared_ptr<const TrieNode> root = std::move(joined);
+        if (!partitions[256].empty()) {
+            PutNode<T>(editor, root, "", std::move(entries[partitions[256].back()].second));
+        }
+        return Trie(std::move(root), resource_);
+    }
+
+    inline auto Trie::Transient() const -> TransientTrie {
+        return TransientTrie(*this);
+    }
+
+
+    //——————————————————————————————————TrieIterator—————————————————————————————————————————————————————————————————//
+
+    // A TrieIterator visits the keys of a trie in ascending order, comparing bytes
+    // as unsigned like std::string_view. It holds a reference to the root, so the
+    // version it walks stays alive for as long as the iterator does.
+    // Dereferencing yields the iterator itself, which exposes Key() and Value<T>().
+    class TrieIterator {
+    public:
+        // Create an end iterator.
+        TrieIterator() = default;
+
+        auto Key() const -> const std::string & { return key_; }
+
+        // Return the value of the current key, or nullptr if it is not a T.
+        template<class T>
+        auto Value() const -> const T * {
+            return Trie::GetValue<T>(stack_.back().node);
+        }
+
+        auto operator*() const -> const TrieIterator & { return *this; }
+
+        auto operator->() const -> const TrieIterator * { return this; }
+
+        auto operator++() -> TrieIterator & {
+            Advance();
+            return *this;
+        }
+
+        // End iterators are equal to each other; other iterators are equal when
+        // they are at the same node under the same key. A TrieInterner shares
+        // one node between keys, so the node alone does not tell the position.
+        bool operator==(const TrieIterator &other) const {
+            if (stack_.empty() || other.stack_.empty()) {
+                return stack_.empty() && other.stack_.empty();
+            }
+            return stack_.back().node == other.stack_.back().node && key_ == other.key_;
+        }
+
+    private:
+        friend class TrieRange;
+        friend class Trie;
+
+        // Where iteration stops: never, at the first key not less than bound_, or
+        // at the first key that does not start with bound_.
+        enum class Bound { kNone, kBelow, kPrefix };
+
+        // A node on the path to the current key.
+        struct Frame {
+            const TrieNode *node;
+            // The length of the node's key.
+            size_t key_len;
+            // The next child byte to visit, or -1 if the node's own value is next.
+            int next;
+        };
+
+        TrieIterator(std::shared_ptr<const TrieNode> root, std::string_view from, Bound kind, std::string_view bound)
+            : root_(std::move(root)), kind_(kind), bound_(bound) {
+            Seek(from);
+            Advance();
+        }
+
+        // Set up the path so that the next Advance lands on the first key not less
+        // than target. Subtrees entirely below target are never entered.
+        void Seek(std::string_view target) {
+            const TrieNode *node = root_.get();
+            if (node == nullptr) {
+                return;
+            }
+            for (;;) {
+                if (key_.size() == target.size()) {
+                    stack_.push_back({node, key_.size(), -1});
+                    return;
+                }
+                const auto b = static_cast<unsigned char>(target[key_.size()]);
+                auto [c, child] = node->children_.LowerBound(b);
+                if (child == nullptr) {
+                    stack_.push_back({node, key_.size(), 256});
+                    return;
+                }
+                const auto cb = static_cast<unsigned char>(c);
+                stack_.push_back({node, key_.size(), cb + 1});
+                if (cb > b) {
+                    PushChild(c, *child);
+                    return;
+                }
+                const std::string_view rest = target.substr(key_.size() + 1);
+                const std::string &prefix = (*child)->prefix_;
+                size_t m = 0;
+                while (m < prefix.size() && m < rest.size() && prefix[m] == rest[m]) {
+                    ++m;
+                }
+                if (m == prefix.size()) {
+                    key_ += c;
+                    key_ += prefix;
+                    node = child->get();
+                    continue;
+                }
+                if (m == rest.size() || static_cast<unsigned char>(prefix[m]) > static_cast<unsigned char>(rest[m])) {
+                    // Every key below the child is greater than target.
+                    PushChild(c, *child);
+                }
+                // Otherwise every key below the child is less than target, and the
+                // frame already skips it.
+                return;
+            }
+        }
+
+        void PushChild(char c, const TrieChildren::Child &child) {
+            key_.resize(stack_.back().key_len);
+            key_ += c;
+            key_ += child->prefix_;
+            stack_.push_back({child.get(), key_.size(), -1});
+        }
+
+        // Move to the next key in pre-order, which is ascending key order.
+        void Advance() {
+            while (!stack_.empty()) {
+                Frame &frame = stack_.back();
+                if (frame.next < 0) {
+                    frame.next = 0;
+                    if (frame.node->is_value_node_) {
+                        if (OutOfBound()) {
+                            stack_.clear();
+                        }
+                        return;
+                    }
+                }
+                auto [c, child] = frame.node->children_.LowerBound(frame.next);
+                if (child == nullptr) {
+                    stack_.pop_back();
+                    continue;
+                }
+                frame.next = static_cast<unsigned char>(c) + 1;
+                PushChild(c, *child);
+            }
+        }
+
+        auto OutOfBound() const -> bool {
+            switch (kind_) {
+                case Bound::kBelow:
+                    return !(std::string_view(key_) < bound_);
+                case Bound::kPrefix:
+                    return std::string_view(key_).substr(0, bound_.size()) != bound_;
+                default:
+                    return false;
+            }
+        }
+
+        std::shared_ptr<const TrieNode> root_;
+        std::vector<Frame> stack_;
+        std::string key_;
+        Bound kind_{Bound::kNone};
+        std::string bound_;
+    };
+
+    // A TrieRange is a range of keys of one trie version, for use in range-for.
+    class TrieRange {
+    public:
+        auto begin() const -> TrieIterator { return TrieIterator(root_, from_, kind_, bound_); }
+
+        auto end() const -> TrieIterator { return {}; }
+
+    private:
+        friend class Trie;
+
+        TrieRange(std::shared_ptr<const TrieNode> root, std::string_view from, TrieIterator::Bound kind,
+                  std::string_view bound)
+            : root_(std::move(root)), from_(from), kind_(kind), bound_(bound) {
+        }
+
+        std::shared_ptr<const TrieNode> root_;
+        std::string from_;
+        TrieIterator::Bound kind_;
+        std::string bound_;
+    };
+
+    inline auto Trie::Scan() const -> TrieRange {
+        return TrieRange(root_, "", TrieIterator::Bound::kNone, "");
+    }
+
+    inline auto Trie::ScanPrefix(std::string_view prefix) const -> TrieRange {
+        return TrieRange(root_, prefix, TrieIterator::Bound::kPrefix, prefix);
+    }
+
+    inline auto Trie::Range(std::string_view lo, std::string_view hi) const -> TrieRange {
+        return TrieRange(root_, lo, TrieIterator::Bound::kBelow, hi);
+    }
+
+    inline auto Trie::LowerBound(std::string_view key) const -> TrieIterator {
+        return TrieIterator(root_, key, TrieIterator::Bound::kNone, "");
+    }
+
+
+    //——————————————————————————————————TrieChange——————————————————————————————————————————————————————————————————//
+
+    // A TrieChange is one key that differs between two tries, see Trie::Diff. It
+    // keeps the nodes of the key alive, so its values stay readable.
+    struct TrieChange {
+        enum class Kind { kInserted, kRemoved, kChanged };
+
+        Kind kind;
+        std::string key;
+        // The node of key in the older and in the newer trie; null where the key
+        // is absent.
+        std::shared_ptr<const TrieNode> before;
+        std::shared_ptr<const TrieNode> after;
+
+        // The value before the change, or nullptr if there was none or it is not
+        // a T.
+        template<class T>
+        auto Before() const -> const T * { return Trie::GetValue<T>(before.get()); }
+
+        // The value after the change, or nullptr if there is none or it is not a T.
+        template<class T>
+        auto After() const -> const T * { return Trie::GetValue<T>(after.get()); }
+    };
+
+    // A position in a trie: the node slot and how much of the node's prefix has
+    // been consumed. The two tries of a diff may compress a path differently, so
+    // they are walked a byte at a time and compared position by position.
+    struct Trie::DiffCursor {
+        const std::shared_ptr<const TrieNode> *slot{nullptr};
+        size_t offset{0};
+
+        auto Node() const -> const TrieNode * { return slot == nullptr ? nullptr : slot->get(); }
+
+        // The value node at this position, or nullptr.
+        auto Value() const -> const std::shared_ptr<const TrieNode> * {
+            const TrieNode *node = Node();
+            return node != nullptr && offset == node->prefix_.size() && node->is_value_node_ ? slot : nullptr;
+        }
+
+        // The first child position reached by a byte of at least from, with that
+        // byte, or 256 if there is none.
+        auto Next(int from) const -> std::pair<int, DiffCursor> {
+            const TrieNode *node = Node();
+            if (node == nullptr) {
+                return {256, {}};
+            }
+            if (offset < node->prefix_.size()) {
+                const int b = static_cast<unsigned char>(node->prefix_[offset]);
+                if (b < from) {
+                    return {256, {}};
+                }
+                return {b, {slot, offset + 1}};
+            }
+            auto [c, child] = node->children_.LowerBound(from);
+            if (child == nullptr) {
+                return {256, {}};
+            }
+            return {static_cast<unsigned char>(c), {child, 0}};
+        }
+    };
+
+    inline void Trie::DiffNodes(DiffCursor older, DiffCursor newer, std::string &key, std::vector<TrieChange> &out) {
+        // Compare the values at two positions, and return whether what lies below
+        // them has to be compared too.
+        auto visit = [&key, &out](DiffCursor a, DiffCursor b) -> bool {
+            if (a.Node() == b.Node() && a.offset == b.offset) {
+                return false; // 共享的子树，没有差异
+            }
+            const auto *before = a.Value();
+            const auto *after = b.Value();
+            if (before != nullptr && after != nullptr) {
+                const TrieNode &x = **before;
+                const TrieNode &y = **after;
+                if (x.type_ != y.type_ || !x.type_->same(x, y)) {
+                    out.push_back({TrieChange::Kind::kChanged, key, *before, *after});
+                }
+            } else if (before != nullptr) {
+                out.push_back({TrieChange::Kind::kRemoved, key, *before, nullptr});
+            } else if (after != nullptr) {
+                out.push_back({TrieChange::Kind::kInserted, key, nullptr, *after});
+            }
+            return true;
+        };
+
+        // The positions on the path to key whose children are being compared,
+        // each with the smallest byte not compared yet. The walk keeps them on
+        // the heap, as a key may be far longer than the call stack is deep.
+        struct Frame {
+            DiffCursor older;
+            DiffCursor newer;
+            int from;
+        };
+        if (!visit(older, newer)) return;
+        std::vector<Frame> path{{older, newer, 0}};
+        while (true) {
+            Frame &top = path.back();
+            auto [a, older_child] = top.older.Next(top.from);
+            auto [b, newer_child] = top.newer.Next(top.from);
+            const int c = std::min(a, b);
+            if (c == 256) {
+                path.pop_back();
+                if (path.empty()) break;
+                key.pop_back();
+                continue;
+            }
+            top.from = c + 1;
+            key.push_back(static_cast<char>(c));
+            const DiffCursor next_older = a == c ? older_child : DiffCursor{};
+            const DiffCursor next_newer = b == c ? newer_child : DiffCursor{};
+            if (visit(next_older, next_newer)) {
+                path.push_back({next_older, next_newer, 0});
+            } else {
+                key.pop_back();
+            }
+        }
+    }
+
+    inline auto Trie::Diff(const Trie &newer) const -> std::vector<TrieChange> {
+        std::vector<TrieChange> changes;
+        std::string key;
+        DiffNodes({&root_, 0}, {&newer.root_, 0}, key, changes);
+        return changes;
+    }
+
+    //——————————————————————————————————TrieMemory——————————————————————————————————————————————————————————————————//
+
+    // TrieMemory is what some tries take: a trie, or a range of versions of a
+    // store. Tries share subtrees, so besides the totals it splits the bytes into
+    // unique ones, held only through the measured tries and freed when they are
+    // dropped, and shared ones, also held by other tries or by value guards.
+    // A node is unique if every reference to it (its shared_ptr use count) is from
+    // a measured trie or a unique parent; a shared value is unique if every
+    // reference is from a unique node. Sizes are estimates that leave out
+    // allocator overhead, and use counts read while other threads copy nodes are
+    // only a snapshot.
+    struct TrieMemory {
+        size_t nodes{0};
+        size_t value_nodes{0};
+        // Node objects and their control blocks, including values stored inline.
+        size_t node_bytes{0};
+        // Values stored outside their node, each counted once however many nodes
+        // share it.
+        size_t value_bytes{0};
+        // Child tables and key prefixes too large to fit in their node.
+        size_t map_bytes{0};
+        // Versions of a store kept as FrozenTries, see FrozenTrie::Bytes.
+        size_t frozen_bytes{0};
+        // Bytes() split by whether dropping the measured tries would free them.
+        size_t unique_bytes{0};
+        size_t shared_bytes{0};
+
+        auto Bytes() const -> size_t { return node_bytes + value_bytes + map_bytes + frozen_bytes; }
+
+    private:
+        friend class Trie;
+        friend class TrieStore;
+
+        // How often a node or value is referenced, and how many of those references
+        // come from the measured tries and unique nodes.
+        struct Refs {
+            long use_count;
+            long unique{0};
+        };
+
+        // Measure the nodes reachable from tries, where every entry is one
+        // reference to its root.
+        static auto Measure(const std::vector<const Trie *> &tries) -> TrieMemory {
+            std::unordered_map<const TrieNode *, Refs> nodes;
+            std::vector<const TrieNode *> order;
+            for (const Trie *trie: tries) {
+                if (trie->root_ == nullptr) continue;
+                auto [it, fresh] = nodes.try_emplace(trie->root_.get(), Refs{trie->root_.use_count()});
+                it->second.unique++;
+                if (fresh) {
+                    Visit(*trie->root_, nodes, order);
+                }
+            }
+
+            // Parents come before their children in reverse post-order, so whether
+            // a node is unique is known before its children are looked at.
+            TrieMemory memory;
+            std::unordered_map<const void *, Refs> values;
+            std::vector<std::pair<const void *, size_t> > value_sizes;
+            for (auto it = order.rbegin(); it != order.rend(); ++it) {
+                const TrieNode &node = **it;
+                const Refs &refs = nodes.at(&node);
+                const bool unique = refs.unique == refs.use_count;
+                const TrieNodeMemory measured = node.type_->memory(node);
+                const size_t map_bytes = node.children_.HeapBytes() + StringHeapBytes(node.prefix_);
+                size_t bytes = measured.node_bytes + kSharedControlBytes + map_bytes;
+                memory.nodes++;
+                memory.value_nodes += node.is_value_node_ ? 1 : 0;
+                memory.node_bytes += measured.node_bytes + kSharedControlBytes;
+                memory.map_bytes += map_bytes;
+                if (measured.value_block == nullptr) {
+                    memory.value_bytes += measured.value_bytes;
+                    bytes += measured.value_bytes;
+                } else {
+                    auto [value, fresh] = values.try_emplace(measured.value_block, Refs{measured.value_use_count});
+                    if (fresh) {
+                        memory.value_bytes += measured.value_bytes;
+                        value_sizes.emplace_back(measured.value_block, measured.value_bytes);
+                    }
+                    value->second.unique += unique ? 1 : 0;
+                }
+                (unique ? memory.unique_bytes : memory.shared_bytes) += bytes;
+                if (unique) {
+                    node.children_.ForEach([&](char, const TrieChildren::Child &child) {
+                        nodes.at(child.get()).unique++;
+                    });
+                }
+            }
+            for (const auto &[block, bytes]: value_sizes) {
+                const Refs &refs = values.at(block);
+                (refs.unique == refs.use_count ? memory.unique_bytes : memory.shared_bytes) += bytes;
+            }
+            return memory;
+        }
+
+        // Add the nodes below node that are not in nodes yet, each after its
+        // children.
+        static void Visit(const TrieNode &node, std::unordered_map<const TrieNode *, Refs> &nodes,
+                          std::vector<const TrieNode *> &order) {
+            node.children_.ForEach([&](char, const TrieChildren::Child &child) {
+                if (nodes.try_emplace(child.get(), Refs{child.use_count()}).second) {
+                    Visit(*child, nodes, order);
+                }
+            });
+            order.push_back(&node);
+        }
+    };
+
+    inline auto Trie::Memory() const -> TrieMemory {
+        return TrieMemory::Measure({this});
+    }
+
+    //——————————————————————————————————FrozenTrie——————————————————————————————————————————————————————————————————//
+
+    // A FrozenTrie is a read-only copy of a Trie without pointers or reference
+    // counts. Nodes are numbered in level order, so the children of node n are
+    // the nodes first_child_[n] to first_child_[n + 1] - 1, and a node is a few
+    // array entries: where its children and prefix start, the byte leading to it
+    // and its value. Values stay typed and answer Get<T> like a Trie; see
+    // FrozenTrieValues for how they are kept.
+    // A frozen copy shares no nodes with the trie it came from or with other
+    // frozen copies, and nodes shared within one trie (see TrieInterner) are
+    // copied once for every path to them. It saves memory for tries that are
+    // mostly unlike the ones they share nodes with, not for versions that differ
+    // in a few keys.
+    class FrozenTrie {
+    public:
+        // Create an empty FrozenTrie.
+        FrozenTrie() = default;
+
+        explicit FrozenTrie(const Trie &trie) {
+            if (trie.root_ == nullptr) return;
+            std::vector<const TrieNode *> level_order{trie.root_.get()};
+            labels_.push_back(0);
+            for (size_t n = 0; n < level_order.size(); ++n) {
+                const TrieNode &node = *level_order[n];
+                first_child_.push_back(Index(level_order.size()));
+                prefix_start_.push_back(Index(prefixes_.size()));
+                prefixes_ += node.prefix_;
+                if (node.is_value_node_) {
+                    value_.push_back(Index(values_.size()));
+                    values_.push_back({node.type_, node.type_->freeze(node, store_)});
+                } else {
+                    value_.push_back(kNone);
+                }
+                node.children_.ForEach([&](char c, const TrieChildren::Child &child) {
+                    labels_.push_back(static_cast<unsigned char>(c));
+                    level_order.push_back(child.get());
+                });
+            }
+            first_child_.push_back(Index(level_order.size()));
+            prefix_start_.push_back(Index(prefixes_.size()));
+            prefixes_.shrink_to_fit();
+            values_.shrink_to_fit();
+            store_.ShrinkToFit();
+        }
+
+        // Same as Trie::Get. The value lives as long as the FrozenTrie.
+        template<class T>
+        auto Get(std::string_view key) const -> const T * {
+            const uint32_t node = Find(key);
+            if (node == kNone || value_[node] == kNone) return nullptr;
+            const Value &value = values_[value_[node]];
+            if (value.type != &TrieNodeWithValue<T>::kType) return nullptr;
+            return TrieValueHolder<T>::Frozen(store_, value.index);
+        }
+
+        // Whether key has a value of any type.
+        auto Contains(std::string_view key) const -> bool {
+            const uint32_t node = Find(key);
+            return node != kNone && value_[node] != kNone;
+        }
+
+        // The number of keys.
+        auto Size() const -> size_t { return values_.size(); }
+
+        // The bytes of the arrays, leaving out shared values.
+        auto Bytes() const -> size_t {
+            return sizeof(FrozenTrie) + (first_child_.capacity() + prefix_start_.capacity() + value_.capacity()) *
+                                       sizeof(uint32_t) + labels_.capacity() + prefixes_.capacity() +
+                   values_.capacity() * sizeof(Value) + store_.Bytes();
+        }
+
+        // Return an ordinary Trie with the same content, allocated from resource.
+        auto Thaw(std::pmr::memory_resource *resource = std::pmr::get_default_resource()) const -> Trie {
+            if (labels_.empty()) return Trie(resource);
+            std::vector<std::shared_ptr<const TrieNode> > built(labels_.size());
+            // Children come after their parents, so they are built first.
+            for (size_t n = labels_.size(); n-- > 0;) {
+                TrieChildren children;
+                for (uint32_t child = first_child_[n]; child < first_child_[n + 1]; ++child) {
+                    children.Set(static_cast<char>(labels_[child]), std::move(built[child]), resource);
+                }
+                std::shared_ptr<TrieNode> node;
+                if (value_[n] == kNone) {
+                    node = AllocateShared<TrieNode>(resource, std::move(children));
+                } else {
+                    const Value &value = values_[value_[n]];
+                    node = value.type->thaw(store_, value.index, std::move(children), resource);
+                }
+                node->prefix_.assign(prefixes_, prefix_start_[n], prefix_start_[n + 1] - prefix_start_[n]);
+                built[n] = std::move(node);
+            }
+            return Trie(std::move(built[0]), resource);
+        }
+
+    private:
+        static constexpr uint32_t kNone = UINT32_MAX;
+
+        struct Value {
+            const TrieNodeType *type;
+            uint32_t index;
+        };
+
+        static auto Index(size_t index) -> uint32_t {
+            if (index >= kNone) {
+                throw std::length_error("FrozenTrie: the trie is too large");
+            }
+            return static_cast<uint32_t>(index);
+        }
+
+        // Return the node of key, or kNone.
+        auto Find(std::string_view key) const -> uint32_t {
+            if (labels_.empty()) return kNone;
+            uint32_t node = 0;
+            size_t i = 0;
+            while (true) {
+                const std::string_view prefix(prefixes_.data() + prefix_start_[node],
+                                              prefix_start_[node + 1] - prefix_start_[node]);
+                if (key.substr(i, prefix.size()) != prefix) return kNone;
+                i += prefix.size();
+                if (i == key.size()) return node;
+                const auto first = labels_.begin() + first_child_[node];
+                const auto last = labels_.begin() + first_child_[node + 1];
+                const auto b = static_cast<unsigned char>(key[i++]);
+                const auto it = std::lower_bound(first, last, b);
+                if (it == last || *it != b) return kNone;
+                node = static_cast<uint32_t>(it - labels_.begin());
+            }
+        }
+
+        // Indexed by node, with one more entry at the end for the last node.
+        std::vector<uint32_t> first_child_;
+        std::vector<uint32_t> prefix_start_;
+        // Indexed by node: the byte leading to it, and its entry in values_.
+        std::vector<unsigned char> labels_;
+        std::vector<uint32_t> value_;
+        std::string prefixes_;
+        std::vector<Value> values_;
+        FrozenTrieValues store_;
+    };
+
+    inline auto Trie::Freeze() const -> FrozenTrie {
+        return FrozenTrie(*this);
+    }
+
+
+    //——————————————————————————————————TrieInterner————————————————————————————————————————————————————————————————//
+
+    // A TrieInterner hash-conses trie nodes: Intern returns a trie in which every
+    // node that is structurally equal to one interned before is replaced by that
+    // node. Two nodes are equal when they have the same prefix, the same kind of
+    // value and a same value (see TrieNodeType::same), and the same child
+    // pointers, so equal subtrees collapse into one and a trie becomes a DAG, like
+    // a minimal acyclic automaton. Tries stay immutable, so sharing a node between
+    // parents is as safe as sharing it between versions.
+    // The table holds weak references and never keeps a node alive. Entries of
+    // destroyed nodes are dropped when their bucket is searched, and the whole
+    // table is swept each time it has grown by half since the last sweep. Even an
+    // expired weak_ptr holds the block of a node made by allocate_shared, so
+    // call Purge after dropping many tries.
+    // Tries interned together must use resources that outlive all of them,
+    // since their nodes end up mixed. Thread-safe.
+    class TrieInterner {
+    public:
+        TrieInterner() = default;
+
+        TrieInterner(const TrieInterner &) = delete;
+
+        auto operator=(const TrieInterner &) -> TrieInterner & = delete;
+
+        // Return trie with its nodes interned. Nodes already in the table are
+        // found by identity, so interning a new version of an interned trie
+        // visits only the nodes the new version created.
+        auto Intern(const Trie &trie) -> Trie {
+            if (!trie.root_) {
+                return trie;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto root = InternNode(trie.root_, trie.resource_);
+            if (inserted_ * 2 > last_swept_ && inserted_ > kMinSweep) {
+                Sweep();
+            }
+            return Trie(std::move(root), trie.resource_);
+        }
+
+        // Drop the entries of destroyed nodes.
+        void Purge() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            Sweep();
+        }
+
+        // The number of entries, including any not yet purged.
+        auto Size() const -> size_t {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return table_.size();
+        }
+
+    private:
+        static constexpr size_t kMinSweep = 1024;
+
+        auto InternNode(const std::shared_ptr<const TrieNode> &node, std::pmr::memory_resource *resource)
+            -> std::shared_ptr<const TrieNode> {
+            const size_t hash = Hash(*node);
+            if (auto found = Find(hash, [&](const TrieNode &entry) { return &entry == node.get(); })) {
+                return found;
+            }
+            TrieChildren children;
+            bool changed = false;
+            node->children_.ForEach([&](char c, const TrieChildren::Child &child) {
+                auto interned = InternNode(child, resource);
+                changed |= interned != child;
+                children.Set(c, std::move(interned), resource);
+            });
+            std::shared_ptr<const TrieNode> candidate = node;
+            size_t candidate_hash = hash;
+            if (changed) {
+                std::shared_ptr<TrieNode> copy = node->Clone(resource);
+                copy->children_ = std::move(children);
+                candidate_hash = Hash(*copy);
+                candidate = std::move(copy);
+            }
+            if (auto found = Find(candidate_hash, [&](const TrieNode &entry) { return Equal(entry, *candidate); })) {
+                return found;
+            }
+            table_.emplace(candidate_hash, candidate);
+            ++inserted_;
+            return candidate;
+        }
+
+        // Return the live entry of bucket hash that match accepts, dropping the
+        // expired entries of the bucket on the way.
+        template<class Match>
+        auto Find(size_t hash, Match &&match) -> std::shared_ptr<const TrieNode> {
+            auto [it, end] = table_.equal_range(hash);
+            while (it != end) {
+                auto entry = it->second.lock();
+                if (!entry) {
+                    it = table_.erase(it);
+                    continue;
+                }
+                if (match(*entry)) {
+                    return entry;
+                }
+                ++it;
+            }
+            return nullptr;
+        }
+
+        void Sweep() {
+            std::erase_if(table_, [](const auto &entry) { return entry.second.expired(); });
+            last_swept_ = table_.size();
+            inserted_ = 0;
+        }
+
+        static auto Hash(const TrieNode &node) -> size_t {
+            size_t hash = std::hash<std::string_view>{}(node.prefix_);
+            const auto mix = [&hash](size_t value) { hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2); };
+            mix(std::hash<const void *>{}(node.type_));
+            if (node.is_value_node_) {
+                mix(node.type_->hash(node));
+            }
+            node.children_.ForEach([&](char c, const TrieChildren::Child &child) {
+                mix(static_cast<unsigned char>(c));
+                mix(std::hash<const void *>{}(child.get()));
+            });
+            return hash;
+        }
+
+        static auto Equal(const TrieNode &a, const TrieNode &b) -> bool {
+            if (a.type_ != b.type_ || a.is_value_node_ != b.is_value_node_ || a.prefix_ != b.prefix_ ||
+                a.children_.Size() != b.children_.Size() || (a.is_value_node_ && !a.type_->same(a, b))) {
+                return false;
+            }
+            bool equal = true;
+            a.children_.ForEach([&](char c, const TrieChildren::Child &child) {
+                const auto *other = b.children_.Find(c);
+                equal = equal && other != nullptr && *other == child;
+            });
+            return equal;
+        }
+
+        mutable std::mutex mutex_;
+        std::unordered_multimap<size_t, std::weak_ptr<const TrieNode> > table_;
+        // Entries added since the last sweep, and the size of the table after it.
+        size_t inserted_{0};
+        size_t last_swept_{0};
+    };
+
+
+    //——————————————————————————————————TrieBuilder——————————————————————————————————————————————————————————————————//
+
+    // A TrieBuilder builds a Trie bottom-up from keys added in strictly ascending
+    // order (comparing bytes as unsigned, like std::string_view). Only the path of
+    // the last key is open for changes; every other node is finished, so each
+    // node is allocated once and nothing is cloned. Use it to bulk load a sorted
+    // dump; use a TransientTrie for unordered input.
+    class TrieBuilder {
+    public:
+        explicit TrieBuilder(std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+            : resource_(resource) {
+            open_.push_back({0, AllocateShared<TrieNode>(resource_)});
+        }
+
+        // Add the next key. Throws std::invalid_argument unless key is greater than
+        // the previous one.
+        template<class T>
+        void Add(std::string_view key, T value) {
+            if (has_key_ && !(std::string_view(last_key_) < key)) {
+                throw std::invalid_argument("TrieBuilder keys must be strictly ascending");
+            }
+            auto node = AllocateShared<TrieNodeWithValue<T> >(resource_, std::in_place, TrieChildren(),
+                                                              std::move(value), resource_);
+            if (!has_key_ && key.empty()) {
+                open_.back().node = std::move(node);
+                has_key_ = true;
+                return;
+            }
+            size_t common = 0;
+            while (common < last_key_.size() && common < key.size() && last_key_[common] == key[common]) {
+                ++common;
+            }
+            CloseBelow(common);
+            open_.push_back({key.size(), std::move(node)});
+            last_key_ = key;
+            has_key_ = true;
+        }
+
+        // Finish every open node and return the trie. The builder is empty after.
+        auto Build() -> Trie {
+            CloseBelow(0);
+            std::shared_ptr<TrieNode> root = std::move(open_.back().node);
+            open_.back().node = AllocateShared<TrieNode>(resource_);
+            last_key_.clear();
+            has_key_ = false;
+            if (root->children_.Empty() && !root->is_value_node_) {
+                return Trie(resource_);
+            }
+            return Trie(std::move(root), resource_);
+        }
+
+    private:
+        // A node on the path of the last key, which may still get children.
+        struct OpenNode {
+            // The length of the node's key, a prefix of last_key_.
+            size_t depth;
+            std::shared_ptr<TrieNode> node;
+        };
+
+        // Finish the open nodes deeper than depth, leaving one at exactly depth on
+        // top. A branch node is created there if the last key had none.
+        void CloseBelow(size_t depth) {
+            std::shared_ptr<TrieNode> closed;
+            size_t closed_depth = 0;
+            while (open_.back().depth > depth) {
+                OpenNode top = std::move(open_.back());
+                open_.pop_back();
+                if (closed) {
+                    Attach(*top.node, top.depth, std::move(closed), closed_depth);
+                }
+                closed = std::move(top.node);
+                closed_depth = top.depth;
+            }
+            if (!closed) {
+                return;
+            }
+            if (open_.back().depth < depth) {
+                open_.push_back({depth, AllocateShared<TrieNode>(resource_)});
+            }
+            Attach(*open_.back().node, open_.back().depth, std::move(closed), closed_depth);
+        }
+
+        // Make child, the node of last_key_[0, child_depth), a child of parent.
+        void Attach(TrieNode &parent, size_t parent_depth, std::shared_ptr<TrieNode> child, size_t child_depth) {
+            child->prefix_ = last_key_.substr(parent_depth + 1, child_depth - parent_depth - 1);
+            parent.children_.Set(last_key_[parent_depth], std::move(child), resource_);
+        }
+
+        std::pmr::memory_resource *resource_;
+        // The path of the last key, from the root down.
+        std::vector<OpenNode> open_;
+        std::string last_key_;
+        bool has_key_{false};
+    };
+
+
+    //——————————————————————————————————TrieImage—————————————————————————————————————————————————————————————————————//
+
+    // TrieImage is the on-disk form of a trie: one flat buffer in which nodes refer
+    // to each other by offset, so that a MappedTrie can query it where it lies.
+    // Integers are in host byte order, which the header records. Layout:
+    //   header  magic "SJTUTRIE", u32 format, u32 byte-order mark, u64 root offset
+    //           (0 for an empty trie), u64 image size
+    //   node    8-byte aligned: u32 prefix length, u32 value length, u32 codec id
+    //           (0 without a value), u16 child count, u16 unused, then the u64
+    //           child offsets, the child bytes in ascending order, the prefix,
+    //           padding to 8 bytes, and the value as its TrieCodec encodes it.
+    // Children are written before their parent.
+    class TrieImage {
+    public:
+        // Return the image of trie. Throws std::runtime_error if a value type
+        // has no TrieCodec.
+        static auto Encode(const Trie &trie) -> std::string {
+            std::string out(sizeof(Header), '\0');
+            Header header;
+            std::unordered_map<const TrieNode *, uint64_t> written;
+            header.root = trie.root_ ? WriteNode(*trie.root_, written, out) : 0;
+            header.size = out.size();
+            std::memcpy(out.data(), &header, sizeof(Header));
+            return out;
+        }
+
+        // Write the image of trie to the file at path. Throws std::runtime_error
+        // if that fails.
+        static void Save(const Trie &trie, const std::string &path) {
+            const std::string image = Encode(trie);
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            file.write(image.data(), static_cast<std::streamsize>(image.size()));
+            if (!file.flush()) {
+                throw std::runtime_error("TrieImage: cannot write " + path);
+            }
+        }
+
+    private:
+        friend class MappedTrie;
+
+        static constexpr char kMagic[8] = {'S', 'J', 'T', 'U', 'T', 'R', 'I', 'E'};
+        static constexpr uint32_t kFormat = 1;
+        static constexpr uint32_t kByteOrder = 0x01020304;
+
+        struct Header {
+            char magic[8]{'S', 'J', 'T', 'U', 'T', 'R', 'I', 'E'};
+            uint32_t format{kFormat};
+            uint32_t byte_order{kByteOrder};
+            uint64_t root{0};
+            uint64_t size{0};
+        };
+
+        struct Node {
+            uint32_t prefix_len;
+            uint32_t value_len;
+            uint32_t codec;
+            uint16_t child_count;
+            uint16_t unused;
+        };
+
+        static void Align(std::string &out) {
+            out.resize((out.size() + 7) & ~static_cast<size_t>(7), '\0');
+        }
+
+        // Append node and everything below it, returning the offset of node. A
+        // node shared within the trie is written once.
+        static auto WriteNode(const TrieNode &node, std::unordered_map<const TrieNode *, uint64_t> &written,
+                              std::string &out) -> uint64_t {
+            if (auto it = written.find(&node); it != written.end()) {
+                return it->second;
+            }
+            std::vector<uint64_t> offsets;
+            std::string bytes;
+            node.children_.ForEach([&](char c, const TrieChildren::Child &child) {
+                offsets.push_back(WriteNode(*child, written, out));
+                bytes += c;
+            });
+            std::string value;
+            const uint32_t codec = node.type_->encode != nullptr ? node.type_->encode(node, value) : 0;
+
+            Align(out);
+            const uint64_t offset = out.size();
+            const Node header{static_cast<uint32_t>(node.prefix_.size()), static_cast<uint32_t>(value.size()),
+                              codec, static_cast<uint16_t>(offsets.size()), 0};
+            out.append(reinterpret_cast<const char *>(&header), sizeof(Node));
+            out.append(reinterpret_cast<const char *>(offsets.data()), offsets.size() * sizeof(uint64_t));
+            out += bytes;
+            out += node.prefix_;
+            Align(out);
+            out += value;
+            written.emplace(&node, offset);
+            return offset;
+        }
+    };
+
+    //——————————————————————————————————MappedTrie————————————————————————————————————————————————————————————————————//
+
+    // A MappedTrie answers queries straight from a TrieImage without building any
+    // nodes; Get and GetBytes allocate nothing. An image opened from a file is
+    // mapped read-only, so processes that open the same file share one
+    // page-cached copy. A MappedTrie is immutable and safe to share between
+    // threads; layer writes over it with a LayeredTrie.
+    class MappedTrie {
+    public:
+        // Map the image in the file at path. Throws std::runtime_error if the file
+        // cannot be read or does not hold an image.
+        static auto Open(const std::string &path) -> MappedTrie {
+            MappedTrie trie;
+#ifdef SJTU_TRIE_POSIX
+            const int fd = ::open(path.c_str(), O_RDONLY);
+            struct stat st{};
+            if (fd < 0 || ::fstat(fd, &st) != 0) {
+                if (fd >= 0) ::close(fd);
+                throw std::runtime_error("MappedTrie: cannot open " + path);
+            }
+            const auto size = static_cast<size_t>(st.st_size);
+            void *mapping = size == 0 ? MAP_FAILED : ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (mapping == MAP_FAILED) {
+                throw std::runtime_error("MappedTrie: cannot map " + path);
+            }
+            trie.data_ = static_cast<const char *>(mapping);
+            trie.size_ = size;
+            trie.mapped_ = true;
+#else
+            std::ifstream file(path, std::ios::binary);
+            trie.owned_.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            if (!file.good() && !file.eof()) {
+                throw std::runtime_error("MappedTrie: cannot read " + path);
+            }
+            trie.data_ = trie.owned_.data();
+            trie.size_ = trie.owned_.size();
+#endif
+            trie.Validate();
+            return trie;
+        }
+
+        // Use an image in memory, for example one from TrieImage::Encode. It must
+        // be 8-byte aligned and outlive the MappedTrie.
+        static auto View(std::string_view image) -> MappedTrie {
+            if (reinterpret_cast<uintptr_t>(image.data()) % 8 != 0) {
+                throw std::invalid_argument("MappedTrie: image is not 8-byte aligned");
+            }
+            MappedTrie trie;
+            trie.data_ = image.data();
+            trie.size_ = image.size();
+            trie.Validate();
+            return trie;
+        }
+
+        MappedTrie(MappedTrie &&other) noexcept
+            : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)),
+              mapped_(std::exchange(other.mapped_, false)), root_(std::exchange(other.root_, nullptr)) {
+#ifndef SJTU_TRIE_POSIX
+            // Moving a vector keeps its buffer, so data_ and root_ stay valid.
+            owned_ = std::move(other.owned_);
+#endif
+        }
+
+        MappedTrie(const MappedTrie &) = delete;
+
+        auto operator=(const MappedTrie &) -> MappedTrie & = delete;
+
+        ~MappedTrie() { Unmap(); }
+
+        // Return the value of key in place, or nullptr if the key is missing or
+        // does not hold a T. Only for types whose codec has View.
+        template<class T>
+        auto Get(std::string_view key) const -> const T * {
+            static_assert(kViewableTrieCodec<T>, "TrieCodec<T> cannot view values in place, use Load");
+            auto bytes = GetBytes<T>(key);
+            return bytes ? TrieCodec<T>::View(*bytes) : nullptr;
+        }
+
+        // Return the encoded bytes of the value of key, if it holds a T. For a
+        // std::string these are its characters.
+        template<class T>
+        auto GetBytes(std::string_view key) const -> std::optional<std::string_view> {
+            const TrieImage::Node *node = FindNode(key);
+            if (node == nullptr || node->codec != TrieCodec<T>::kId) {
+                return std::nullopt;
+            }
+            return ValueOf(node);
+        }
+
+        // Return a decoded copy of the value of key, if it holds a T.
+        template<class T>
+        auto Load(std::string_view key) const -> std::optional<T> {
+            auto bytes = GetBytes<T>(key);
+            if (!bytes) return std::nullopt;
+            return TrieCodec<T>::Decode(*bytes);
+        }
+
+        // Whether key has a value of any type.
+        auto Contains(std::string_view key) const -> bool { return FindNode(key) != nullptr; }
+
+    private:
+        MappedTrie() = default;
+
+        void Validate() {
+            TrieImage::Header header;
+            if (size_ < sizeof(header)) {
+                throw std::runtime_error("MappedTrie: not a trie image");
+            }
+            std::memcpy(&header, data_, sizeof(header));
+            if (std::memcmp(header.magic, TrieImage::kMagic, sizeof(header.magic)) != 0 ||
+                header.format != TrieImage::kFormat || header.size != size_) {
+                throw std::runtime_error("MappedTrie: not a trie image");
+            }
+            if (header.byte_order != TrieImage::kByteOrder) {
+                throw std::runtime_error("MappedTrie: image has a different byte order");
+            }
+            root_ = header.root == 0 ? nullptr : NodeAt(header.root);
+        }
+
+        void Unmap() {
+#ifdef SJTU_TRIE_POSIX
+            if (mapped_) {
+                ::munmap(const_cast<char *>(data_), size_);
+                mapped_ = false;
+            }
+#endif
+        }
+
+        // Return the node at offset, checking that all of it lies in the image.
+        auto NodeAt(uint64_t offset) const -> const TrieImage::Node * {
+            if (offset % 8 != 0 || offset > size_ || size_ - offset < sizeof(TrieImage::Node)) {
+                throw std::runtime_error("MappedTrie: corrupt image");
+            }
+            const auto *node = std::launder(reinterpret_cast<const TrieImage::Node *>(data_ + offset));
+            const uint64_t end = ValueOffset(node) - offset + node->value_len;
+            if (size_ - offset < end) {
+                throw std::runtime_error("MappedTrie: corrupt image");
+            }
+            return node;
+        }
+
+        auto Offsets(const TrieImage::Node *node) const -> const uint64_t * {
+            return std::launder(reinterpret_cast<const uint64_t *>(node + 1));
+        }
+
+        auto Bytes(const TrieImage::Node *node) const -> const unsigned char * {
+            return reinterpret_cast<const unsigned char *>(Offsets(node) + node->child_count);
+        }
+
+        auto Prefix(const TrieImage::Node *node) const -> std::string_view {
+            return {reinterpret_cast<const char *>(Bytes(node) + node->child_count), node->prefix_len};
+        }
+
+        auto ValueOffset(const TrieImage::Node *node) const -> uint64_t {
+            const auto *prefix_end = reinterpret_cast<const char *>(node + 1) + node->child_count * 9 + node->prefix_len;
+            return (static_cast<uint64_t>(prefix_end - data_) + 7) & ~static_cast<uint64_t>(7);
+        }
+
+        auto ValueOf(const TrieImage::Node *node) const -> std::string_view {
+            return {data_ + ValueOffset(node), node->value_len};
+        }
+
+        // Return the node of key if it has a value.
+        auto FindNode(std::string_view key) const -> const TrieImage::Node * {
+            const TrieImage::Node *node = root_;
+            size_t i = 0;
+            while (node != nullptr && i < key.size()) {
+                const unsigned char *bytes = Bytes(node);
+                const auto c = static_cast<unsigned char>(key[i++]);
+                const unsigned char *it = std::lower_bound(bytes, bytes + node->child_count, c);
+                if (it == bytes + node->child_count || *it != c) {
+                    return nullptr;
+                }
+                node = NodeAt(Offsets(node)[it - bytes]);
+                const std::string_view prefix = Prefix(node);
+                if (key.substr(i, prefix.size()) != prefix) {
+                    return nullptr;
+                }
+                i += prefix.size();
+            }
+            return node != nullptr && node->codec != 0 ? node : nullptr;
+        }
+
+        const char *data_{nullptr};
+        size_t size_{0};
+        bool mapped_{false};
+        const TrieImage::Node *root_{nullptr};
+#ifndef SJTU_TRIE_POSIX
+        std::vector<char> owned_;
+#endif
+    };
+
+    //——————————————————————————————————LayeredTrie———————————————————————————————————————————————————————————————————//
+
+    // A LayeredTrie is a MappedTrie base with changes in an ordinary Trie on top.
+    // Puts copy only overlay nodes and removals leave a tombstone in the overlay,
+    // so the base is never touched, and a LayeredTrie is as cheap to copy and to
+    // keep old versions of as a Trie.
+    class LayeredTrie {
+    public:
+        explicit LayeredTrie(std::shared_ptr<const MappedTrie> base,
+                             std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+            : base_(std::move(base)), overlay_(resource) {
+        }
+
+        // Same as Trie::Get; values still in the base are read in place, which
+        // needs a codec with View.
+        template<class T>
+        auto Get(std::string_view key) const -> const T * {
+            static_assert(kViewableTrieCodec<T>, "TrieCodec<T> cannot view values in place, use Load");
+            if (InOverlay(key)) {
+                return overlay_.Get<T>(key);
+            }
+            return base_->Get<T>(key);
+        }
+
+        // Return a copy of the value of key, if it holds a T.
+        template<class T>
+        auto Load(std::string_view key) const -> std::optional<T> {
+            if (InOverlay(key)) {
+                const T *value = overlay_.Get<T>(key);
+                return value != nullptr ? std::optional<T>(*value) : std::nullopt;
+            }
+            return base_->Load<T>(key);
+        }
+
+        template<class T>
+        auto Put(std::string_view key, T value) const -> LayeredTrie {
+            return LayeredTrie(base_, overlay_.Put<T>(key, std::move(value)));
+        }
+
+        auto Remove(std::string_view key) const -> LayeredTrie {
+            return LayeredTrie(base_, overlay_.Put<Tombstone>(key, Tombstone{}));
+        }
+
+        // The changes made on top of the base, with removed keys holding
+        // tombstones.
+        auto Overlay() const -> const Trie & { return overlay_; }
+
+    private:
+        struct Tombstone {
+        };
+
+        // Whether the overlay decides key, with a value of any type or a tombstone.
+        auto InOverlay(std::string_view key) const -> bool {
+            const TrieNode *node = Trie::FindNode(overlay_.root_, key);
+            return node != nullptr && node->is_value_node_;
+        }
+
+        LayeredTrie(std::shared_ptr<const MappedTrie> base, Trie overlay)
+            : base_(std::move(base)), overlay_(std::move(overlay)) {
+        }
+
+        std::shared_ptr<const MappedTrie> base_;
+        Trie overlay_;
+    };
+
+
+    //——————————————————————————————————ValueGuard————————————————————————————————————————————————————————————————————//
+
+    // This class is used to guard the value returned by the trie. It holds a
+    // reference to what owns the value, the root, only the node of the key or a
+    // FrozenTrie, so that the reference to the value will not be invalidated.
+    template<class T>
+    class ValueGuard {
+    public:
+        ValueGuard(Trie root, const T &value)
+            : node_(std::move(root.root_)), value_(value) {
+        }
+
+        auto operator*() const -> const T & { return value_; }
+
+    private:
+        friend class TrieStore;
+
+        ValueGuard(std::shared_ptr<const void> owner, const T &value)
+            : node_(std::move(owner)), value_(value) {
+        }
+
+        std::shared_ptr<const void> node_;
+        const T &value_;
+    };
+
+
+    //——————————————————————————————————EpochDomain———————————————————————————————————————————————————————————————————//
+
+    // EpochDomain lets readers use an object without touching its reference
+    // count. A reader brackets the use with a Guard, which only writes a slot of
+    // its own thread. A writer that has unlinked an object tags it with Advance()
+    // and destroys it once Oldest() has moved past the tag, by which time every
+    // reader that could still see the object has left its guard.
+    class EpochDomain {
+    public:
+        EpochDomain(const EpochDomain &) = delete;
+
+        auto operator=(const EpochDomain &) -> EpochDomain & = delete;
+
+        // The process-wide domain. It is never destroyed, so guards work during
+        // static destruction.
+        static auto Global() -> EpochDomain & {
+            static auto *domain = new EpochDomain();
+            return *domain;
+        }
+
+    private:
+        // One per thread, padded so that readers do not share cache lines.
+        struct alignas(64) Slot {
+            // The epoch the thread entered its guard at, or 0 outside guards.
+            std::atomic<uint64_t> epoch{0};
+            std::atomic<bool> in_use{true};
+            // How deep the owning thread is in guards. Only it touches this.
+            size_t depth{0};
+            Slot *next{nullptr};
+        };
+
+    public:
+        class Guard {
+        public:
+            explicit Guard(EpochDomain &domain): slot_(domain.LocalSlot()) {
+                if (slot_->depth++ == 0) {
+                    slot_->epoch.store(domain.epoch_.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+                }
+            }
+
+            Guard(const Guard &) = delete;
+
+            auto operator=(const Guard &) -> Guard & = delete;
+
+            ~Guard() {
+                if (--slot_->depth == 0) {
+                    slot_->epoch.store(0, std::memory_order_release);
+                }
+            }
+
+        private:
+            Slot *slot_;
+        };
+
+        // Start a new epoch and return the old one, which tags the objects
+        // unlinked before the call.
+        auto Advance() -> uint64_t {
+            return epoch_.fetch_add(1, std::memory_order_seq_cst);
+        }
+
+        // Return the oldest epoch a reader is still in. Objects tagged below it
+        // are no longer in use.
+        auto Oldest() const -> uint64_t {
+            uint64_t oldest = epoch_.load(std::memory_order_seq_cst);
+            for (Slot *slot = slots_.load(std::memory_order_acquire); slot != nullptr; slot = slot->next) {
+                const uint64_t epoch = slot->epoch.load(std::memory_order_seq_cst);
+                if (epoch != 0 && epoch < oldest) {
+                    oldest = epoch;
+                }
+            }
+            return oldest;
+        }
+
+    private:
+        EpochDomain() = default;
+
+        // Return the slot of this thread, reusing one left by an exited thread.
+        auto LocalSlot() -> Slot * {
+            struct Owner {
+                ~Owner() {
+                    if (slot != nullptr) {
+                        slot->in_use.store(false, std::memory_order_release);
+                    }
+                }
+
+                Slot *slot{nullptr};
+            };
+            thread_local Owner owner;
+            if (owner.slot == nullptr) {
+                for (Slot *slot = slots_.load(std::memory_order_acquire); slot != nullptr; slot = slot->next) {
+                    bool expected = false;
+                    if (slot->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                        owner.slot = slot;
+                        return slot;
+                    }
+                }
+                auto *slot = new Slot();
+                slot->next = slots_.load(std::memory_order_relaxed);
+                while (!slots_.compare_exchange_weak(slot->next, slot, std::memory_order_release,
+                                                     std::memory_order_relaxed)) {
+                }
+                owner.slot = slot;
+            }
+            return owner.slot;
+        }
+
+        // Epoch 0 marks a slot outside guards.
+        std::atomic<uint64_t> epoch_{1};
+        std::atomic<Slot *> slots_{nullptr};
+    };
+
+
+    //——————————————————————————————————VersionLog————————————————————————————————————————————————————————————————————//
+
+    // A VersionLog is an append-only array of slots numbered from a starting
+    // index. Slots live in segments of kSegmentSize that never move, so appending
+    // never copies a slot, and trimming the front frees whole segments. Readers
+    // find a slot without a lock, inside a guard of EpochDomain::Global(): the
+    // segments are listed in a directory that is replaced rather than changed,
+    // and a replaced directory, with the segments it dropped, is destroyed once
+    // no reader can still be using it. One thread at a time may write.
+    template<class T>
+    class VersionLog {
+    public:
+        static constexpr size_t kSegmentSize = 1024;
+
+        explicit VersionLog(size_t start = 0)
+            : directory_(new Directory{start, {}, {}}), begin_(start), end_(start) {
+        }
+
+        VersionLog(const VersionLog &) = delete;
+
+        auto operator=(const VersionLog &) -> VersionLog & = delete;
+
+        ~VersionLog() {
+            Reset(0);
+            delete directory_.load(std::memory_order_relaxed);
+        }
+
+        // The first slot not trimmed, and one past the last slot appended.
+        auto Begin() const -> size_t { return begin_; }
+
+        auto End() const -> size_t { return end_.load(std::memory_order_acquire); }
+
+        // Return the slot at index, or nullptr if it has not been appended yet or
+        // its segment has been freed. Slots trimmed in a segment still held are
+        // returned as they are.
+        auto Find(size_t index) const -> T * {
+            if (index >= End()) return nullptr;
+            const Directory *directory = directory_.load(std::memory_order_acquire);
+            if (index < directory->base) return nullptr;
+            return &(*directory->segments[(index - directory->base) / kSegmentSize])[(index - directory->base) %
+                                                                                     kSegmentSize];
+        }
+
+        // The slot at index, which must be in [Begin(), End()), and the last one.
+        // For the writer.
+        auto operator[](size_t index) -> T & { return *Find(index); }
+
+        auto Back() -> T & { return *Find(end_.load(std::memory_order_relaxed) - 1); }
+
+        // Append a slot assigned value and make it visible to readers.
+        template<class V>
+        void PushBack(V &&value) {
+            const size_t index = end_.load(std::memory_order_relaxed);
+            Directory *directory = directory_.load(std::memory_order_relaxed);
+            if (index == directory->base + directory->segments.size() * kSegmentSize) {
+                auto *grown = new Directory{directory->base, directory->segments, {}};
+                grown->segments.push_back(new Segment());
+                Replace(grown, 0);
+                directory = grown;
+            }
+            (*directory->segments[(index - directory->base) / kSegmentSize])[(index - directory->base) %
+                                                                             kSegmentSize] = std::forward<V>(value);
+            end_.store(index + 1, std::memory_order_release);
+        }
+
+        // Give up the slots below index and free the segments wholly below it.
+        void TrimFront(size_t index) {
+            begin_ = std::max(begin_, index);
+            Directory *directory = directory_.load(std::memory_order_relaxed);
+            const size_t dropped = std::min((begin_ - directory->base) / kSegmentSize, directory->segments.size());
+            if (dropped == 0) return;
+            Replace(new Directory{directory->base + dropped * kSegmentSize,
+                                  {directory->segments.begin() + static_cast<std::ptrdiff_t>(dropped),
+                                   directory->segments.end()}, {}}, dropped);
+        }
+
+        // Destroy the replaced directories no reader can still be using.
+        void ReleaseRetired() {
+            const uint64_t oldest = EpochDomain::Global().Oldest();
+            std::erase_if(retired_, [oldest](const auto &retired) { return retired.first < oldest; });
+        }
+
+        // Drop every slot and start again at start. No reader may be using the
+        // log, and the slots are not cleaned up.
+        void Reset(size_t start) {
+            retired_.clear();
+            Directory *directory = directory_.load(std::memory_order_relaxed);
+            for (Segment *segment: directory->segments) {
+                delete segment;
+            }
+            *directory = Directory{start, {}, {}};
+            begin_ = start;
+            end_.store(start, std::memory_order_relaxed);
+        }
+
+    private:
+        using Segment = std::array<T, kSegmentSize>;
+
+        struct Directory {
+            // The index of the first slot of segments[0].
+            size_t base;
+            std::vector<Segment *> segments;
+            // The segments a directory that replaced this one dropped.
+            std::vector<std::unique_ptr<Segment> > dropped;
+        };
+
+        // Publish next, handing the first dropped segments of the current
+        // directory to it to be destroyed with it.
+        void Replace(Directory *next, size_t dropped) {
+            Directory *previous = directory_.exchange(next, std::memory_order_acq_rel);
+            for (size_t i = 0; i < dropped; i++) {
+                previous->dropped.emplace_back(previous->segments[i]);
+            }
+            retired_.emplace_back(EpochDomain::Global().Advance(), previous);
+            ReleaseRetired();
+        }
+
+        std::atomic<Directory *> directory_;
+        // Each replaced directory with the epoch it was retired at.
+        std::vector<std::pair<uint64_t, std::unique_ptr<Directory> > > retired_;
+        size_t begin_;
+        std::atomic<size_t> end_;
+    };
+
+
+    //——————————————————————————————————RetentionPolicy———————————————————————————————————————————————————————————————//
+
+    // Which historical versions a TrieStore keeps. A version is kept while any
+    // rule asks for it, while it is pinned, or while it is the newest version.
+    // With no rule set every version is kept forever.
+    struct RetentionPolicy {
+        // Keep the newest max_versions versions. 0 disables the rule.
+        size_t max_versions{0};
+
+        // Keep versions created less than max_age ago. Zero disables the rule.
+        std::chrono::steady_clock::duration max_age{};
+
+        // Turn each version into a FrozenTrie once it is this many versions older
+        // than the newest, if the frozen copy is smaller than what the version
+        // alone holds (its unique bytes, see TrieMemory). A version that shares
+        // most nodes with its neighbours stays as it is. Every version is checked
+        // once, with a walk over it, by TrieStore::CollectGarbage or by the
+        // writer thread of the asynchronous writes while it is idle; writes do
+        // not freeze. 0 disables the rule.
+        size_t freeze_after{0};
+    };
+
+    // Why a TrieStore lookup did or did not produce a value.
+    enum class LookupStatus {
+        kFound,
+        // The version exists, but the key is not in it or holds another type.
+        kKeyNotFound,
+        // The version was reclaimed by the retention policy.
+        kVersionExpired,
+        // The version has not been created yet.
+        kVersionNotFound,
+    };
+
+    template<class T>
+    struct LookupResult {
+        LookupStatus status;
+        std::optional<ValueGuard<T> > value;
+    };
+
+    // What TrieStore::Stats reports.
+    struct TrieStoreStats {
+        // The counters of every thread of the process; zero unless built with
+        // SJTU_TRIE_STATS.
+        TrieStats::Snapshot threads;
+        size_t newest_version;
+        // Versions whose trie is still held, pinned or not.
+        size_t live_versions;
+        size_t pinned_versions;
+        // Tries replaced as the newest that readers may still be using.
+        size_t retired_tries;
+        // Live versions kept as FrozenTries.
+        size_t frozen_versions;
+    };
+
+
+    //——————————————————————————————————TrieCodecRegistry————————————————————————————————————————————————————————————//
+
+    // TrieCodecRegistry finds the value type of a codec id when a write-ahead log
+    // or a checkpoint is read back. The built-in codecs are registered already;
+    // call Register<T>() for every other value type before recovering a store.
+    class TrieCodecRegistry {
+    public:
+        template<class T>
+        static void Register() {
+            static_assert(kHasTrieCodec<T>, "T has no TrieCodec");
+            std::lock_guard<std::mutex> lock(Mutex());
+            Entries()[TrieCodec<T>::kId] = Entry{&MakeNode<T>, &PutValue<T>};
+        }
+
+    private:
+        friend class TrieLog;
+        friend class TrieCheckpoint;
+        friend class TrieDelta;
+
+        struct Entry {
+            // Make a node holding the decoded value and children.
+            std::shared_ptr<TrieNode> (*make)(std::string_view bytes, TrieChildren children,
+                                              std::pmr::memory_resource *resource);
+            // Put the decoded value under key.
+            void (*put)(TransientTrie &trie, std::string_view key, std::string_view bytes);
+        };
+
+        // Throws std::runtime_error if id is not registered.
+        static auto Find(uint32_t id) -> Entry {
+            std::lock_guard<std::mutex> lock(Mutex());
+            auto it = Entries().find(id);
+            if (it == Entries().end()) {
+                throw std::runtime_error("TrieCodecRegistry: unknown codec id " + std::to_string(id));
+            }
+            return it->second;
+        }
+
+        template<class T>
+        static auto MakeNode(std::string_view bytes, TrieChildren children, std::pmr::memory_resource *resource)
+            -> std::shared_ptr<TrieNode> {
+            return AllocateShared<TrieNodeWithValue<T> >(resource, std::in_place, std::move(children),
+                                                         TrieCodec<T>::Decode(bytes), resource);
+        }
+
+        template<class T>
+        static void PutValue(TransientTrie &trie, std::string_view key, std::string_view bytes) {
+            trie.Put<T>(key, TrieCodec<T>::Decode(bytes));
+        }
+
+        template<class... Ts>
+        static auto Builtins() -> std::unordered_map<uint32_t, Entry> {
+            return {{TrieCodec<Ts>::kId, Entry{&MakeNode<Ts>, &PutValue<Ts>}}...};
+        }
+
+        static auto Entries() -> std::unordered_map<uint32_t, Entry> & {
+            static auto *entries = new std::unordered_map<uint32_t, Entry>(
+                Builtins<bool, char, signed char, unsigned char, short, unsigned short, int, unsigned int, long,
+                    unsigned long, long long, unsigned long long, float, double, std::string>());
+            return *entries;
+        }
+
+        static auto Mutex() -> std::mutex & {
+            static auto *mutex = new std::mutex();
+            return *mutex;
+        }
+    };
+
+
+    //——————————————————————————————————TrieFile——————————————————————————————————————————————————————————————————————//
+
+    // The FNV-1a hash of bytes, which guards log records and checkpoints against
+    // torn writes.
+    inline auto TrieChecksum(std::string_view bytes) -> uint32_t {
+        uint32_t hash = 2166136261u;
+        for (char c: bytes) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+        }
+        return hash;
+    }
+
+    // An append-only file that can be forced to disk. Throws std::runtime_error
+    // when the file cannot be opened, written or synced.
+    class TrieFile {
+    public:
+        explicit TrieFile(const std::string &path): path_(path) {
+#ifdef SJTU_TRIE_POSIX
+            fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+            struct stat st{};
+            if (fd_ < 0 || ::fstat(fd_, &st) != 0) {
+                if (fd_ >= 0) ::close(fd_);
+                throw std::runtime_error("TrieFile: cannot open " + path);
+            }
+            size_ = static_cast<uint64_t>(st.st_size);
+#else
+            file_ = std::fopen(path.c_str(), "ab");
+            if (file_ == nullptr) {
+                throw std::runtime_error("TrieFile: cannot open " + path);
+            }
+            size_ = std::filesystem::file_size(path);
+#endif
+        }
+
+        TrieFile(const TrieFile &) = delete;
+
+        auto operator=(const TrieFile &) -> TrieFile & = delete;
+
+        ~TrieFile() {
+#ifdef SJTU_TRIE_POSIX
+            ::close(fd_);
+#else
+            std::fclose(file_);
+#endif
+        }
+
+        void Write(std::string_view bytes) {
+#ifdef SJTU_TRIE_POSIX
+            while (!bytes.empty()) {
+                const ssize_t written = ::write(fd_, bytes.data(), bytes.size());
+                if (written < 0 && errno == EINTR) {
+                    continue;
+                }
+                // write only returns 0 for a non-empty buffer if it cannot make
+                // progress, so that is a failure too.
+                if (written <= 0) {
+                    throw std::runtime_error("TrieFile: cannot write " + path_);
+                }
+                size_ += static_cast<uint64_t>(written);
+                bytes.remove_prefix(static_cast<size_t>(written));
+            }
+#else
+            const size_t written = std::fwrite(bytes.data(), 1, bytes.size(), file_);
+            size_ += written;
+            if (written != bytes.size()) {
+                throw std::runtime_error("TrieFile: cannot write " + path_);
+            }
+#endif
+        }
+
+        // The size of the file, including what was written but not synced.
+        auto Size() const -> uint64_t { return size_; }
+
+        // Cut the file to its first size bytes and make that durable. Later
+        // writes append from there.
+        void Truncate(uint64_t size) {
+#ifdef SJTU_TRIE_POSIX
+            if (::ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+                throw std::runtime_error("TrieFile: cannot truncate " + path_);
+            }
+#else
+            std::fflush(file_);
+            std::filesystem::resize_file(path_, size);
+#endif
+            size_ = size;
+            Sync();
+        }
+
+        void Sync() {
+#ifdef SJTU_TRIE_POSIX
+            if (::fsync(fd_) != 0) {
+                throw std::runtime_error("TrieFile: cannot sync " + path_);
+            }
+#else
+            if (std::fflush(file_) != 0) {
+                throw std::runtime_error("TrieFile: cannot sync " + path_);
+            }
+#endif
+        }
+
+        // Make the creation, removal and renaming of files in directory durable.
+        static void SyncDirectory(const std::string &directory) {
+#ifdef SJTU_TRIE_POSIX
+            const int fd = ::open(directory.c_str(), O_RDONLY);
+            if (fd >= 0) {
+                ::fsync(fd);
+                ::close(fd);
+            }
+#else
+            (void) directory;
+#endif
+        }
+
+        // Cut the file at path to its first size bytes and make that durable.
+        static void Truncate(const std::string &path, uint64_t size) {
+            std::filesystem::resize_file(path, size);
+            TrieFile(path).Sync();
+        }
+
+        // Return the whole content of the file at path, or nullopt if it cannot
+        // be read.
+        static auto ReadAll(const std::string &path) -> std::optional<std::string> {
+            std::ifstream file(path, std::ios::binary);
+            if (!file) return std::nullopt;
+            return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+
+        // Return the name of a file of a durable store: prefix, number, suffix,
+        // with the number padded so that names sort by it.
+        static auto Name(const std::string &directory, const char *prefix, uint64_t number, const char *suffix)
+            -> std::string {
+            std::string digits = std::to_string(number);
+            return directory + "/" + prefix + std::string(20 - digits.size(), '0') + digits + suffix;
+        }
+
+        // Return the numbers of the files named by Name in directory, ascending.
+        static auto List(const std::string &directory, std::string_view prefix, std::string_view suffix)
+            -> std::vector<uint64_t> {
+            std::vector<uint64_t> numbers;
+            for (const auto &entry: std::filesystem::directory_iterator(directory)) {
+                const std::string name = entry.path().filename().string();
+                if (name.size() == prefix.size() + 20 + suffix.size() && name.starts_with(prefix) &&
+                    name.ends_with(suffix)) {
+                    numbers.push_back(std::stoull(name.substr(prefix.size(), 20)));
+                }
+            }
+            std::sort(numbers.begin(), numbers.end());
+            return numbers;
+        }
+
+    private:
+        std::string path_;
+        uint64_t size_{0};
+#ifdef SJTU_TRIE_POSIX
+        int fd_{-1};
+#else
+        std::FILE *file_{nullptr};
+#endif
+    };
+
+
+    //——————————————————————————————————DurabilityOptions————————————————————————————————————————————————————————————//
+
+    // When a durable TrieStore forces its write-ahead log to disk.
+    enum class LogSync {
+        // After every logged operation.
+        kEveryOp,
+        // Once per version, which covers a whole Commit or GroupCommit group.
+        kGroupCommit,
+        // At most once per sync_interval, and on Sync(). A crash may lose the
+        // writes of the last interval.
+        kInterval,
+    };
+
+    // How a TrieStore keeps its content on disk, see TrieLog and TrieCheckpoint.
+    struct DurabilityOptions {
+        // The directory holding the log and the checkpoints. Created if missing.
+        std::string directory;
+
+        LogSync sync{LogSync::kGroupCommit};
+
+        std::chrono::steady_clock::duration sync_interval{std::chrono::milliseconds(100)};
+
+        // Take a checkpoint once this many versions have been written since the
+        // last one. 0 leaves checkpoints to TrieStore::Checkpoint.
+        size_t checkpoint_every{0};
+
+        // After this many incremental checkpoints the next one is full, which lets
+        // the older checkpoint files go.
+        size_t max_checkpoint_chain{8};
+    };
+
+
+    //——————————————————————————————————TrieLog———————————————————————————————————————————————————————————————————————//
+
+    // TrieLog is the write-ahead log of a durable TrieStore. It is a series of
+    // segment files wal-<first version>.log, each a sequence of records
+    //   u32 payload length, u32 checksum of the payload, payload
+    // whose payload is u64 version, u8 operation, u32 key length, the key, and
+    // for a put the u32 codec id and the encoded value. The last record of every
+    // version carries kEndOfVersion, so replay applies versions whole and stops
+    // at a torn tail. A new segment starts at every checkpoint, which makes the
+    // older segments obsolete. Not thread-safe; the store calls it under its
+    // write lock.
+    class TrieLog {
+    public:
+        TrieLog(std::string directory, LogSync sync, std::chrono::steady_clock::duration interval)
+            : directory_(std::move(directory)), sync_(sync), interval_(interval) {
+        }
+
+        // Write the following versions to a new segment, starting at first_version.
+        void StartSegment(uint64_t first_version) {
+            if (file_) {
+                file_->Sync();
+            }
+            file_ = std::make_unique<TrieFile>(TrieFile::Name(directory_, "wal-", first_version, ".log"));
+            TrieFile::SyncDirectory(directory_);
+            failed_ = false;
+        }
+
+        // Queue a put for the next Write. Throws std::runtime_error if T has no
+        // TrieCodec, before anything is queued.
+        template<class T>
+        void AddPut(std::string_view key, const T &value) {
+            if constexpr (kHasTrieCodec<T>) {
+                std::string bytes;
+                TrieCodec<T>::Encode(value, bytes);
+                pending_.push_back({kPut, std::string(key), TrieCodec<T>::kId, std::move(bytes)});
+            } else {
+                throw std::runtime_error("TrieLog: a value type has no TrieCodec");
+            }
+        }
+
+        void AddRemove(std::string_view key) {
+            pending_.push_back({kRemove, std::string(key), 0, {}});
+        }
+
+        // Queue a change found by Trie::Diff. Throws std::runtime_error if the
+        // value type has no TrieCodec.
+        void AddChange(const TrieChange &change) {
+            if (!change.after) {
+                AddRemove(change.key);
+                return;
+            }
+            std::string bytes;
+            const uint32_t codec = change.after->type_->encode(*change.after, bytes);
+            pending_.push_back({kPut, change.key, codec, std::move(bytes)});
+        }
+
+        // Write the queued operations as version and sync as configured. If that
+        // fails, the segment is cut back to where the version started, so the
+        // store can log the same version number again; if even that fails, every
+        // Write throws until the next segment starts, which a checkpoint does.
+        void Write(uint64_t version) {
+            if (failed_) {
+                throw std::runtime_error("TrieLog: a failed write could not be rolled back");
+            }
+            const uint64_t start = file_->Size();
+            try {
+                WriteRecords(version);
+            } catch (...) {
+                try {
+                    file_->Truncate(start);
+                } catch (const std::runtime_error &) {
+                    failed_ = true;
+                }
+                throw;
+            }
+        }
+
+        // Return the number of queued operations.
+        auto Queued() const -> size_t { return pending_.size(); }
+
+        // Drop the queued operations after the first keep.
+        void Discard(size_t keep = 0) {
+            pending_.erase(pending_.begin() + static_cast<std::ptrdiff_t>(keep), pending_.end());
+        }
+
+        void Sync() {
+            if (file_) {
+                file_->Sync();
+                last_sync_ = std::chrono::steady_clock::now();
+            }
+        }
+
+        // Apply every whole version after version `after` from the segments in
+        // directory to trie, in order. Returns the last version applied, or
+        // `after` if there was none. Replay stops at the first torn or corrupt
+        // record and at a gap in the version numbers, and cuts the log there, so
+        // that the versions logged after recovery directly follow the last one
+        // applied.
+        static auto Replay(const std::string &directory, uint64_t after, TransientTrie &trie) -> uint64_t {
+            const std::vector<uint64_t> segments = TrieFile::List(directory, "wal-", ".log");
+            // Skip the segments that hold only versions up to after.
+            size_t first = 0;
+            while (first + 1 < segments.size() && segments[first + 1] <= after + 1) {
+                ++first;
+            }
+            uint64_t last = after;
+            // The version the next record must carry once a version is whole.
+            uint64_t next = first < segments.size() ? segments[first] : 0;
+            for (size_t s = first; s < segments.size(); ++s) {
+                const std::string path = TrieFile::Name(directory, "wal-", segments[s], ".log");
+                if (segments[s] != next || next > last + 1) {
+                    Cut(directory, segments, s, 0);
+                    break;
+                }
+                const auto content = TrieFile::ReadAll(path);
+                const std::string_view all = content ? std::string_view(*content) : std::string_view();
+                std::string_view in = all;
+                // The bytes of the whole versions read from the segment.
+                size_t whole = 0;
+                // The operations of the version being read, applied once it is whole.
+                uint64_t version = next;
+                std::vector<Replayed> batch;
+                while (in.size() >= 8) {
+                    const auto length = Read<uint32_t>(in.substr(0, 4));
+                    const auto checksum = Read<uint32_t>(in.substr(4, 4));
+                    if (in.size() - 8 < length) break;
+                    const std::string_view payload = in.substr(8, length);
+                    in.remove_prefix(8 + length);
+                    if (TrieChecksum(payload) != checksum || payload.size() < 13) break;
+                    const auto record_version = Read<uint64_t>(payload.substr(0, 8));
+                    const auto operation = static_cast<uint8_t>(payload[8]);
+                    const auto key_length = Read<uint32_t>(payload.substr(9, 4));
+                    if (record_version != version || payload.size() - 13 < key_length) break;
+                    const std::string_view rest = payload.substr(13 + key_length);
+                    Replayed op{payload.substr(13, key_length), {}, nullptr};
+                    if ((operation & ~kEndOfVersion) == kPut) {
+                        if (rest.size() < 4) break;
+                        op.put = TrieCodecRegistry::Find(Read<uint32_t>(rest.substr(0, 4))).put;
+                        op.value = rest.substr(4);
+                    }
+                    batch.push_back(op);
+                    if ((operation & kEndOfVersion) == 0) continue;
+                    if (version > after) {
+                        for (const Replayed &replayed: batch) {
+                            if (replayed.put != nullptr) {
+                                replayed.put(trie, replayed.key, replayed.value);
+                            } else {
+                                trie.Remove(replayed.key);
+                            }
+                        }
+                        last = version;
+                    }
+                    batch.clear();
+                    whole = all.size() - in.size();
+                    version = ++next;
+                }
+                if (whole != all.size()) {
+                    Cut(directory, segments, s, whole);
+                    break;
+                }
+            }
+            return last;
+        }
+
+    private:
+        static constexpr uint8_t kPut = 1;
+        static constexpr uint8_t kRemove = 2;
+        static constexpr uint8_t kEndOfVersion = 0x80;
+
+        // A logged operation read back; a remove if put is null.
+        struct Replayed {
+            std::string_view key;
+            std::string_view value;
+            void (*put)(TransientTrie &, std::string_view, std::string_view);
+        };
+
+        struct Pending {
+            uint8_t operation;
+            std::string key;
+            uint32_t codec;
+            std::string value;
+        };
+
+        // Keep the first size bytes of segments[from] and delete the segments
+        // after it, or all of them from it if size is 0.
+        static void Cut(const std::string &directory, const std::vector<uint64_t> &segments, size_t from,
+                        size_t size) {
+            if (size != 0) {
+                TrieFile::Truncate(TrieFile::Name(directory, "wal-", segments[from++], ".log"), size);
+            }
+            for (; from < segments.size(); ++from) {
+                std::filesystem::remove(TrieFile::Name(directory, "wal-", segments[from], ".log"));
+            }
+            TrieFile::SyncDirectory(directory);
+        }
+
+        template<class Int>
+        static void Append(std::string &out, Int value) {
+            out.append(reinterpret_cast<const char *>(&value), sizeof(Int));
+        }
+
+        template<class Int>
+        static auto Read(std::string_view bytes) -> Int {
+            Int value;
+            std::memcpy(&value, bytes.data(), sizeof(Int));
+            return value;
+        }
+
+        // Encode the queued operations as version, write them and sync as
+        // configured.
+        void WriteRecords(uint64_t version) {
+            std::string out;
+            for (size_t i = 0; i < pending_.size(); ++i) {
+                const Pending &op = pending_[i];
+                std::string payload;
+                Append(payload, version);
+                payload += static_cast<char>(op.operation | (i + 1 == pending_.size() ? kEndOfVersion : 0));
+                Append(payload, static_cast<uint32_t>(op.key.size()));
+                payload += op.key;
+                if (op.operation == kPut) {
+                    Append(payload, op.codec);
+                    payload += op.value;
+                }
+                Append(out, static_cast<uint32_t>(payload.size()));
+                Append(out, TrieChecksum(payload));
+                out += payload;
+                if (sync_ == LogSync::kEveryOp) {
+                    file_->Write(out);
+                    file_->Sync();
+                    out.clear();
+                }
+            }
+            pending_.clear();
+            file_->Write(out);
+            const auto now = std::chrono::steady_clock::now();
+            if (sync_ == LogSync::kGroupCommit || (sync_ == LogSync::kInterval && now - last_sync_ >= interval_)) {
+                file_->Sync();
+                last_sync_ = now;
+            }
+        }
+
+        std::string directory_;
+        LogSync sync_;
+        std::chrono::steady_clock::duration interval_;
+        std::chrono::steady_clock::time_point last_sync_{std::chrono::steady_clock::now()};
+        std::unique_ptr<TrieFile> file_;
+        std::vector<Pending> pending_;
+        // A write failed and could not be cut from the current segment.
+        bool failed_{false};
+    };
+
+
+    //——————————————————————————————————TrieCheckpoint———————————————————————————————————————————————————————————————//
+
+    // TrieCheckpoint writes the content of a durable TrieStore to files
+    // checkpoint-<version>.ckpt. A full checkpoint holds every node; an
+    // incremental one holds only the nodes created since the previous checkpoint
+    // and refers to older nodes by id, so its size follows the churn rather than
+    // the size of the trie. A chain is a full checkpoint and the incremental ones
+    // after it; every max_chain checkpoints a full one starts a new chain and the
+    // old files are deleted. Layout:
+    //   header   magic "SJTUCKPT", u32 format, u32 full flag, u64 version, u64
+    //            version of the previous checkpoint in the chain
+    //   record   u64 id, u32 prefix length, u32 codec id (0 without a value),
+    //            u32 value length, u32 child count, the prefix, the value, and a
+    //            u8 byte and u64 id per child; children come before their parent
+    //   trailer  u64 root id (0 for an empty trie), u64 record count, u32
+    //            checksum of everything before it, u32 unused
+    // A node remembers the id it was saved under, see TrieNode::checkpoint_. Ids
+    // carry a number unique to the chain in the process, so nodes saved by
+    // another chain or another store are saved again.
+    // Not thread-safe; the store serializes checkpoints.
+    class TrieCheckpoint {
+    public:
+        TrieCheckpoint(std::string directory, size_t max_chain)
+            : directory_(std::move(directory)), max_chain_(max_chain) {
+        }
+
+        // The version of the last checkpoint written or loaded, 0 if none.
+        auto Version() const -> uint64_t { return version_; }
+
+        // Load the newest checkpoint in the directory and make it the base of the
+        // next incremental one. Returns its version and trie, or version 0 and an
+        // empty trie if there is none. Throws std::runtime_error if a file of
+        // the chain is missing or damaged.
+        auto Recover(std::pmr::memory_resource *resource) -> std::pair<uint64_t, Trie> {
+            for (const auto &entry: std::filesystem::directory_iterator(directory_)) {
+                if (entry.path().extension() == ".tmp") {
+                    std::filesystem::remove(entry.path());
+                }
+            }
+            const std::vector<uint64_t> versions = TrieFile::List(directory_, "checkpoint-", ".ckpt");
+            if (versions.empty()) {
+                return {0, Trie(resource)};
+            }
+            // Follow the chain back from the newest checkpoint to its full one.
+            std::vector<std::string> chain;
+            for (uint64_t version = versions.back();;) {
+                auto content = TrieFile::ReadAll(TrieFile::Name(directory_, "checkpoint-", version, ".ckpt"));
+                if (!content || content->size() < sizeof(Header) + sizeof(Trailer)) {
+                    throw std::runtime_error("TrieCheckpoint: checkpoint " + std::to_string(version) +
+                                             " is missing or damaged");
+                }
+                Header header;
+                std::memcpy(&header, content->data(), sizeof(Header));
+                Trailer trailer;
+                std::memcpy(&trailer, content->data() + content->size() - sizeof(Trailer), sizeof(Trailer));
+                if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.format != kFormat ||
+                    header.version != version ||
+                    TrieChecksum(std::string_view(*content).substr(0, content->size() - sizeof(Trailer))) !=
+                    trailer.checksum) {
+                    throw std::runtime_error("TrieCheckpoint: checkpoint " + std::to_string(version) +
+                                             " is damaged");
+                }
+                chain.push_back(std::move(*content));
+                if (header.full != 0) break;
+                version = header.previous;
+            }
+
+            chain_ = NewChain();
+            next_id_ = 1;
+            length_ = chain.size() - 1;
+            version_ = versions.back();
+            std::unordered_map<uint64_t, std::shared_ptr<const TrieNode> > nodes;
+            uint64_t root = 0;
+            for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+                root = ReadRecords(*it, nodes, resource);
+            }
+            if (root == 0) {
+                return {version_, Trie(resource)};
+            }
+            auto found = nodes.find(root);
+            if (found == nodes.end()) {
+                throw std::runtime_error("TrieCheckpoint: the root of a checkpoint is missing");
+            }
+            return {version_, Trie(found->second, resource)};
+        }
+
+        // Write a checkpoint of trie as version, then delete the checkpoints it
+        // makes obsolete. Throws std::runtime_error if that fails, in which case
+        // the previous checkpoints stay valid.
+        void Write(const Trie &trie, uint64_t version) {
+            const bool full = version_ == 0 || length_ >= max_chain_;
+            const uint64_t chain = full ? NewChain() : chain_;
+            uint64_t next_id = full ? 1 : next_id_;
+
+            std::string out(sizeof(Header), '\0');
+            Header header;
+            header.full = full ? 1 : 0;
+            header.version = version;
+            header.previous = full ? version : version_;
+            std::memcpy(out.data(), &header, sizeof(Header));
+            // Ids are given to the nodes only once the file is in place.
+            std::unordered_map<const TrieNode *, uint64_t> saved;
+            Trailer trailer;
+            trailer.root = trie.root_ ? WriteNode(*trie.root_, chain, next_id, saved, out) : 0;
+            trailer.records = saved.size();
+            trailer.checksum = TrieChecksum(out);
+            out.append(reinterpret_cast<const char *>(&trailer), sizeof(Trailer));
+
+            const std::string path = TrieFile::Name(directory_, "checkpoint-", version, ".ckpt");
+            const std::string temporary = TrieFile::Name(directory_, "checkpoint-", version, ".tmp");
+            std::filesystem::remove(temporary);
+            {
+                TrieFile file(temporary);
+                file.Write(out);
+                file.Sync();
+            }
+            std::filesystem::rename(temporary, path);
+            TrieFile::SyncDirectory(directory_);
+
+            for (const auto &[node, id]: saved) {
+                node->checkpoint_.id.store(chain | id, std::memory_order_relaxed);
+            }
+            chain_ = chain;
+            next_id_ = next_id;
+            length_ = full ? 0 : length_ + 1;
+            version_ = version;
+            if (full) {
+                for (uint64_t old: TrieFile::List(directory_, "checkpoint-", ".ckpt")) {
+                    if (old < version) {
+                        std::filesystem::remove(TrieFile::Name(directory_, "checkpoint-", old, ".ckpt"));
+                    }
+                }
+                TrieFile::SyncDirectory(directory_);
+            }
+        }
+
+    private:
+        static constexpr char kMagic[8] = {'S', 'J', 'T', 'U', 'C', 'K', 'P', 'T'};
+        static constexpr uint32_t kFormat = 1;
+        // The low bits of a node tag are its id within the chain.
+        static constexpr int kIdBits = 40;
+        static constexpr uint64_t kIdMask = (uint64_t{1} << kIdBits) - 1;
+
+        struct Header {
+            char magic[8]{'S', 'J', 'T', 'U', 'C', 'K', 'P', 'T'};
+            uint32_t format{kFormat};
+            uint32_t full{0};
+            uint64_t version{0};
+            uint64_t previous{0};
+        };
+
+        struct Record {
+            uint64_t id;
+            uint32_t prefix_len;
+            uint32_t codec;
+            uint32_t value_len;
+            uint32_t child_count;
+        };
+
+        struct Trailer {
+            uint64_t root{0};
+            uint64_t records{0};
+            uint32_t checksum{0};
+            uint32_t unused{0};
+        };
+
+        static constexpr size_t kChildSize = 1 + sizeof(uint64_t);
+
+        // Return the tag bits of a new chain, never used before in the process.
+        static auto NewChain() -> uint64_t {
+            static std::atomic<uint64_t> chains{0};
+            return (chains.fetch_add(1, std::memory_order_relaxed) + 1) << kIdBits;
+        }
+
+        // Append the records of node and of the nodes below it that chain has not
+        // saved yet, returning the id of node. A node shared within the trie is
+        // written once.
+        static auto WriteNode(const TrieNode &node, uint64_t chain, uint64_t &next_id,
+                              std::unordered_map<const TrieNode *, uint64_t> &saved, std::string &out)
+            -> uint64_t {
+            const uint64_t tag = node.checkpoint_.id.load(std::memory_order_relaxed);
+            if ((tag & ~kIdMask) == chain) {
+                return tag & kIdMask;
+            }
+            if (auto it = saved.find(&node); it != saved.end()) {
+                return it->second;
+            }
+            std::string children;
+            node.children_.ForEach([&](char c, const TrieChildren::Child &child) {
+                const uint64_t id = WriteNode(*child, chain, next_id, saved, out);
+                children += c;
+                children.append(reinterpret_cast<const char *>(&id), sizeof(uint64_t));
+            });
+            std::string value;
+            const uint32_t codec = node.type_->encode != nullptr ? node.type_->encode(node, value) : 0;
+
+            const Record record{next_id++, static_cast<uint32_t>(node.prefix_.size()), codec,
+                                static_cast<uint32_t>(value.size()), static_cast<uint32_t>(node.children_.Size())};
+            out.append(reinterpret_cast<const char *>(&record), sizeof(Record));
+            out += node.prefix_;
+            out += value;
+            out += children;
+            saved.emplace(&node, record.id);
+            return record.id;
+        }
+
+        // Rebuild the nodes of a checkpoint file into nodes and tag them with the
+        // current chain. Returns the root id.
+        auto ReadRecords(std::string_view in, std::unordered_map<uint64_t, std::shared_ptr<const TrieNode> > &nodes,
+                         std::pmr::memory_resource *resource) -> uint64_t {
+            Trailer trailer;
+            std::memcpy(&trailer, in.data() + in.size() - sizeof(Trailer), sizeof(Trailer));
+            in = in.substr(sizeof(Header), in.size() - sizeof(Header) - sizeof(Trailer));
+            const auto damaged = [] { return std::runtime_error("TrieCheckpoint: a checkpoint record is damaged"); };
+            for (uint64_t i = 0; i < trailer.records; ++i) {
+                if (in.size() < sizeof(Record)) throw damaged();
+                Record record;
+                std::memcpy(&record, in.data(), sizeof(Record));
+                in.remove_prefix(sizeof(Record));
+                const size_t size = size_t{record.prefix_len} + record.value_len + record.child_count * kChildSize;
+                if (in.size() < size || record.id == 0 || record.id > kIdMask) throw damaged();
+                const std::string_view prefix = in.substr(0, record.prefix_len);
+                const std::string_view value = in.substr(record.prefix_len, record.value_len);
+                std::string_view children = in.substr(record.prefix_len + record.value_len,
+                                                      record.child_count * kChildSize);
+                in.remove_prefix(size);
+
+                TrieChildren table;
+                for (; !children.empty(); children.remove_prefix(kChildSize)) {
+                    uint64_t id;
+                    std::memcpy(&id, children.data() + 1, sizeof(uint64_t));
+                    auto child = nodes.find(id);
+                    if (child == nodes.end()) throw damaged();
+                    table.Set(children[0], child->second, resource);
+                }
+                std::shared_ptr<TrieNode> node =
+                        record.codec == 0
+                            ? AllocateShared<TrieNode>(resource, std::move(table))
+                            : TrieCodecRegistry::Find(record.codec).make(value, std::move(table), resource);
+                node->prefix_ = prefix;
+                node->checkpoint_.id.store(chain_ | record.id, std::memory_order_relaxed);
+                next_id_ = std::max(next_id_, record.id + 1);
+                nodes[record.id] = std::move(node);
+            }
+            return trailer.root;
+        }
+
+        std::string directory_;
+        size_t max_chain_;
+
+        // The tag bits of the current chain, the next free id in it, the number of
+        // incremental checkpoints in it, and the version of its newest checkpoint.
+        uint64_t chain_{0};
+        uint64_t next_id_{1};
+        size_t length_{0};
+        uint64_t version_{0};
+    };
+
+
+    //——————————————————————————————————TrieDelta———————————————————————————————————————————————————————————————————//
+
+    // TrieDelta carries the changes between two versions of a leader TrieStore to
+    // a follower, as bytes that can cross a process boundary:
+    //   header   magic "SJTUDLTA", u32 format, u32 full flag, u64 leader version
+    //            the delta starts from, u64 version it leads to, u64 change count
+    //   change   u8 operation (1 put, 2 remove), u32 key length, the key, and for
+    //            a put the u32 codec id, u32 value length and the value
+    //   trailer  u32 checksum of everything before it
+    // A full delta holds every key of its version and replaces the follower's
+    // content. Values are encoded with TrieCodec; on the follower, types other
+    // than the built-in ones must be registered with TrieCodecRegistry.
+    class TrieDelta {
+    public:
+        // Encode changes, the result of a Diff from version from to version to.
+        // Throws std::runtime_error if a value type has no TrieCodec.
+        static auto Encode(const std::vector<TrieChange> &changes, uint64_t from, uint64_t to, bool full)
+            -> std::string {
+            std::string out(sizeof(Header), '\0');
+            Header header;
+            header.full = full ? 1 : 0;
+            header.from = from;
+            header.to = to;
+            header.changes = changes.size();
+            std::memcpy(out.data(), &header, sizeof(Header));
+            std::string value;
+            for (const TrieChange &change: changes) {
+                out += static_cast<char>(change.after ? kPut : kRemove);
+                Append(out, static_cast<uint32_t>(change.key.size()));
+                out += change.key;
+                if (change.after) {
+                    value.clear();
+                    Append(out, change.after->type_->encode(*change.after, value));
+                    Append(out, static_cast<uint32_t>(value.size()));
+                    out += value;
+                }
+            }
+            Append(out, TrieChecksum(out));
+            return out;
+        }
+
+        // Parse a delta. It refers to bytes, which must outlive it. Throws
+        // std::runtime_error if the delta is damaged.
+        explicit TrieDelta(std::string_view bytes) {
+            if (bytes.size() < sizeof(Header) + sizeof(uint32_t) ||
+                TrieChecksum(bytes.substr(0, bytes.size() - sizeof(uint32_t))) !=
+                Read<uint32_t>(bytes.substr(bytes.size() - sizeof(uint32_t)))) {
+                throw std::runtime_error("TrieDelta: the delta is damaged");
+            }
+            std::memcpy(&header_, bytes.data(), sizeof(Header));
+            if (std::memcmp(header_.magic, kMagic, sizeof(kMagic)) != 0 || header_.format != kFormat) {
+                throw std::runtime_error("TrieDelta: not a delta");
+            }
+            std::string_view in = bytes.substr(sizeof(Header), bytes.size() - sizeof(Header) - sizeof(uint32_t));
+            const auto take = [&in](size_t size) {
+                if (in.size() < size) throw std::runtime_error("TrieDelta: the delta is damaged");
+                const std::string_view taken = in.substr(0, size);
+                in.remove_prefix(size);
+                return taken;
+            };
+            changes_.reserve(header_.changes);
+            for (uint64_t i = 0; i < header_.changes; ++i) {
+                Change change;
+                change.operation = static_cast<uint8_t>(take(1)[0]);
+                change.key = take(Read<uint32_t>(take(4)));
+                if (change.operation == kPut) {
+                    change.codec = Read<uint32_t>(take(4));
+                    change.value = take(Read<uint32_t>(take(4)));
+                }
+                changes_.push_back(change);
+            }
+        }
+
+        auto From() const -> uint64_t { return header_.from; }
+
+        auto To() const -> uint64_t { return header_.to; }
+
+        auto Full() const -> bool { return header_.full != 0; }
+
+        auto Size() const -> size_t { return changes_.size(); }
+
+        // Apply the changes to trie. Throws std::runtime_error if a codec id is
+        // not registered.
+        void ApplyTo(TransientTrie &trie) const {
+            for (const Change &change: changes_) {
+                if (change.operation == kPut) {
+                    TrieCodecRegistry::Find(change.codec).put(trie, change.key, change.value);
+                } else {
+                    trie.Remove(change.key);
+                }
+            }
+        }
+
+    private:
+        static constexpr char kMagic[8] = {'S', 'J', 'T', 'U', 'D', 'L', 'T', 'A'};
+        static constexpr uint32_t kFormat = 1;
+        static constexpr uint8_t kPut = 1;
+        static constexpr uint8_t kRemove = 2;
+
+        struct Header {
+            char magic[8]{'S', 'J', 'T', 'U', 'D', 'L', 'T', 'A'};
+            uint32_t format{kFormat};
+            uint32_t full{0};
+            uint64_t from{0};
+            uint64_t to{0};
+            uint64_t changes{0};
+        };
+
+        struct Change {
+            uint8_t operation{kRemove};
+            std::string_view key;
+            uint32_t codec{0};
+            std::string_view value;
+        };
+
+        template<class Int>
+        static void Append(std::string &out, Int value) {
+            out.append(reinterpret_cast<const char *>(&value), sizeof(Int));
+        }
+
+        template<class Int>
+        static auto Read(std::string_view bytes) -> Int {
+            Int value;
+            std::memcpy(&value, bytes.data(), sizeof(Int));
+            return value;
+        }
+
+        Header header_;
+        std::vector<Change> changes_;
+    };
+
+
+    //——————————————————————————————————TrieStore—————————————————————————————————————————————————————————————————————//
+
+    // This class is a thread-safe wrapper around the Trie class. It provides a
+    // simple interface for accessing the trie. It should allow concurrent reads and
+    // a single write operation at the same time.
+    class TrieStore {
+    private:
+        friend class ShardedTrieStore;
+
+    public:
+        // A WriteBatch collects puts and removes to be applied to a store as one
+        // version: fill it with Put and Remove, then hand it to TrieStore::Commit.
+        class WriteBatch {
+        public:
+            template<class T>
+            auto Put(std::string_view key, T value) -> WriteBatch & {
+                ops_.push_back(std::make_unique<PutOp<T> >(key, std::move(value)));
+                return *this;
+            }
+
+            auto Remove(std::string_view key) -> WriteBatch & {
+                ops_.push_back(std::make_unique<RemoveOp>(key));
+                return *this;
+            }
+
+            auto Size() const -> size_t { return ops_.size(); }
+
+            auto Empty() const -> bool { return ops_.empty(); }
+
+        private:
+            friend class TrieStore;
+            friend class ShardedTrieStore;
+
+            struct Op {
+                explicit Op(std::string_view key): key(key) {
+                }
+
+                virtual ~Op() = default;
+
+                // Apply the operation, returning false if it changed nothing.
+                virtual auto Apply(TransientTrie &trie) -> bool = 0;
+
+                // Queue the operation in the write-ahead log. Called before Apply,
+                // which may move the value away.
+                virtual void Log(TrieLog &log) const = 0;
+
+                std::string key;
+            };
+
+            template<class T>
+            struct PutOp : Op {
+                PutOp(std::string_view key, T value): Op(key), value(std::move(value)) {
+                }
+
+                auto Apply(TransientTrie &trie) -> bool override {
+                    trie.Put<T>(this->key, std::move(value));
+                    return true;
+                }
+
+                void Log(TrieLog &log) const override { log.AddPut<T>(this->key, value); }
+
+                T value;
+            };
+
+            struct RemoveOp : Op {
+                using Op::Op;
+
+                auto Apply(TransientTrie &trie) -> bool override { return trie.Remove(key); }
+
+                void Log(TrieLog &log) const override { log.AddRemove(key); }
+            };
+
+            std::vector<std::unique_ptr<Op> > ops_;
+        };
+
+        // A ReadTxn holds one version of a store, taken by TrieStore::BeginRead,
+        // and reads it without touching the store again: every Get and scan sees
+        // the same version, however many writes land meanwhile. The version stays
+        // alive while the transaction does, whatever the retention policy says.
+        // A ReadTxn is a value; one thread at a time may use it.
+        class ReadTxn {
+        public:
+            auto Version() const -> size_t { return version_; }
+
+            // Return the value of key in this version, or nullptr if the key is
+            // missing or holds another type. The pointer is valid while the
+            // transaction is alive.
+            template<class T>
+            auto Get(std::string_view key) const -> const T * {
+                TrieStats::Add(TrieStats::kGets);
+                return frozen_ ? frozen_->Get<T>(key) : trie_.Get<T>(key);
+            }
+
+            // Iterate over the keys of this version; see Trie::Scan. A frozen
+            // version is thawed for every scan.
+            auto Scan() const -> TrieRange { return Contents().Scan(); }
+
+            auto ScanPrefix(std::string_view prefix) const -> TrieRange { return Contents().ScanPrefix(prefix); }
+
+            auto Range(std::string_view lo, std::string_view hi) const -> TrieRange {
+                return Contents().Range(lo, hi);
+            }
+
+        private:
+            friend class TrieStore;
+
+            ReadTxn(size_t version, Trie trie, std::shared_ptr<const FrozenTrie> frozen,
+                    std::pmr::memory_resource *resource)
+                : version_(version), trie_(std::move(trie)), frozen_(std::move(frozen)), resource_(resource) {
+            }
+
+            auto Contents() const -> Trie { return frozen_ ? frozen_->Thaw(resource_) : trie_; }
+
+            size_t version_;
+            Trie trie_;
+            std::shared_ptr<const FrozenTrie> frozen_;
+            std::pmr::memory_resource *resource_;
+        };
+
+        TrieStore(): TrieStore(RetentionPolicy{}) {
+        }
+
+        // Create a store whose tries allocate their nodes from resource. The
+        // resource must outlive the store and every guard taken from it.
+        explicit TrieStore(std::pmr::memory_resource *resource): TrieStore(RetentionPolicy{}, resource) {
+        }
+
+        // Create a store that reclaims the versions policy does not retain.
+        explicit TrieStore(RetentionPolicy policy,
+                           std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+            : policy_(policy), resource_(resource), latest_(new Trie(resource)) {
+            snapshots_.PushBack(new Snapshot{Trie(resource), Clock::now()});
+        }
+
+        // Create a store that keeps its content in options.directory: every write
+        // goes to a write-ahead log before it is published, and checkpoints let
+        // the log be truncated. The store recovers the newest checkpoint and the
+        // whole versions logged after it, which continue the version numbers;
+        // older versions are expired. Value types other than the built-in ones
+        // must be registered with TrieCodecRegistry first. Throws
+        // std::runtime_error if a value cannot be logged or recovery fails.
+        explicit TrieStore(const DurabilityOptions &options, RetentionPolicy policy = {},
+                           std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+            : TrieStore(policy, resource) {
+            std::filesystem::create_directories(options.directory);
+            durable_ = std::make_unique<Durability>(options);
+            auto [checkpointed, base] = durable_->checkpoint.Recover(resource);
+            TransientTrie working(base);
+            const size_t version = TrieLog::Replay(options.directory, checkpointed, working);
+            Trie recovered = working.Freeze();
+            // 把日志中恢复的部分写进检查点，之后旧日志段就都不再需要了
+            if (version != checkpointed) {
+                durable_->checkpoint.Write(recovered, version);
+            }
+            durable_->checkpointed = version;
+            RemoveSegments(version);
+            durable_->log.StartSegment(version + 1);
+
+            delete snapshots_.Back().load(std::memory_order_relaxed);
+            snapshots_.Reset(version);
+            snapshots_.PushBack(new Snapshot{recovered, Clock::now()});
+            swept_version_ = version;
+            delete latest_.exchange(new Trie(recovered), std::memory_order_relaxed);
+            latest_version_.store(version, std::memory_order_relaxed);
+        }
+
+        TrieStore(const TrieStore &) = delete;
+
+        auto operator=(const TrieStore &) -> TrieStore & = delete;
+
+        // No reader may be inside the store when it is destroyed. A durable store
+        // syncs its log first.
+        ~TrieStore() {
+            if (async_) {
+                // 先让写线程处理完已提交的异步写入
+                {
+                    std::lock_guard<std::mutex> lock(async_->lock);
+                    async_->stop = true;
+                }
+                async_->wake.notify_one();
+                async_->thread.join();
+            }
+            if (durable_) {
+                try {
+                    durable_->log.Sync();
+                } catch (const std::runtime_error &) {
+                }
+            }
+            delete latest_.load(std::memory_order_relaxed);
+            for (size_t version = snapshots_.Begin(); version < snapshots_.End(); ++version) {
+                delete snapshots_[version].load(std::memory_order_relaxed);
+            }
+        }
+
+        // This function returns a ValueGuard object that holds a reference to the
+        // value in the trie of the given version (default: newest version). If the
+        // key does not exist in the trie, it will return std::nullopt.
+        //Get函数是一个模板函数，接受一个键（key）和一个版本号（version），返回一个std::optional<ValueGuard<T>>对象。
+        template<class T>
+        auto Get(std::string_view key, size_t version = -1) -> std::optional<ValueGuard<T> > {
+            return Lookup<T>(key, version).value;
+        }
+
+        // Like Get, but also tells a missing key apart from a version that has been
+        // reclaimed or does not exist yet.
+        template<class T>
+        auto Lookup(std::string_view key, size_t version = -1) -> LookupResult<T> {
+            TrieStats::Timer timer(TrieStats::kGetLatency);
+            TrieStats::Add(TrieStats::kGets);
+            if (version == static_cast<size_t>(-1)) {
+                // 最新版本：在读者纪元内直接使用当前版本，不经过任何锁，也不碰根节点的引用计数
+                EpochDomain::Guard guard(EpochDomain::Global());
+                return PinValue<T>(*latest_.load(std::memory_order_seq_cst), key);
+            }
+            // 历史版本：同样在读者纪元内找到版本，快照不会在纪元结束前被释放
+            EpochDomain::Guard guard(EpochDomain::Global());
+            auto [status, snapshot] = Locate(version);
+            if (status != LookupStatus::kFound) {
+                return {status, std::nullopt};
+            }
+            if (snapshot->frozen) {
+                const T *value = snapshot->frozen->Get<T>(key);
+                if (!value) return {LookupStatus::kKeyNotFound, std::nullopt};
+                return {LookupStatus::kFound, ValueGuard<T>(snapshot->frozen, *value)};
+            }
+            return PinValue<T>(snapshot->trie, key);
+        }
+
+        // Start a read transaction on a version (default: newest version). This
+        // finds the version once; the transaction's reads do not touch the store.
+        // Returns nullopt if the version is unavailable.
+        auto BeginRead(size_t version = -1) -> std::optional<ReadTxn> {
+            EpochDomain::Guard guard(EpochDomain::Global());
+            const Snapshot *snapshot;
+            if (version == static_cast<size_t>(-1)) {
+                std::tie(version, snapshot) = Newest();
+            } else {
+                LookupStatus status;
+                std::tie(status, snapshot) = Locate(version);
+                if (status != LookupStatus::kFound) return std::nullopt;
+            }
+            return ReadTxn(version, snapshot->trie, snapshot->frozen, resource_);
+        }
+
+        // Iterate over the keys of a version that start with prefix. The range
+        // keeps the version alive; nullopt if the version is unavailable.
+        auto ScanPrefix(std::string_view prefix, size_t version = -1) -> std::optional<TrieRange> {
+            auto [status, target_trie] = Resolve(version);
+            if (status != LookupStatus::kFound) return std::nullopt;
+            return target_trie.ScanPrefix(prefix);
+        }
+
+        // Iterate over the keys of a version in [lo, hi). The range keeps the
+        // version alive; nullopt if the version is unavailable.
+        auto Range(std::string_view lo, std::string_view hi, size_t version = -1) -> std::optional<TrieRange> {
+            auto [status, target_trie] = Resolve(version);
+            if (status != LookupStatus::kFound) return std::nullopt;
+            return target_trie.Range(lo, hi);
+        }
+
+        // Return the keys that version newer inserts, removes or changes relative
+        // to version older, see Trie::Diff. Returns nullopt if either version is
+        // unavailable.
+        auto Diff(size_t older, size_t newer = -1) -> std::optional<std::vector<TrieChange> > {
+            auto [older_status, older_trie] = Resolve(older);
+            auto [newer_status, newer_trie] = Resolve(newer);
+            if (older_status != LookupStatus::kFound || newer_status != LookupStatus::kFound) return std::nullopt;
+            return older_trie.Diff(newer_trie);
+        }
+
+        // Return a TrieDelta that brings a follower at version of this store to the
+        // newest version. If version is no longer available the delta is full.
+        // Throws std::runtime_error if a value type has no TrieCodec.
+        auto DeltaSince(size_t version) -> std::string {
+            size_t latest;
+            Trie newest;
+            Trie base;
+            std::shared_ptr<const FrozenTrie> frozen;
+            bool full;
+            {
+                EpochDomain::Guard guard(EpochDomain::Global());
+                const auto [newest_version, newest_snapshot] = Newest();
+                latest = newest_version;
+                newest = newest_snapshot->trie;
+                auto [status, older] = Locate(version);
+                full = status != LookupStatus::kFound || version > latest;
+                base = full ? Trie() : older->trie;
+                frozen = full ? nullptr : older->frozen;
+            }
+            if (frozen) {
+                base = frozen->Thaw(resource_);
+            }
+            return TrieDelta::Encode(base.Diff(newest), full ? 0 : version, latest, full);
+        }
+
+        // Apply a delta from DeltaSince of a leader, as one new version of this
+        // store, which follows the leader and takes no other writes. Returns the
+        // version of this store afterwards. Throws std::invalid_argument if the
+        // delta does not start at ReplicatedVersion(), and std::runtime_error if
+        // it is damaged.
+        auto ApplyDelta(std::string_view bytes) -> size_t {
+            const TrieDelta delta(bytes);
+            size_t version;
+            {
+                TimedWriteLock lock(write_lock_);
+                if (!delta.Full() && delta.From() != replicated_version_) {
+                    throw std::invalid_argument("TrieStore: the delta does not start at the replicated version");
+                }
+                const Trie &current_trie = NewestTrie();
+                TransientTrie working(delta.Full() ? Trie(resource_) : current_trie);
+                delta.ApplyTo(working);
+                version = PublishReplica(working.Freeze());
+                replicated_version_ = delta.To();
+            }
+            AutoCheckpoint(version);
+            return version;
+        }
+
+        // Make the newest version of leader, a store in the same process, the
+        // newest version of this one. The trie is adopted as it is, so the two
+        // stores share every node. Returns the version of this store afterwards.
+        auto CatchUp(TrieStore &leader) -> size_t {
+            size_t leader_version;
+            Trie newest;
+            {
+                EpochDomain::Guard guard(EpochDomain::Global());
+                const auto [newest_version, snapshot] = leader.Newest();
+                leader_version = newest_version;
+                newest = snapshot->trie;
+            }
+            size_t version;
+            {
+                TimedWriteLock lock(write_lock_);
+                version = PublishReplica(newest);
+                replicated_version_ = leader_version;
+            }
+            AutoCheckpoint(version);
+            return version;
+        }
+
+        // The version of the leader this store last applied with ApplyDelta or
+        // CatchUp, 0 if none.
+        auto ReplicatedVersion() -> size_t {
+            std::lock_guard<std::mutex> lock(write_lock_);
+            return replicated_version_;
+        }
+
+        // This function will insert the key-value pair into the trie. If the key
+        // already exists in the trie, it will overwrite the value return the
+        // version number after operation Hint: new version should only be visible
+        // after the operation is committed(completed)
+        //lockguard和uniquelock都是不需要释放的，使用RAII机制，作用于结束后会自动释放
+        template<class T>
+        size_t Put(std::string_view key, T value) {
+            TrieStats::Timer timer(TrieStats::kPutLatency);
+            TrieStats::Add(TrieStats::kPuts);
+            size_t version;
+            {
+                TimedWriteLock lock(write_lock_);
+                if (TrieLog *log = StartLog()) {
+                    log->AddPut<T>(key, value);
+                }
+                const Trie &current_trie = NewestTrie();
+                version = PublishLogged(current_trie.Put<T>(key, std::move(value)));
+            }
+            AutoCheckpoint(version);
+            return version;
+        }
+
+        // This function will remove the key-value pair from the trie.
+        // return the version number after operation
+        // if the key does not exist, version number should not be increased
+        size_t Remove(std::string_view key) {
+            TrieStats::Timer timer(TrieStats::kRemoveLatency);
+            TrieStats::Add(TrieStats::kRemoves);
+            size_t version;
+            {
+                TimedWriteLock lock(write_lock_);
+                if (TrieLog *log = StartLog()) {
+                    log->AddRemove(key);
+                }
+                const Trie &current_trie = NewestTrie();
+                Trie new_trie = current_trie.Remove(key);
+                if (new_trie == current_trie) {
+                    return Unchanged(); // 无变化
+                }
+                version = PublishLogged(std::move(new_trie));
+            }
+            AutoCheckpoint(version);
+            return version;
+        }
+
+        // Get, Put and Remove with a typed key, stored as its TrieKey bytes.
+        template<class T, class K> requires kTypedTrieKey<K>
+        auto Get(const K &key, size_t version = -1) -> std::optional<ValueGuard<T> > {
+            return Get<T>(EncodeKey(key), version);
+        }
 
-        // Create a TrieNode with some children.
-        explicit TrieNode(std::map<char, std::shared_ptr<const TrieNode> > children): children_(std::move(children)) {
+        template<class T, class K> requires kTypedTrieKey<K>
+        size_t Put(const K &key, T value) {
+            return Put<T>(EncodeKey(key), std::move(value));
         }
 
-        virtual ~TrieNode() = default;
+        template<class K> requires kTypedTrieKey<K>
+        size_t Remove(const K &key) {
+            return Remove(EncodeKey(key));
+        }
 
-        // Clone returns a copy of this TrieNode. If the TrieNode has a value, the
-        // value is copied. The return type of this function is a unique_ptr to a
-        // TrieNode.
-        // You cannot use the copy constructor to clone the node because it doesn't
-        // know whether a `TrieNode` contains a value or not.
-        virtual auto Clone() const -> std::unique_ptr<TrieNode> {
-            auto clonedNode = std::make_unique<TrieNode>();
-            clonedNode->children_ = children_;
-            clonedNode->is_value_node_ = is_value_node_;
-            return clonedNode;
+        // Apply the operations of batch in order to one working copy of the newest
+        // version, and publish the result as a single new version. Readers see
+        // either none or all of the batch. Returns the version number after the
+        // commit, which is unchanged if the batch changed nothing.
+        auto Commit(WriteBatch batch) -> size_t {
+            TrieStats::Timer timer(TrieStats::kCommitLatency);
+            TrieStats::Add(TrieStats::kCommits);
+            size_t version;
+            {
+                TimedWriteLock lock(write_lock_);
+                version = CommitLocked(batch);
+            }
+            AutoCheckpoint(version);
+            return version;
         }
 
-    protected:
-        // A map of children, where the key is the next character in the key, and
-        // the value is the next TrieNode.
-        std::map<char, std::shared_ptr<const TrieNode> > children_;
+        // Like Commit, but batches that threads submit at the same time are
+        // combined: one of the callers applies all of them, in submission order,
+        // to one working copy and publishes a single version for the group.
+        // Returns the version that contains batch, which is shared with the rest
+        // of its group. A batch that cannot be logged throws without failing the
+        // others.
+        auto GroupCommit(WriteBatch batch) -> size_t {
+            TrieStats::Timer timer(TrieStats::kCommitLatency);
+            TrieStats::Add(TrieStats::kCommits);
+            PendingCommit request(std::move(batch));
+            std::future<size_t> version = request.promise.get_future();
+            request.next = pending_.load(std::memory_order_relaxed);
+            while (!pending_.compare_exchange_weak(request.next, &request, std::memory_order_seq_cst,
+                                                   std::memory_order_relaxed)) {
+            }
+            // 抢到合并者身份的线程负责处理队列；放弃身份后若队列里又有请求，再抢一次，
+            // 这样任何入队的请求都有人处理
+            while (pending_.load(std::memory_order_seq_cst) != nullptr &&
+                   !combining_.exchange(true, std::memory_order_seq_cst)) {
+                CombinePending();
+                combining_.store(false, std::memory_order_seq_cst);
+            }
+            const size_t committed = version.get();
+            AutoCheckpoint(committed);
+            return committed;
+        }
 
-        // Indicates if the node is the terminal node.
-        bool is_value_node_{false};
-    };
+        // Put without waiting for the write lock: the write is handed to the
+        // store's writer thread, started by the first asynchronous write, and the
+        // future becomes ready with the version that holds it once that is
+        // published. Asynchronous writes are applied in the order they were
+        // submitted; those queued together become one version, as in GroupCommit.
+        // The value is moved into the request on the calling thread.
+        template<class T>
+        auto PutAsync(std::string_view key, T value) -> std::future<size_t> {
+            TrieStats::Add(TrieStats::kPuts);
+            WriteBatch batch;
+            batch.Put<T>(key, std::move(value));
+            return Submit(std::move(batch));
+        }
 
+        // Remove like PutAsync.
+        auto RemoveAsync(std::string_view key) -> std::future<size_t> {
+            TrieStats::Add(TrieStats::kRemoves);
+            WriteBatch batch;
+            batch.Remove(key);
+            return Submit(std::move(batch));
+        }
 
-    //——————————————————————————————————TrieNodeWithValue————————————————————————————————————————————————————————————//
+        // Commit like PutAsync. The future throws what Commit would have thrown.
+        auto CommitAsync(WriteBatch batch) -> std::future<size_t> {
+            TrieStats::Add(TrieStats::kCommits);
+            return Submit(std::move(batch));
+        }
 
-    // A TrieNodeWithValue is a TrieNode that also has a value of type T associated
-    // with it.
-    template<class T>
-    class TrieNodeWithValue : public TrieNode {
-    public:
+        // This function return the newest version number
+        size_t get_version() {
+            return latest_version_.load(std::memory_order_acquire);
+        }
 
-        friend class Trie;
-        // Create a trie node with no children and a value.
-        explicit TrieNodeWithValue(std::shared_ptr<T> value)
-            : value_(std::move(value)) {
-            this->is_value_node_ = true;
+        // Block until version has been published and return the newest version,
+        // which is at least version.
+        auto WaitForVersion(size_t version) -> size_t {
+            size_t latest = latest_version_.load(std::memory_order_acquire);
+            while (latest < version) {
+                latest_version_.wait(latest, std::memory_order_acquire);
+                latest = latest_version_.load(std::memory_order_acquire);
+            }
+            return latest;
         }
 
-        // Create a trie node with children and a value.
-        TrieNodeWithValue(std::map<char, std::shared_ptr<const TrieNode> > children,
-                          std::shared_ptr<T> value)
-            : TrieNode(std::move(children)), value_(std::move(value)) {
-            this->is_value_node_ = true;
+        // Keep version alive regardless of the retention policy until a matching
+        // Unpin. Returns false if the version has expired or does not exist.
+        auto Pin(size_t version) -> bool {
+            std::lock_guard<std::mutex> lock(write_lock_);
+            if (Locate(version).first != LookupStatus::kFound) {
+                return false;
+            }
+            ++pins_[version];
+            return true;
         }
 
-        // Override the Clone method to also clone the value.
-        auto Clone() const -> std::unique_ptr<TrieNode> override {
-            auto clonedNode = std::make_unique<TrieNodeWithValue<T> >(value_);
-            clonedNode->children_ = this->children_;
-            clonedNode->is_value_node_ = this->is_value_node_;
-            return clonedNode;
+        // Release a pin taken by Pin. The version is reclaimed if the retention
+        // policy no longer keeps it.
+        void Unpin(size_t version) {
+            std::lock_guard<std::mutex> lock(write_lock_);
+            auto it = pins_.find(version);
+            if (it == pins_.end() || --it->second > 0) {
+                return;
+            }
+            pins_.erase(it);
+            if (version < swept_version_) {
+                ReclaimSnapshot(version);
+                ReleaseRetired();
+            }
         }
 
-    protected:
-        // The value associated with this trie node.
-        std::shared_ptr<T> value_;
-    };
+        // Apply the retention policy now, and freeze the versions it has made
+        // old enough. Writes reclaim versions as well; call it to let the time
+        // window take effect while there are no writes, and to freeze versions
+        // after synchronous writes.
+        void CollectGarbage() {
+            {
+                std::lock_guard<std::mutex> lock(write_lock_);
+                Sweep();
+                ReleaseRetired();
+            }
+            FreezeOld();
+        }
 
-    //——————————————————————————————————Trie—————————————————————————————————————————————————————————————————————————//
+        // Return the counters of TrieStats and the state of this store's versions.
+        auto Stats() -> TrieStoreStats {
+            TrieStoreStats stats{TrieStats::Collect(), 0, 0, 0, 0, 0};
+            std::lock_guard<std::mutex> lock(write_lock_);
+            stats.newest_version = Latest();
+            for (size_t version = snapshots_.Begin(); version <= stats.newest_version; ++version) {
+                const Snapshot *snapshot = snapshots_[version].load(std::memory_order_relaxed);
+                stats.live_versions += snapshot ? 1 : 0;
+                stats.frozen_versions += snapshot && snapshot->frozen ? 1 : 0;
+            }
+            stats.pinned_versions = pins_.size();
+            stats.retired_tries = retired_.size();
+            return stats;
+        }
 
-    // A Trie is a data structure that maps strings to values of type T. All
-    // operations on a Trie should not modify the trie itself. It should reuse the
-    // existing nodes as much as possible, and create new nodes to represent the new
-    // trie.
-    class Trie {
-    private:
-        // The root of the trie.
-        std::shared_ptr<const TrieNode> root_{nullptr};
+        // Measure the versions in [from, to] that are still held, see TrieMemory.
+        // The unique bytes are what reclaiming all of them would free, so
+        // Memory(v, v) tells what dropping version v alone would save. Return
+        // nullopt if none of the versions is held.
+        auto Memory(size_t from, size_t to = -1) -> std::optional<TrieMemory> {
+            std::lock_guard<std::mutex> lock(write_lock_);
+            const size_t latest = Latest();
+            std::vector<const Trie *> tries;
+            std::unordered_set<const TrieNode *> roots;
+            size_t frozen_bytes = 0;
+            size_t frozen_shared = 0;
+            for (size_t version = std::max(from, snapshots_.Begin()); version <= std::min(to, latest); ++version) {
+                const Snapshot *snapshot = snapshots_[version].load(std::memory_order_relaxed);
+                if (snapshot && snapshot->frozen) {
+                    frozen_bytes += snapshot->frozen->Bytes();
+                    frozen_shared += snapshot->frozen.use_count() > 1 ? snapshot->frozen->Bytes() : 0;
+                } else if (snapshot) {
+                    tries.push_back(&snapshot->trie);
+                    roots.insert(snapshot->trie.root_.get());
+                }
+            }
+            if (tries.empty() && frozen_bytes == 0) return std::nullopt;
+            // The store's other copies of these tries are its own references too.
+            const Trie *newest = latest_.load(std::memory_order_acquire);
+            if (newest != nullptr && roots.count(newest->root_.get()) != 0) {
+                tries.push_back(newest);
+            }
+            for (const auto &[epoch, trie]: retired_) {
+                if (roots.count(trie->root_.get()) != 0) {
+                    tries.push_back(trie.get());
+                }
+            }
+            TrieMemory memory = TrieMemory::Measure(tries);
+            memory.frozen_bytes = frozen_bytes;
+            memory.unique_bytes += frozen_bytes - frozen_shared;
+            memory.shared_bytes += frozen_shared;
+            return memory;
+        }
 
-        // Create a new trie with the given root.
-        explicit Trie(std::shared_ptr<const TrieNode> root): root_(std::move(root)) {
+        // Write a checkpoint of the newest version of a durable store and delete
+        // the log segments and checkpoints it makes obsolete. Writes go on while
+        // the checkpoint is written. Returns the version saved. Throws
+        // std::logic_error if the store is not durable.
+        auto Checkpoint() -> size_t {
+            if (!durable_) {
+                throw std::logic_error("TrieStore: the store is not durable");
+            }
+            std::lock_guard<std::mutex> lock(durable_->checkpoint_lock);
+            return CheckpointLocked();
         }
 
-    public:
-        // Create an empty trie.
-        Trie() = default;
+        // Intern every version published from now on with interner, which other
+        // stores and tries may share; null stops interning. See TrieInterner.
+        void SetInterner(std::shared_ptr<TrieInterner> interner) {
+            std::lock_guard<std::mutex> lock(write_lock_);
+            interner_ = std::move(interner);
+        }
 
-        bool operator==(const Trie &other) const {
-            if (root_ == other.root_) {
-                return true;
-            } else {
-                return false;
+        // Force the log of a durable store to disk, which LogSync::kInterval
+        // leaves to the next interval.
+        void Sync() {
+            if (durable_) {
+                std::lock_guard<std::mutex> lock(write_lock_);
+                durable_->log.Sync();
             }
         }
 
-        // Get the value associated with the given key.
-        // 1. If the key is not in the trie, return nullptr.
-        // 2. If the key is in the trie but the type is mismatched, return nullptr.
-        // 3. Otherwise, return the value.
-        template<class T>
-        auto Get(std::string_view key) const -> const T * {
-            const TrieNode *cur = root_.get();
-            if (cur == nullptr) {
-                return nullptr;
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        // Holds write_lock_ like a lock_guard, and tells TrieStats how long it
+        // waited for the lock and held it.
+        class TimedWriteLock {
+        public:
+            explicit TimedWriteLock(std::mutex &mutex): mutex_(mutex) {
+                const auto start = TrieStats::Now();
+                mutex_.lock();
+                TrieStats::Add(TrieStats::kWriteLockWaitNanos, TrieStats::Elapsed(start));
+                acquired_ = TrieStats::Now();
             }
-            for (auto c: key) {
-                auto it = cur->children_.find(c);
-                if (it == cur->children_.end()) {
-                    return nullptr;
-                }
-                cur = it->second.get();
+
+            TimedWriteLock(const TimedWriteLock &) = delete;
+
+            auto operator=(const TimedWriteLock &) -> TimedWriteLock & = delete;
+
+            ~TimedWriteLock() {
+                mutex_.unlock();
+                TrieStats::Add(TrieStats::kWriteLockHoldNanos, TrieStats::Elapsed(acquired_));
             }
 
-            if (!cur->is_value_node_) {
-                return nullptr;
+        private:
+            std::mutex &mutex_;
+            std::chrono::steady_clock::time_point acquired_;
+        };
+
+        struct Snapshot {
+            Trie trie;
+            Clock::time_point created;
+            // Set, and trie empty, in the snapshot of a frozen version.
+            std::shared_ptr<const FrozenTrie> frozen{};
+        };
+
+        // Return a guard that keeps only the node of key alive, so that the
+        // lookup leaves the reference count of the root alone.
+        template<class T>
+        static auto PinValue(const Trie &trie, std::string_view key) -> LookupResult<T> {
+            const auto *slot = Trie::FindSlot(trie.root_, key);
+            const T *value = slot == nullptr ? nullptr : Trie::GetValue<T>(slot->get());
+            if (!value) return {LookupStatus::kKeyNotFound, std::nullopt};
+            return {LookupStatus::kFound, ValueGuard<T>(*slot, *value)};
+        }
+
+        // Return the snapshot of a version, with kFound if it is available. Must be
+        // called inside a guard of EpochDomain::Global() or with write_lock_ held,
+        // which keep the snapshot alive.
+        auto Locate(size_t version) const -> std::pair<LookupStatus, const Snapshot *> {
+            if (version >= snapshots_.End()) {
+                return {LookupStatus::kVersionNotFound, nullptr};
             }
-            const auto *value_node = dynamic_cast<const TrieNodeWithValue<T> *>(cur);
-            if (!value_node) {
-                return nullptr;
+            const auto *slot = snapshots_.Find(version);
+            const Snapshot *snapshot = slot == nullptr ? nullptr : slot->load(std::memory_order_acquire);
+            if (snapshot == nullptr) {
+                return {LookupStatus::kVersionExpired, nullptr};
             }
-            return value_node->value_.get();
+            return {LookupStatus::kFound, snapshot};
         }
 
-        // Put a new key-value pair into the trie. If the key already exists,
-        // overwrite the value. Returns the new trie.
-        template<class T>
-        auto Put(std::string_view key, T value) const -> Trie {
-            if (root_ == nullptr) {
-                // 处理空树的情况
-                std::shared_ptr<TrieNode> cur = std::make_shared<TrieNode>();
-                //记录路径
-                std::stack<std::pair<std::shared_ptr<TrieNode>, char> > path;
+        // Return the newest version and its snapshot, under the same conditions as
+        // Locate. A version a writer reclaims as this runs, or whose segment it
+        // frees, is passed over for the one that replaced it.
+        auto Newest() const -> std::pair<size_t, const Snapshot *> {
+            while (true) {
+                const size_t version = snapshots_.End() - 1;
+                const auto *slot = snapshots_.Find(version);
+                if (slot == nullptr) continue;
+                if (const Snapshot *snapshot = slot->load(std::memory_order_acquire)) {
+                    return {version, snapshot};
+                }
+            }
+        }
+
+        // The newest version and its trie. Must be called with write_lock_ held.
+        auto Latest() const -> size_t { return snapshots_.End() - 1; }
+
+        auto NewestTrie() -> const Trie & { return snapshots_.Back().load(std::memory_order_relaxed)->trie; }
 
-                for (auto c: key) {
-                    path.push({cur, c});
-                    auto newNode = std::make_shared<TrieNode>();
-                    cur->children_[c] = newNode;
-                    cur = newNode;
+        // Return a copy of the trie of a version, with kFound if it is available.
+        // A frozen version is thawed into a new trie.
+        auto Resolve(size_t version) -> std::pair<LookupStatus, Trie> {
+            if (version == static_cast<size_t>(-1)) {
+                EpochDomain::Guard guard(EpochDomain::Global());
+                return {LookupStatus::kFound, *latest_.load(std::memory_order_seq_cst)};
+            }
+            std::shared_ptr<const FrozenTrie> frozen;
+            {
+                EpochDomain::Guard guard(EpochDomain::Global());
+                auto [status, snapshot] = Locate(version);
+                if (status != LookupStatus::kFound) {
+                    return {status, Trie()};
+                }
+                if (!snapshot->frozen) {
+                    return {status, snapshot->trie};
                 }
+                frozen = snapshot->frozen;
+            }
+            return {LookupStatus::kFound, frozen->Thaw(resource_)};
+        }
 
-                // 创建带值的节点，继承cur的children
-                auto valueNode = std::make_shared<TrieNodeWithValue<T> >(
-                    cur->children_, std::make_shared<T>(std::move(value)));
-                cur = valueNode;
+        // Commit batch with write_lock_ held.
+        auto CommitLocked(WriteBatch &batch) -> size_t {
+            std::optional<Trie> next = ApplyLocked(batch);
+            return next ? PublishLogged(std::move(*next)) : Unchanged();
+        }
 
-                while (!path.empty()) {
-                    auto [parent, c] = path.top();
-                    path.pop();
-                    parent->children_[c] = cur;
-                    cur = parent;
+        // Queue the operations of batch in the log and apply them to a working
+        // copy of the newest version, without publishing anything. Returns the
+        // new trie, or nullopt if the batch changed nothing. Must be called with
+        // write_lock_ held and followed by PublishLogged or Unchanged.
+        auto ApplyLocked(WriteBatch &batch) -> std::optional<Trie> {
+            if (TrieLog *log = StartLog()) {
+                for (const auto &op: batch.ops_) {
+                    op->Log(*log);
                 }
+            }
+            TransientTrie working(NewestTrie());
+            bool changed = false;
+            for (auto &op: batch.ops_) {
+                changed |= op->Apply(working);
+            }
+            if (!changed) {
+                return std::nullopt;
+            }
+            return working.Freeze();
+        }
 
-                return Trie(cur);
+        // A batch waiting in pending_ for a GroupCommit combiner.
+        struct PendingCommit {
+            explicit PendingCommit(WriteBatch batch): batch(std::move(batch)) {
             }
 
-            std::shared_ptr<TrieNode> cur = std::shared_ptr<TrieNode>(root_->Clone());
-            std::stack<std::pair<std::shared_ptr<TrieNode>, char> > path;
+            WriteBatch batch;
+            std::promise<size_t> promise;
+            PendingCommit *next{nullptr};
+            // Set if the batch could not be logged; it is left out of its group.
+            std::exception_ptr error;
+        };
+
+        // Apply every pending batch. Each drained group becomes one version.
+        void CombinePending() {
+            while (PendingCommit *head = pending_.exchange(nullptr, std::memory_order_acquire)) {
+                // 队列是后进先出的，反转成提交顺序
+                PendingCommit *group = nullptr;
+                while (head != nullptr) {
+                    PendingCommit *next = head->next;
+                    head->next = group;
+                    group = head;
+                    head = next;
+                }
+                ApplyGroup(group);
+            }
+        }
 
-            for (auto c: key) {
-                path.push({cur, c});
-                auto it = cur->children_.find(c);
-                if (it == cur->children_.end()) {
-                    // 如果子节点不存在，则创建一个新的子节点
-                    auto newNode = std::make_shared<TrieNode>();
-                    cur->children_[c] = newNode;
-                    cur = newNode;
+        // Apply a list of batches, in order, as one version and fulfil their
+        // promises with it. A batch that cannot be logged fails on its own and
+        // the others still commit. Returns the version, or 0 if the group failed.
+        auto ApplyGroup(PendingCommit *group) -> size_t {
+            size_t version = 0;
+            std::exception_ptr error;
+            try {
+                TimedWriteLock lock(write_lock_);
+                if (TrieLog *log = StartLog()) {
+                    for (PendingCommit *request = group; request != nullptr; request = request->next) {
+                        const size_t queued = log->Queued();
+                        try {
+                            for (const auto &op: request->batch.ops_) {
+                                op->Log(*log);
+                            }
+                        } catch (...) {
+                            log->Discard(queued);
+                            request->error = std::current_exception();
+                        }
+                    }
+                }
+                TransientTrie working(NewestTrie());
+                bool changed = false;
+                for (PendingCommit *request = group; request != nullptr; request = request->next) {
+                    if (request->error) continue;
+                    for (auto &op: request->batch.ops_) {
+                        changed |= op->Apply(working);
+                    }
+                }
+                version = changed ? PublishLogged(working.Freeze()) : Unchanged();
+            } catch (...) {
+                error = std::current_exception();
+            }
+            // A request may be gone as soon as its promise is ready, so take
+            // everything out of it first.
+            while (group != nullptr) {
+                std::promise<size_t> promise = std::move(group->promise);
+                const std::exception_ptr failed = group->error ? group->error : error;
+                group = group->next;
+                if (failed) {
+                    promise.set_exception(failed);
                 } else {
-                    // 克隆子节点并更新路径
-                    auto clonedChild = it->second->Clone();
-                    cur->children_[c] = std::shared_ptr<const TrieNode>(std::move(clonedChild));
-                    cur = std::const_pointer_cast<TrieNode>(cur->children_[c]);
+                    promise.set_value(version);
                 }
             }
+            return error ? 0 : version;
+        }
 
-            // 创建带值的节点，继承原有子节点
-            auto valueNode = std::make_shared<TrieNodeWithValue<T> >(cur->children_,
-                                                                     std::make_shared<T>(std::move(value)));
-            cur = valueNode;
+        // The writer thread of the asynchronous writes and its queue.
+        struct AsyncWriter {
+            std::mutex lock;
+            std::condition_variable wake;
+            std::deque<PendingCommit> queue;
+            bool stop{false};
+            std::thread thread;
+        };
 
-            // 反向更新路径中的节点
-            while (!path.empty()) {
-                auto [parent, c] = path.top();
-                path.pop();
-                parent->children_[c] = cur;
-                cur = parent;
+        // Queue batch for the writer thread, starting it if need be.
+        auto Submit(WriteBatch batch) -> std::future<size_t> {
+            std::unique_lock<std::mutex> start_lock(async_start_lock_);
+            if (!async_) {
+                auto writer = std::make_unique<AsyncWriter>();
+                writer->thread = std::thread([this, shared = writer.get()] { RunWriter(*shared); });
+                async_ = std::move(writer);
+            }
+            start_lock.unlock();
+            std::future<size_t> version;
+            {
+                std::lock_guard<std::mutex> lock(async_->lock);
+                async_->queue.emplace_back(std::move(batch));
+                version = async_->queue.back().promise.get_future();
             }
+            async_->wake.notify_one();
+            return version;
+        }
 
-            return Trie(cur);
+        // Apply queued batches until the store is destroyed and the queue is empty.
+        void RunWriter(AsyncWriter &writer) {
+            std::unique_lock<std::mutex> lock(writer.lock);
+            while (true) {
+                writer.wake.wait(lock, [&writer] { return writer.stop || !writer.queue.empty(); });
+                if (writer.queue.empty()) {
+                    return;
+                }
+                std::deque<PendingCommit> group = std::move(writer.queue);
+                writer.queue.clear();
+                lock.unlock();
+                for (size_t i = 0; i + 1 < group.size(); ++i) {
+                    group[i].next = &group[i + 1];
+                }
+                const size_t version = ApplyGroup(&group.front());
+                try {
+                    AutoCheckpoint(version);
+                } catch (const std::runtime_error &) {
+                    // The next write or Checkpoint tries again.
+                }
+                lock.lock();
+                // Freeze old versions one at a time while there is nothing to write.
+                while (writer.queue.empty() && !writer.stop) {
+                    lock.unlock();
+                    const bool more = FreezeOld(1);
+                    lock.lock();
+                    if (!more) break;
+                }
+            }
         }
 
+        // Append new_trie as the newest version and apply the retention policy.
+        // Must be called with write_lock_ held. Returns the new version number.
+        auto Publish(Trie new_trie) -> size_t {
+            if (interner_) {
+                new_trie = interner_->Intern(new_trie);
+            }
+            auto latest = std::make_unique<const Trie>(new_trie);
+            snapshots_.PushBack(new Snapshot{std::move(new_trie), Clock::now()});
+            Sweep();
+            const size_t version = Latest();
+            // 发布新版本：先发布新版本的trie，再发布版本号，保证读到新版本号的线程也能读到新trie
+            const Trie *previous = latest_.exchange(latest.release(), std::memory_order_seq_cst);
+            latest_version_.store(version, std::memory_order_release);
+            latest_version_.notify_all();
+            // 被替换下来的trie和快照可能还有读者在用，等它们都离开后再释放
+            retired_.emplace_back(EpochDomain::Global().Advance(), previous);
+            ReleaseRetired();
+            return version;
+        }
 
-        // Remove the key from the trie. If the key does not exist, return the
-        // original trie. Otherwise, returns the new trie.
-        auto Remove(std::string_view key) const -> Trie {
-            if (!root_) {
-                return *this;
+        // Consider for freezing up to limit of the versions policy_.freeze_after
+        // has reached since the last call, and freeze those where that saves
+        // memory. Returns whether versions are left to consider. A version is
+        // measured and frozen from a copy of its trie without write_lock_, which
+        // is only held to pick the version and to swap in its frozen snapshot;
+        // readers of the old snapshot keep it until they leave.
+        auto FreezeOld(size_t limit = -1) -> bool {
+            if (policy_.freeze_after == 0) return false;
+            std::lock_guard<std::mutex> freezing(freeze_lock_);
+            for (; limit > 0; --limit) {
+                size_t version;
+                const Snapshot *snapshot;
+                Trie trie;
+                {
+                    std::lock_guard<std::mutex> lock(write_lock_);
+                    freeze_checked_ = std::max(freeze_checked_, snapshots_.Begin());
+                    if (freeze_checked_ + policy_.freeze_after > Latest()) return false;
+                    version = freeze_checked_++;
+                    snapshot = snapshots_[version].load(std::memory_order_relaxed);
+                    if (snapshot == nullptr || snapshot->frozen) continue;
+                    trie = snapshot->trie;
+                }
+                // Skip versions whose unique bytes could not even hold the arrays
+                // of a frozen copy before building one. The copy is a second
+                // reference to the root of the version.
+                const TrieMemory memory = TrieMemory::Measure({&trie, &trie});
+                if (memory.unique_bytes <= memory.nodes * (3 * sizeof(uint32_t) + 1)) continue;
+                auto frozen = std::make_shared<const FrozenTrie>(trie);
+                if (frozen->Bytes() >= memory.unique_bytes) continue;
+                std::lock_guard<std::mutex> lock(write_lock_);
+                // Only this thread replaces snapshots, so the version still has
+                // the one measured unless it has been reclaimed meanwhile.
+                if (version < snapshots_.Begin() || snapshots_[version].load(std::memory_order_relaxed) != snapshot) {
+                    continue;
+                }
+                snapshots_[version].store(new Snapshot{Trie(), snapshot->created, std::move(frozen)},
+                                          std::memory_order_release);
+                Retire(snapshot);
+                ReleaseRetired();
             }
+            return true;
+        }
+
+        // Return the log of a durable store, cleared for the next write, or nullptr.
+        // Must be called with write_lock_ held.
+        auto StartLog() -> TrieLog * {
+            if (!durable_) return nullptr;
+            durable_->log.Discard();
+            return &durable_->log;
+        }
 
-            std::shared_ptr<TrieNode> new_root = std::shared_ptr<TrieNode>(root_->Clone());
-            std::stack<std::pair<std::shared_ptr<TrieNode>, char> > path;
+        // Write the logged operations of new_trie, then publish it. Must be called
+        // with write_lock_ held.
+        auto PublishLogged(Trie new_trie) -> size_t {
+            if (durable_) {
+                durable_->log.Write(Latest() + 1);
+            }
+            return Publish(std::move(new_trie));
+        }
 
-            std::shared_ptr<TrieNode> current = new_root;
+        // Drop the logged operations of a write that changed nothing and return
+        // the newest version. Must be called with write_lock_ held.
+        auto Unchanged() -> size_t {
+            if (durable_) {
+                durable_->log.Discard();
+            }
+            return Latest();
+        }
 
-            // 遍历键的每个字符
-            for (char c: key) {
-                auto it = current->children_.find(c);
-                if (it == current->children_.end()) {
-                    return *this;
+        // Publish a trie received from a leader unless it has the same content as
+        // the newest version. A durable store logs the difference. Must be called
+        // with write_lock_ held.
+        auto PublishReplica(Trie new_trie) -> size_t {
+            const std::vector<TrieChange> changes = NewestTrie().Diff(new_trie);
+            if (changes.empty()) {
+                return Latest();
+            }
+            if (TrieLog *log = StartLog()) {
+                for (const TrieChange &change: changes) {
+                    log->AddChange(change);
                 }
+            }
+            return PublishLogged(std::move(new_trie));
+        }
+
+        // Take a checkpoint after version if options.checkpoint_every asks for one
+        // and no other checkpoint is being written.
+        void AutoCheckpoint(size_t version) {
+            if (!durable_ || durable_->options.checkpoint_every == 0 ||
+                version < durable_->checkpointed.load(std::memory_order_relaxed) +
+                          durable_->options.checkpoint_every) {
+                return;
+            }
+            std::unique_lock<std::mutex> lock(durable_->checkpoint_lock, std::try_to_lock);
+            if (lock) {
+                CheckpointLocked();
+            }
+        }
 
-                auto cloned_child = it->second->Clone();
-                current->children_[c] = std::shared_ptr<const TrieNode>(std::move(cloned_child));
-                path.push({current, c});
-                current = std::const_pointer_cast<TrieNode>(current->children_[c]);
+        // Checkpoint with checkpoint_lock held.
+        auto CheckpointLocked() -> size_t {
+            Trie trie;
+            size_t version;
+            {
+                std::lock_guard<std::mutex> lock(write_lock_);
+                trie = NewestTrie();
+                version = Latest();
+                if (version == durable_->checkpoint.Version()) {
+                    return version;
+                }
+                // 之后的写入进入新的日志段，检查点完成后旧段就可以删除
+                durable_->log.StartSegment(version + 1);
             }
+            durable_->checkpoint.Write(trie, version);
+            durable_->checkpointed.store(version, std::memory_order_relaxed);
+            RemoveSegments(version);
+            return version;
+        }
 
-            // 若当前节点不是值节点，无需删除
-            if (!(current->is_value_node_)) {
-                return *this;
+        // Delete the log segments holding only versions up to version.
+        void RemoveSegments(size_t version) {
+            const std::string &directory = durable_->options.directory;
+            for (uint64_t segment: TrieFile::List(directory, "wal-", ".log")) {
+                if (segment <= version) {
+                    std::filesystem::remove(TrieFile::Name(directory, "wal-", segment, ".log"));
+                }
             }
+            TrieFile::SyncDirectory(directory);
+        }
 
-            current->is_value_node_ = false;
-            current = std::dynamic_pointer_cast<TrieNode>(current);
+        // Destroy the retired tries no reader can still be using. Must be called
+        // with write_lock_ held.
+        void ReleaseRetired() {
+            const uint64_t oldest = EpochDomain::Global().Oldest();
+            std::erase_if(retired_, [oldest](const auto &retired) { return retired.first < oldest; });
+            std::erase_if(retired_snapshots_, [oldest](const auto &retired) { return retired.first < oldest; });
+            snapshots_.ReleaseRetired();
+        }
 
+        // Destroy snapshot, which has been unlinked from its slot, once no reader
+        // can still be using it. Must be called with write_lock_ held.
+        void Retire(const Snapshot *snapshot) {
+            retired_snapshots_.emplace_back(EpochDomain::Global().Advance(), snapshot);
+        }
 
-            // 反向遍历
-            while (!path.empty()) {
-                auto [parent, c] = path.top();
-                path.pop();
-                if (current->children_.empty() && !current->is_value_node_) {
-                    parent->children_.erase(c);
-                }
-                current = parent; // 回溯
+        // Whether the policy rules (ignoring pins) let version go. Both rules only
+        // ever give up versions from the oldest end.
+        auto Expendable(size_t version, Clock::time_point created, size_t latest, Clock::time_point now) const
+            -> bool {
+            if (policy_.max_versions == 0 && policy_.max_age == Clock::duration::zero()) {
+                return false;
             }
+            const bool by_count = policy_.max_versions == 0 || latest - version >= policy_.max_versions;
+            const bool by_age = policy_.max_age == Clock::duration::zero() || now - created >= policy_.max_age;
+            return by_count && by_age;
+        }
 
-            if (new_root->children_.empty() && !new_root->is_value_node_) {
-                return Trie();
+        // Reclaim every version the policy has given up since the last sweep,
+        // except pinned ones, which are reclaimed on their last Unpin.
+        void Sweep() {
+            const size_t latest = Latest();
+            const auto now = Clock::now();
+            while (swept_version_ < latest) {
+                const Snapshot *snapshot = snapshots_[swept_version_].load(std::memory_order_relaxed);
+                if (!Expendable(swept_version_, snapshot->created, latest, now)) {
+                    break;
+                }
+                if (pins_.find(swept_version_) == pins_.end()) {
+                    ReclaimSnapshot(swept_version_);
+                }
+                ++swept_version_;
             }
+        }
 
-            return Trie(new_root);
+        // Empty the slot of version, retire its snapshot, and trim the leading run
+        // of empty slots from the log.
+        void ReclaimSnapshot(size_t version) {
+            auto &slot = snapshots_[version];
+            Retire(slot.exchange(nullptr, std::memory_order_acq_rel));
+            size_t begin = snapshots_.Begin();
+            while (begin < version + 1 && snapshots_[begin].load(std::memory_order_relaxed) == nullptr) {
+                ++begin;
+            }
+            snapshots_.TrimFront(begin);
         }
-    };
 
+        // This mutex sequences all writes operations and allows only one write
+        // operation at a time. Concurrent modifications should have the effect of
+        // applying them in some sequential order
+        std::mutex write_lock_; //互斥锁，用于单一的增删
 
-    //——————————————————————————————————ValueGuard————————————————————————————————————————————————————————————————————//
+        // Stores the retained historical versions of trie, slot v holding version
+        // v, or nullptr once it has been reclaimed. Readers find and use a
+        // snapshot inside an EpochDomain guard; a snapshot is never changed, but
+        // replaced, and only by writers holding write_lock_.
+        VersionLog<std::atomic<const Snapshot *> > snapshots_;
+        //保存历史版本的trie，每次增删创建一个新的trie到这里面。被回收的版本留下一个空位，
+        //直到它前面的版本也都被回收，整段回收后释放该段
 
-    // This class is used to guard the value returned by the trie. It holds a
-    // reference to the root so that the reference to the value will not be
-    // invalidated.
-    template<class T>
-    class ValueGuard {
+        RetentionPolicy policy_;
+
+        // Versions below this one have been checked against the policy.
+        size_t swept_version_{0};
+
+        // Versions below this one have been considered for freezing. Guarded by
+        // write_lock_ and changed only with freeze_lock_ held as well, which
+        // keeps one thread at a time freezing.
+        size_t freeze_checked_{0};
+        std::mutex freeze_lock_;
+
+        // Pin counts of pinned versions.
+        std::unordered_map<size_t, size_t> pins_;
+
+        // The resource of every trie in snapshots_.
+        std::pmr::memory_resource *resource_;
+
+        // An owning copy of the newest trie and its number, published after the
+        // snapshot is in snapshots_, so that reads of the newest version take no
+        // lock. Readers use the trie inside an EpochDomain guard.
+        std::atomic<const Trie *> latest_{nullptr};
+        std::atomic<size_t> latest_version_{0};
+
+        // Tries replaced as the newest, each with the epoch it was retired at.
+        // Destroyed once EpochDomain::Oldest() has moved past the epoch.
+        std::vector<std::pair<uint64_t, std::unique_ptr<const Trie> > > retired_;
+
+        // Snapshots unlinked from snapshots_, retired alike.
+        std::vector<std::pair<uint64_t, std::unique_ptr<const Snapshot> > > retired_snapshots_;
+
+        // Batches submitted by GroupCommit, newest first, and whether a thread is
+        // applying them.
+        std::atomic<PendingCommit *> pending_{nullptr};
+        std::atomic<bool> combining_{false};
+
+        // The writer of PutAsync, RemoveAsync and CommitAsync, once one was called.
+        std::unique_ptr<AsyncWriter> async_;
+        std::mutex async_start_lock_;
+
+        // The log and checkpoints of a durable store.
+        struct Durability {
+            explicit Durability(const DurabilityOptions &options)
+                : options(options), log(options.directory, options.sync, options.sync_interval),
+                  checkpoint(options.directory, options.max_checkpoint_chain) {
+            }
+
+            DurabilityOptions options;
+            TrieLog log;
+            TrieCheckpoint checkpoint;
+            // Held while a checkpoint is written.
+            std::mutex checkpoint_lock;
+            // The version of the newest checkpoint.
+            std::atomic<size_t> checkpointed{0};
+        };
+
+        // Null unless the store is durable.
+        std::unique_ptr<Durability> durable_;
+
+        // The version of the leader a follower has applied last.
+        size_t replicated_version_{0};
+
+        // Interns every published version if set.
+        std::shared_ptr<TrieInterner> interner_;
+    };
+
+    //——————————————————————————————————ShardedTrieStore——————————————————————————————————————————————————————————————//
+
+    // A ShardedTrieStore spreads keys over independent TrieStore shards, each with
+    // its own writer, so writes to different shards run in parallel. Keys are
+    // routed by hash, or by first byte so that shards cover ascending key ranges
+    // and a prefix scan touches a single shard.
+    // A version of the whole store is a VersionVector holding one version per
+    // shard; Versions() returns one that is consistent across shards.
+    class ShardedTrieStore {
     public:
-        ValueGuard(Trie root, const T &value)
-            : root_(std::move(root)), value_(value) {
+        enum class Routing { kHash, kFirstByte };
+
+        using VersionVector = std::vector<size_t>;
+
+        // Create a store of shards shards. First-byte routing allows 256 at most.
+        explicit ShardedTrieStore(size_t shards, Routing routing = Routing::kHash, RetentionPolicy policy = {},
+                                  std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+            : routing_(routing) {
+            if (shards == 0 || (routing == Routing::kFirstByte && shards > 256)) {
+                throw std::invalid_argument("ShardedTrieStore: unsupported number of shards");
+            }
+            shards_.reserve(shards);
+            for (size_t i = 0; i < shards; ++i) {
+                shards_.push_back(std::make_unique<TrieStore>(policy, resource));
+            }
         }
 
-        auto operator*() const -> const T & { return value_; }
+        auto ShardCount() const -> size_t { return shards_.size(); }
 
-    private:
-        Trie root_;
-        const T &value_;
-    };
+        // Return the shard that holds key.
+        auto ShardOf(std::string_view key) const -> size_t {
+            if (routing_ == Routing::kHash) {
+                return std::hash<std::string_view>{}(key) % shards_.size();
+            }
+            return key.empty() ? 0 : static_cast<unsigned char>(key[0]) * shards_.size() / 256;
+        }
 
+        auto Shard(size_t shard) -> TrieStore & { return *shards_[shard]; }
 
-    //——————————————————————————————————TrieStore—————————————————————————————————————————————————————————————————————//
+        // Same as TrieStore::Get on the shard of key.
+        template<class T>
+        auto Get(std::string_view key) -> std::optional<ValueGuard<T> > {
+            return shards_[ShardOf(key)]->Get<T>(key);
+        }
 
-    // This class is a thread-safe wrapper around the Trie class. It provides a
-    // simple interface for accessing the trie. It should allow concurrent reads and
-    // a single write operation at the same time.
-    class TrieStore {
-    public:
-        // This function returns a ValueGuard object that holds a reference to the
-        // value in the trie of the given version (default: newest version). If the
-        // key does not exist in the trie, it will return std::nullopt.
-        //Get函数是一个模板函数，接受一个键（key）和一个版本号（version），返回一个std::optional<ValueGuard<T>>对象。
+        // Get key as of a version of the whole store.
         template<class T>
-        auto Get(std::string_view key, size_t version = -1) -> std::optional<ValueGuard<T> > {
-            size_t target_version;
-            Trie target_trie; {
-                //锁定快照：使用std::shared_lock<std::shared_mutex>锁定snapshots_lock_，
-                //以确保在读取快照时不会被其他线程修改。
-                std::shared_lock<std::shared_mutex> lock(snapshots_lock_);
-                //若版本号为-1，给最新版，否则给传入的版本
-                if (version == static_cast<size_t>(-1)) {
-                    if (snapshots_.empty()) return std::nullopt;
-                    target_version = snapshots_.size() - 1;
-                } else {
-                    target_version = version;
-                }
-                if (target_version >= snapshots_.size()) {
-                    return std::nullopt;
-                }
-                target_trie = snapshots_[target_version];
-            }
-            const T *value = target_trie.Get<T>(key);
-            if (!value) return std::nullopt;
-            return ValueGuard<T>(target_trie, *value);
+        auto Get(std::string_view key, const VersionVector &versions) -> std::optional<ValueGuard<T> > {
+            const size_t shard = ShardOf(key);
+            return shards_[shard]->Get<T>(key, versions[shard]);
         }
 
-        // This function will insert the key-value pair into the trie. If the key
-        // already exists in the trie, it will overwrite the value return the
-        // version number after operation Hint: new version should only be visible
-        // after the operation is committed(completed)
-        //lockguard和uniquelock都是不需要释放的，使用RAII机制，作用于结束后会自动释放
+        // Put key into its shard. Returns the new version of that shard.
         template<class T>
-        size_t Put(std::string_view key, T value) {
-            std::lock_guard<std::mutex> lock(write_lock_);
+        auto Put(std::string_view key, T value) -> size_t {
+            return shards_[ShardOf(key)]->Put<T>(key, std::move(value));
+        }
 
-            const Trie &current_trie = snapshots_.back();
-            Trie new_trie = current_trie.Put<T>(key, std::move(value)); {
-                std::unique_lock<std::shared_mutex> snapshot_lock(snapshots_lock_);
-                snapshots_.push_back(std::move(new_trie));
+        // Remove key from its shard. Returns the version of that shard afterwards.
+        auto Remove(std::string_view key) -> size_t {
+            return shards_[ShardOf(key)]->Remove(key);
+        }
+
+        // Split batch by shard and commit every part. The shards involved are
+        // locked together, and every part is applied before any is published, so
+        // a VersionVector from Versions() sees either none or all of the batch,
+        // also if applying a part throws. Returns the version of every shard
+        // afterwards. Counts as one commit in TrieStats, like TrieStore::Commit.
+        auto Commit(TrieStore::WriteBatch batch) -> VersionVector {
+            TrieStats::Timer timer(TrieStats::kCommitLatency);
+            TrieStats::Add(TrieStats::kCommits);
+            std::vector<TrieStore::WriteBatch> parts(shards_.size());
+            for (auto &op: batch.ops_) {
+                parts[ShardOf(op->key)].ops_.push_back(std::move(op));
+            }
+            std::deque<TrieStore::TimedWriteLock> locks;
+            for (size_t i = 0; i < shards_.size(); ++i) {
+                if (!parts[i].Empty()) {
+                    locks.emplace_back(shards_[i]->write_lock_);
+                }
+            }
+            std::vector<std::optional<Trie> > tries(shards_.size());
+            for (size_t i = 0; i < shards_.size(); ++i) {
+                if (!parts[i].Empty()) {
+                    tries[i] = shards_[i]->ApplyLocked(parts[i]);
+                }
+            }
+            VersionVector versions(shards_.size());
+            for (size_t i = 0; i < shards_.size(); ++i) {
+                if (tries[i]) {
+                    versions[i] = shards_[i]->PublishLogged(std::move(*tries[i]));
+                } else {
+                    versions[i] = parts[i].Empty() ? shards_[i]->get_version() : shards_[i]->Unchanged();
+                }
             }
-            return snapshots_.size() - 1;
+            return versions;
         }
 
-        // This function will remove the key-value pair from the trie.
-        // return the version number after operation
-        // if the key does not exist, version number should not be increased
-        size_t Remove(std::string_view key) {
-            std::lock_guard<std::mutex> lock(write_lock_);
-            const Trie &current_trie = snapshots_.back();
-            Trie new_trie = current_trie.Remove(key);
-            if (new_trie == current_trie) {
-                return snapshots_.size() - 1; // 无变化
-            } {
-                std::unique_lock<std::shared_mutex> snapshot_lock(snapshots_lock_);
-                snapshots_.push_back(std::move(new_trie));
+        // Return the newest version of every shard at one instant: no write is
+        // in progress on any shard while they are read.
+        auto Versions() -> VersionVector {
+            // 按分片顺序加锁，与Commit的顺序一致，不会死锁
+            std::vector<std::unique_lock<std::mutex> > locks;
+            for (auto &shard: shards_) {
+                locks.emplace_back(shard->write_lock_);
             }
-            return snapshots_.size() - 1;
+            VersionVector versions;
+            for (auto &shard: shards_) {
+                versions.push_back(shard->get_version());
+            }
+            return versions;
         }
 
-        // This function return the newest version number
-        size_t get_version() {
-            std::shared_lock<std::shared_mutex> lock(snapshots_lock_);
-            return snapshots_.empty() ? 0 : snapshots_.size() - 1;
+        // Iterate over the keys that start with prefix, as of versions. Returns one
+        // range per shard that may hold such keys; with first-byte routing a
+        // non-empty prefix needs a single shard, and the ranges come in ascending
+        // key order. Returns nullopt if a version is unavailable.
+        auto ScanPrefix(std::string_view prefix, const VersionVector &versions)
+            -> std::optional<std::vector<TrieRange> > {
+            std::vector<TrieRange> ranges;
+            auto scan = [&](size_t shard) {
+                auto range = shards_[shard]->ScanPrefix(prefix, versions[shard]);
+                if (range) {
+                    ranges.push_back(std::move(*range));
+                }
+                return range.has_value();
+            };
+            if (routing_ == Routing::kFirstByte && !prefix.empty()) {
+                if (!scan(ShardOf(prefix))) return std::nullopt;
+                return ranges;
+            }
+            for (size_t i = 0; i < shards_.size(); ++i) {
+                if (!scan(i)) return std::nullopt;
+            }
+            return ranges;
         }
 
     private:
-        // This mutex sequences all writes operations and allows only one write
-        // operation at a time. Concurrent modifications should have the effect of
-        // applying them in some sequential order
-        std::mutex write_lock_; //互斥锁，用于单一的增删
-        std::shared_mutex snapshots_lock_; //共享互斥锁，允许多线程同时读，但在写的时候独占锁
+        Routing routing_;
 
-        // Stores all historical versions of trie
-        // version number ranges from [0, snapshots_.size())
-        std::vector<Trie> snapshots_{1};
-        //保存历史版本的trie，每次增删创建一个新的trie到这里面，版本号的范围是[0, snapshots_.size())
+        std::vector<std::unique_ptr<TrieStore> > shards_;
     };
 } // namespace sjtu
 